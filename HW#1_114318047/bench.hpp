@@ -0,0 +1,269 @@
+#pragma once
+#include <algorithm> // for std::sort, std::max, std::min
+#include <chrono>
+#include <cmath> // for std::ceil, std::sin, std::cos
+#include <cstdint>
+#include <cstdlib> // for std::strtol
+#include <fstream>
+#include <iterator> // for std::begin, std::end
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImage, bmp::rowSizeBytes
+
+/********************************************************
+* Filename    : bench.hpp
+* Note        : Shared harness of the kernel benchmarks: timing with warm-up,
+*               median / p99, command line, CSV and JSON output
+*********************************************************/
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Wall times of the timed runs of one kernel, in seconds
+struct Stats {
+    int reps = 0;
+    double median = 0;
+    double p99 = 0; // nearest rank, the slowest run when there are fewer than 100
+    double min = 0;
+};
+
+// warmup untimed runs, then reps timed runs
+template <typename F>
+Stats measure(int warmup, int reps, F&& run) {
+    for (int i = 0; i < warmup; ++i) run();
+    std::vector<double> t;
+    t.reserve(reps);
+    for (int i = 0; i < reps; ++i) {
+        const Clock::time_point start = Clock::now();
+        run();
+        t.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    std::sort(t.begin(), t.end());
+
+    Stats s;
+    s.reps = reps;
+    s.median = t[t.size() / 2];
+    s.p99 = t[static_cast<size_t>(std::ceil(0.99 * t.size())) - 1];
+    s.min = t.front();
+    return s;
+}
+
+// Command line shared by the benchmarks
+/*
+    --sizes 256,1024   square image sizes (default 256 512 ... 16384)
+    --reps N           timed runs per kernel and size (default 15, fewer on large images)
+    --warmup N         untimed runs before them (default 2)
+    --only a,b         run only these kernels
+    --csv file         append the results as CSV (header written when the file is new)
+    --json file        write the results as a JSON array
+    --label text       tag of this run in the CSV / JSON, e.g. the commit
+    --threads N        threads of the hand-rolled kernels and of OpenCV
+*/
+struct Options {
+    std::vector<int> sizes;
+    int reps = 15;
+    int warmup = 2;
+    std::vector<std::string> only;
+    std::string csv;
+    std::string json;
+    std::string label;
+    int threads = 0; // 0 = one per core; the program stores the actual count here
+
+    bool wants(const std::string& kernel) const {
+        return only.empty() || std::find(only.begin(), only.end(), kernel) != only.end();
+    }
+
+    // Timed runs for an n x n image: the runs of the large sizes take long enough on
+    // their own, so reps shrinks with the pixel count above 1024 x 1024 (at least 3)
+    int repsFor(int n) const {
+        const double scale = (1024.0 * 1024.0) / (static_cast<double>(n) * n);
+        return std::max(std::min(reps, 3), std::min(reps, static_cast<int>(reps * scale)));
+    }
+};
+
+inline int parsePositive(const std::string& text, const char* option) {
+    char* end = nullptr;
+    const long v = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || v < 1 || v > (1 << 20)) {
+        throw std::invalid_argument(std::string(option) + " needs a positive number, got " + text);
+    }
+    return static_cast<int>(v);
+}
+
+inline std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        const size_t comma = std::min(text.find(',', begin), text.size());
+        if (comma > begin) items.push_back(text.substr(begin, comma - begin));
+        begin = comma + 1;
+    }
+    return items;
+}
+
+// Throws std::invalid_argument for an unknown option or a bad value
+inline Options parseOptions(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string name = arg.substr(0, eq);
+        static const char* const known[] = {"--sizes", "--reps", "--warmup", "--only", "--csv", "--json", "--label", "--threads"};
+        if (std::find(std::begin(known), std::end(known), name) == std::end(known)) {
+            throw std::invalid_argument("unknown option " + arg);
+        }
+        std::string value;
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+        } else {
+            if (i + 1 == argc) throw std::invalid_argument(arg + " needs a value");
+            value = argv[++i];
+        }
+
+        if (name == "--sizes") {
+            for (const std::string& s : splitList(value)) opt.sizes.push_back(parsePositive(s, "--sizes"));
+        } else if (name == "--reps") {
+            opt.reps = parsePositive(value, "--reps");
+        } else if (name == "--warmup") {
+            opt.warmup = value == "0" ? 0 : parsePositive(value, "--warmup");
+        } else if (name == "--only") {
+            opt.only = splitList(value);
+        } else if (name == "--csv") {
+            opt.csv = value;
+        } else if (name == "--json") {
+            opt.json = value;
+        } else if (name == "--label") {
+            opt.label = value;
+        } else {
+            opt.threads = parsePositive(value, "--threads");
+        }
+    }
+    if (opt.sizes.empty()) {
+        for (int n = 256; n <= 16384; n *= 2) opt.sizes.push_back(n);
+    }
+    return opt;
+}
+
+// One kernel, one implementation, one size
+struct Result {
+    std::string kernel; // e.g. "rotate"
+    std::string impl;   // "imgproc", "opencv" or "naive" (the original HW1 loops)
+    int size = 0;       // n x n pixels
+    Stats stats;
+
+    double megapixelsPerSecond() const {
+        return static_cast<double>(size) * size / 1e6 / stats.median;
+    }
+};
+
+// Collects the results, prints one line per result, writes the CSV / JSON files at the end
+class Report {
+public:
+    explicit Report(const Options& opt, const char* program) : opt_(opt), program_(program) {
+        std::cout << std::left << std::setw(16) << "kernel" << std::setw(10) << "impl" << std::right
+                  << std::setw(7) << "size" << std::setw(6) << "reps" << std::setw(13) << "median ms"
+                  << std::setw(13) << "p99 ms" << std::setw(12) << "MP/s" << "\n";
+    }
+
+    void add(const std::string& kernel, const std::string& impl, int size, const Stats& stats) {
+        Result r;
+        r.kernel = kernel;
+        r.impl = impl;
+        r.size = size;
+        r.stats = stats;
+        results_.push_back(r);
+        std::cout << std::left << std::setw(16) << kernel << std::setw(10) << impl << std::right
+                  << std::setw(7) << size << std::setw(6) << stats.reps << std::fixed << std::setprecision(3)
+                  << std::setw(13) << stats.median * 1e3 << std::setw(13) << stats.p99 * 1e3
+                  << std::setprecision(1) << std::setw(12) << r.megapixelsPerSecond() << "\n";
+    }
+
+    void write() const {
+        if (!opt_.csv.empty()) writeCSV(opt_.csv);
+        if (!opt_.json.empty()) writeJSON(opt_.json);
+    }
+
+private:
+    // CSV rows are appended, so several runs (commits) can share one file
+    void writeCSV(const std::string& path) const {
+        const bool fresh = !std::ifstream(path).good();
+        std::ofstream out(path, std::ios::app);
+        if (!out) throw std::runtime_error("cannot write " + path);
+        if (fresh) out << "label,program,threads,kernel,impl,size,reps,median_ms,p99_ms,min_ms,mpixel_per_s\n";
+        out << std::setprecision(6);
+        for (const Result& r : results_) {
+            out << csvField(opt_.label) << ',' << program_ << ',' << opt_.threads << ',' << r.kernel << ','
+                << r.impl << ',' << r.size << ',' << r.stats.reps << ',' << r.stats.median * 1e3 << ','
+                << r.stats.p99 * 1e3 << ',' << r.stats.min * 1e3 << ',' << r.megapixelsPerSecond() << '\n';
+        }
+    }
+
+    void writeJSON(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) throw std::runtime_error("cannot write " + path);
+        out << std::setprecision(6) << "[\n";
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const Result& r = results_[i];
+            out << "  {\"label\": " << jsonString(opt_.label) << ", \"program\": " << jsonString(program_)
+                << ", \"threads\": " << opt_.threads << ", \"kernel\": " << jsonString(r.kernel)
+                << ", \"impl\": " << jsonString(r.impl) << ", \"size\": " << r.size
+                << ", \"reps\": " << r.stats.reps << ", \"median_ms\": " << r.stats.median * 1e3
+                << ", \"p99_ms\": " << r.stats.p99 * 1e3 << ", \"min_ms\": " << r.stats.min * 1e3
+                << ", \"mpixel_per_s\": " << r.megapixelsPerSecond() << "}" << (i + 1 < results_.size() ? "," : "") << "\n";
+        }
+        out << "]\n";
+    }
+
+    static std::string csvField(const std::string& s) {
+        if (s.find_first_of(",\"\n") == std::string::npos) return s;
+        std::string q = "\"";
+        for (char c : s) q += c == '"' ? std::string("\"\"") : std::string(1, c);
+        return q + "\"";
+    }
+
+    static std::string jsonString(const std::string& s) {
+        std::string q = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') q += '\\';
+            if (static_cast<unsigned char>(c) < 0x20) continue; // no control characters in a label
+            q += c;
+        }
+        return q + "\"";
+    }
+
+    const Options& opt_;
+    std::string program_;
+    std::vector<Result> results_;
+};
+
+// n x n test image: smooth bright and dark blobs plus some noise, so thresholds and
+// morphology see regions of many sizes (the same pixels for the same n)
+inline bmp::BMPImage syntheticImage(int n) {
+    bmp::BMPImage img;
+    img.width = n;
+    img.height = n;
+    const int rowSize = bmp::rowSizeBytes(n);
+    img.data.assign(static_cast<size_t>(rowSize) * n, 0);
+    std::vector<double> columnWave(n);
+    for (int c = 0; c < n; ++c) columnWave[c] = std::cos(c * 0.047);
+    uint32_t seed = 12345;
+    for (int r = 0; r < n; ++r) {
+        uint8_t* px = &img.data[static_cast<size_t>(r) * rowSize];
+        const double wave = std::sin(r * 0.031) * 60.0;
+        for (int c = 0; c < n; ++c, px += 3) {
+            seed = seed * 1664525u + 1013904223u; // LCG noise in [-16, 15]
+            const int noise = static_cast<int>(seed >> 27) - 16;
+            const int v = 110 + static_cast<int>(wave * columnWave[c]) + noise;
+            px[0] = static_cast<uint8_t>(std::max(0, std::min(255, v - 10)));
+            px[1] = static_cast<uint8_t>(std::max(0, std::min(255, v + 5)));
+            px[2] = static_cast<uint8_t>(std::max(0, std::min(255, v)));
+        }
+    }
+    return img;
+}
+
+} // namespace bench
@@ -0,0 +1,171 @@
+#include "channels.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <cstring> // for std::memcpy, std::memset
+#include <stdexcept>
+#include <vector>
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+namespace imgproc {
+
+namespace {
+
+// pshufb control for one 128-bit lane: the first `pixels` pixels are permuted,
+// the remaining bytes of the lane are copied through unchanged
+struct LaneMask {
+    alignas(16) int8_t bytes[16];
+};
+
+// the 4-pixel lane mask repeated over a 512-bit register
+// (filled by hand: GCC's _mm512_broadcast_i32x4 trips -Wuninitialized)
+struct WideMask {
+    alignas(64) int8_t bytes[64];
+};
+
+LaneMask makeLaneMask(const ChannelOrder& order, int pixels) {
+    LaneMask m;
+    for (int b = 0; b < 16; ++b) m.bytes[b] = static_cast<int8_t>(b);
+    for (int p = 0; p < pixels; ++p) {
+        for (int i = 0; i < 3; ++i) {
+            m.bytes[p * 3 + i] = order[i] < 0 ? static_cast<int8_t>(-128) // 0x80 => zero
+                                              : static_cast<int8_t>(p * 3 + order[i]);
+        }
+    }
+    return m;
+}
+
+// Pixels [c, width) of one row, one pixel at a time
+void permuteTail(uint8_t* row, int c, int width, const ChannelOrder& order) {
+    for (uint8_t* px = row + c * 3; c < width; ++c, px += 3) {
+        const uint8_t src[3] = {px[0], px[1], px[2]}; // B, G, R before any write
+        px[0] = order[0] < 0 ? 0 : src[order[0]];
+        px[1] = order[1] < 0 ? 0 : src[order[1]];
+        px[2] = order[2] < 0 ? 0 : src[order[2]];
+    }
+}
+
+#if ACV_X86
+
+// 5 pixels (15 bytes) per 16-byte vector; byte 15 is the next pixel's B, written back as read
+ACV_TARGET("ssse3")
+int permuteRowSSSE3(uint8_t* row, int width, const LaneMask& five) {
+    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(five.bytes));
+    int c = 0;
+    for (; (c + 5) * 3 + 1 <= width * 3; c += 5) {
+        __m128i* p = reinterpret_cast<__m128i*>(row + c * 3);
+        _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+    }
+    return c;
+}
+
+// 8 pixels (24 bytes) per 32-byte vector
+/*
+    pshufb never crosses a 128-bit lane, so the 6 pixel dwords are first spread
+    3 + 3 over the two lanes (the 2 spare dwords fill slot 3), shuffled, and put back:
+    d0 d1 d2 d3 d4 d5 d6 d7  ->  [d0 d1 d2 d6 | d3 d4 d5 d7]  ->  pshufb  ->  d0' .. d5' d6 d7
+*/
+ACV_TARGET("avx2")
+int permuteRowAVX2(uint8_t* row, int width, const LaneMask& four) {
+    const __m128i lane = _mm_load_si128(reinterpret_cast<const __m128i*>(four.bytes));
+    const __m256i mask = _mm256_broadcastsi128_si256(lane);
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 6, 3, 4, 5, 7);
+    const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int c = 0;
+    for (; (c + 8) * 3 + 8 <= width * 3; c += 8) {
+        __m256i* p = reinterpret_cast<__m256i*>(row + c * 3);
+        __m256i v = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(p), spread);
+        v = _mm256_shuffle_epi8(v, mask);
+        _mm256_storeu_si256(p, _mm256_permutevar8x32_epi32(v, gather));
+    }
+    return c;
+}
+
+// 16 pixels (48 bytes) per 64-byte vector, same spreading as AVX2 over four lanes
+ACV_TARGET("avx512f,avx512bw")
+int permuteRowAVX512(uint8_t* row, int width, const WideMask& four) {
+    const __m512i mask = _mm512_load_si512(four.bytes);
+    // lane k = { d(3k), d(3k+1), d(3k+2), d(12+k) }
+    const __m512i spread = _mm512_setr_epi32(0, 1, 2, 12, 3, 4, 5, 13, 6, 7, 8, 14, 9, 10, 11, 15);
+    const __m512i gather = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 3, 7, 11, 15);
+    int c = 0;
+    for (; (c + 16) * 3 + 16 <= width * 3; c += 16) {
+        uint8_t* p = row + c * 3;
+        __m512i v = _mm512_maskz_permutexvar_epi32(0xFFFF, spread, _mm512_loadu_si512(p));
+        v = _mm512_shuffle_epi8(v, mask);
+        _mm512_storeu_si512(p, _mm512_maskz_permutexvar_epi32(0xFFFF, gather, v));
+    }
+    return c;
+}
+
+#endif // ACV_X86
+
+void checkOrder(const ChannelOrder& order) {
+    for (int i = 0; i < 3; ++i) {
+        if (order[i] < -1 || order[i] > 2) {
+            throw std::invalid_argument("permuteChannels: channel index must be -1, 0, 1 or 2");
+        }
+    }
+}
+
+} // namespace
+
+void permuteChannels(uint8_t* origin, std::ptrdiff_t stride, int width, int height, const ChannelOrder& order) {
+    TRACE_SPAN("imgproc: permute channels");
+    checkOrder(order);
+    if (order[0] == 0 && order[1] == 1 && order[2] == 2) return; // identity
+
+#if ACV_X86
+    const LaneMask four = makeLaneMask(order, 4);
+    const LaneMask five = makeLaneMask(order, 5);
+    WideMask wide;
+    for (int b = 0; b < 64; ++b) wide.bytes[b] = four.bytes[b % 16];
+    const bool avx512 = cpu::hasAVX512BW();
+    const bool avx2 = cpu::hasAVX2();
+    const bool ssse3 = cpu::hasSSSE3();
+#endif
+
+    parallel::parallelRows(height, parallel::kMinRowsPerBand, [&](int r0, int r1) {
+        for (int r = r0; r < r1; ++r) {
+            uint8_t* row = origin + r * stride;
+            int c = 0;
+#if ACV_X86
+            if (avx512) c = permuteRowAVX512(row, width, wide);
+            else if (avx2) c = permuteRowAVX2(row, width, four);
+            // the SSSE3 loop also mops up what is left after the wide kernels
+            if (ssse3) c += permuteRowSSSE3(row + c * 3, width - c, five);
+#endif
+            permuteTail(row, c, width, order);
+        }
+    });
+}
+
+void permuteChannels(PlanarImage& img, const ChannelOrder& order) {
+    TRACE_SPAN("imgproc: permute planes");
+    checkOrder(order);
+    const bool permutation = order[0] >= 0 && order[1] >= 0 && order[2] >= 0 && order[0] != order[1] &&
+                             order[0] != order[2] && order[1] != order[2];
+    if (permutation) {
+        const int planes[3] = {order[0], order[1], order[2]};
+        img.permutePlanes(planes);
+        return;
+    }
+
+    // a source plane may be overwritten before it is read: every band keeps a copy of its source rows
+    const int width = img.width();
+    parallel::parallelRows(img.height(), parallel::kMinRowsPerBand, [&](int r0, int r1) {
+        std::vector<uint8_t> src(3 * static_cast<size_t>(width));
+        for (int r = r0; r < r1; ++r) {
+            for (int ch = 0; ch < 3; ++ch) std::memcpy(&src[ch * width], img.row(ch, r), width);
+            for (int ch = 0; ch < 3; ++ch) {
+                if (order[ch] < 0) std::memset(img.row(ch, r), 0, width);
+                else std::memcpy(img.row(ch, r), &src[order[ch] * width], width);
+            }
+        }
+    });
+}
+
+} // namespace imgproc
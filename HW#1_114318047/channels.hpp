@@ -0,0 +1,49 @@
+#pragma once
+#include <array>
+#include <cstddef> // for std::ptrdiff_t
+#include <cstdint>
+#include "bmp.hpp" // bmp::BMPImage, bmp::Strip
+#include "planar.hpp" // imgproc::PlanarImage, imgproc::Layout
+
+namespace imgproc {
+
+// dst channel i takes src channel order[i] (0 = B, 1 = G, 2 = R), -1 fills it with 0
+/*
+    Same mappings as cv::mixChannels on one 3-channel image:
+    from_to = { 2,0, 0,1, 1,2 }  <=>  order = {2, 0, 1}   (HW1 task3: R=>G, G=>B, B=>R)
+    a source channel may be used more than once, e.g. {2, 2, 2} copies R into all three
+*/
+typedef std::array<int, 3> ChannelOrder;
+
+// Permute the channels of height rows of width BGR pixels in place
+// Rows start at origin and are stride bytes apart (may be negative); the row padding is not touched
+/*
+    The SIMD kernels (SSSE3 / AVX2 / AVX-512BW, picked at runtime) shuffle 5 / 8 / 16
+    pixels per instruction; a pixel never crosses a 128-bit lane, the bytes after the
+    last whole pixel of a vector are written back unchanged and the row tail is scalar
+*/
+void permuteChannels(uint8_t* origin, std::ptrdiff_t stride, int width, int height, const ChannelOrder& order);
+
+inline void permuteChannels(bmp::BMPImage& img, const ChannelOrder& order) {
+    permuteChannels(img.data.data(), bmp::rowSizeBytes(img.width), img.width, img.height, order);
+}
+
+inline void permuteChannels(bmp::Strip& strip, const ChannelOrder& order) {
+    permuteChannels(strip.data.data(), bmp::rowSizeBytes(strip.width), strip.width, strip.rows, order);
+}
+
+// The same on planes: a permutation of B, G, R only reorders the planes (no pixel is
+// touched); an order with a repeated channel or -1 copies / clears whole plane rows
+void permuteChannels(PlanarImage& img, const ChannelOrder& order);
+
+// permuteChannels for LazyImage::run, on planes
+struct PermuteChannelsKernel {
+    static const Layout layout = Layout::Planar;
+    ChannelOrder order;
+    void operator()(const PlanarImage& in, PlanarImage& out) const {
+        out = in;
+        permuteChannels(out, order);
+    }
+};
+
+} // namespace imgproc
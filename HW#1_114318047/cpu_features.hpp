@@ -0,0 +1,79 @@
+#pragma once
+
+// Runtime CPU feature detection for the SIMD kernels
+// The kernels are compiled for the target ISA with ACV_TARGET("ssse3") etc.
+// and only called after checking the matching has*() function, so the
+// executable still runs on CPUs without that extension
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ACV_X86 1
+#else
+#define ACV_X86 0
+#endif
+
+#if ACV_X86 && (defined(__GNUC__) || defined(__clang__))
+#define ACV_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ACV_TARGET(isa) // MSVC lets any intrinsic through without a target attribute
+#endif
+
+#if ACV_X86 && defined(_MSC_VER)
+#include <intrin.h> // __cpuid, __cpuidex, _xgetbv
+#endif
+
+namespace cpu {
+
+inline bool hasSSSE3() {
+#if ACV_X86 && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+#elif ACV_X86 && defined(_MSC_VER)
+    static const bool supported = [] {
+        int regs[4];
+        __cpuid(regs, 1);
+        return (regs[2] & (1 << 9)) != 0; // ECX bit 9 = SSSE3
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+#if ACV_X86 && defined(_MSC_VER)
+// CPUID leaf 7 EBX bit, only trusted when the OS saves the wide registers (XCR0)
+inline bool msvcLeaf7(int bit, unsigned long long xcr0Mask) {
+    int regs[4];
+    __cpuid(regs, 1);
+    if ((regs[2] & (1 << 27)) == 0) return false; // ECX bit 27 = OSXSAVE
+    if ((_xgetbv(0) & xcr0Mask) != xcr0Mask) return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << bit)) != 0;
+}
+#endif
+
+inline bool hasAVX2() {
+#if ACV_X86 && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#elif ACV_X86 && defined(_MSC_VER)
+    static const bool supported = msvcLeaf7(5, 0x6); // EBX bit 5 = AVX2, XMM+YMM state
+    return supported;
+#else
+    return false;
+#endif
+}
+
+// AVX-512 F + BW (512-bit byte shuffles)
+inline bool hasAVX512BW() {
+#if ACV_X86 && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    return supported;
+#elif ACV_X86 && defined(_MSC_VER)
+    static const bool supported = msvcLeaf7(16, 0xE6) && msvcLeaf7(30, 0xE6); // EBX bits 16/30, opmask+ZMM state
+    return supported;
+#else
+    return false;
+#endif
+}
+
+} // namespace cpu
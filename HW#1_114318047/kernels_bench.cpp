@@ -0,0 +1,195 @@
+#include <cstdio> // for std::remove
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "bench.hpp" // bench::Options, bench::Report, bench::measure
+#include "bmp.hpp"
+#include "rotate.hpp"
+#include "channels.hpp"
+#include "planar.hpp" // imgproc::PlanarImage, imgproc::deinterleave
+#include "point_ops.hpp" // imgproc::ops::pipe, imgproc::ops::run
+#include "resize.hpp"
+#include "resample.hpp"
+#include "thread_pool.hpp" // parallel::setThreads
+
+/********************************************************
+* Filename    : kernels_bench.cpp
+* Note        : Every HW1 kernel against the equivalent OpenCV call, on synthetic
+*               square images: BMP write / read, rotation, channel interchange
+*               (both also against the original HW1 loops, impl "naive")
+*               (interleaved, and on planes against cv::split / mixChannels /
+*               merge; as a point-op pipeline), nearest and bilinear resize
+*               (to half size)
+* Usage       : ./HW1_kernels_bench [--sizes 256,1024] [--reps N] [--warmup N]
+*               [--only rotate,...] [--csv file] [--json file] [--label text] [--threads N]
+*********************************************************/
+
+// The original HW1 task2 loop, the baseline of "rotate" (square images only)
+static void naiveRotate270(const bmp::BMPImage& img, std::vector<uint8_t>& out)
+{
+    const int N = img.width;
+    const int rowSize = bmp::rowSizeBytes(N);
+    for (int r = 0; r < N; ++r) {
+        const uint8_t* srcRow = &img.data[r * rowSize];
+        for (int c = 0; c < N; ++c) {
+            const uint8_t* srcPx = &srcRow[c * 3];
+            uint8_t* dstPx = &out[c * rowSize + (N - 1 - r) * 3];
+            dstPx[0] = srcPx[0];
+            dstPx[1] = srcPx[1];
+            dstPx[2] = srcPx[2];
+        }
+    }
+}
+
+// The original HW1 task3 loop, the baseline of "channel_permute": R=>G, G=>B, B=>R
+static void naiveSwap(bmp::BMPImage& img)
+{
+    const int rowSize = bmp::rowSizeBytes(img.width);
+    for (int r = 0; r < img.height; ++r) {
+        uint8_t* rowPtr = &img.data[r * rowSize];
+        for (int c = 0; c < img.width; ++c) {
+            uint8_t* px = &rowPtr[c * 3];
+            const uint8_t B = px[0], G = px[1], R = px[2];
+            px[0] = R;
+            px[1] = B;
+            px[2] = G;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bench::Options opt;
+    try {
+        opt = bench::parseOptions(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\nUsage: " << argv[0]
+                  << " [--sizes 256,1024] [--reps N] [--warmup N] [--only kernel,...]"
+                     " [--csv file] [--json file] [--label text] [--threads N]\n"
+                  << "Kernels: bmp_write bmp_read rotate channel_permute permute_planar permute_pipe\n"
+                  << "         resize_nearest resize_bilinear\n";
+        return 1;
+    }
+    parallel::setThreads(opt.threads);
+    if (opt.threads > 0) cv::setNumThreads(opt.threads); // 0 would make OpenCV single-threaded
+    opt.threads = parallel::pool().size(); // recorded in the CSV / JSON
+
+    const std::string ownFile = "kernels_bench_imgproc.bmp";
+    const std::string cvFile = "kernels_bench_opencv.bmp";
+    const imgproc::ChannelOrder order = {2, 0, 1};
+    const int from_to[] = { 2,0, 0,1, 1,2 };
+
+    try {
+        bench::Report report(opt, "HW1_kernels_bench");
+        for (int n : opt.sizes) {
+            bmp::BMPImage img = bench::syntheticImage(n);
+            const bmp::BMPImageView view = bmp::viewOf(img);
+            const int reps = opt.repsFor(n);
+            const int half = std::max(1, n / 2);
+
+            // cv::Mat over the same bottom-up rows (upside down for OpenCV, which does
+            // not change the amount of work)
+            cv::Mat cvSrc(n, n, CV_8UC3, img.data.data(), bmp::rowSizeBytes(n));
+            cv::Mat cvDst;
+            bmp::BMPImage dst;
+
+            if (opt.wants("bmp_write") || opt.wants("bmp_read")) {
+                // the files are written anyway, bmp_read needs them
+                const bench::Stats ownWrite = bench::measure(opt.warmup, reps, [&] { bmp::writeBMP(ownFile.c_str(), img); });
+                const bench::Stats cvWrite = bench::measure(opt.warmup, reps, [&] { cv::imwrite(cvFile, cvSrc); });
+                if (opt.wants("bmp_write")) {
+                    report.add("bmp_write", "imgproc", n, ownWrite);
+                    report.add("bmp_write", "opencv", n, cvWrite);
+                }
+            }
+            if (opt.wants("bmp_read")) {
+                report.add("bmp_read", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { dst = bmp::readBMP(ownFile.c_str()); }));
+                report.add("bmp_read", "opencv", n,
+                           bench::measure(opt.warmup, reps, [&] { cvDst = cv::imread(cvFile, cv::IMREAD_COLOR); }));
+            }
+            std::remove(ownFile.c_str());
+            std::remove(cvFile.c_str());
+
+            if (opt.wants("rotate")) {
+                std::vector<uint8_t> naiveOut(img.data.size());
+                report.add("rotate", "naive", n,
+                           bench::measure(opt.warmup, reps, [&] { naiveRotate270(img, naiveOut); }));
+                report.add("rotate", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { imgproc::rotate(view, dst, imgproc::Rotation::CW270); }));
+                report.add("rotate", "opencv", n,
+                           bench::measure(opt.warmup, reps, [&] { cv::rotate(cvSrc, cvDst, cv::ROTATE_90_CLOCKWISE); }));
+                if (dst.data != naiveOut)
+                    std::cout << "warning: rotate differs from the naive loop at size " << n << "\n";
+            }
+
+            if (opt.wants("channel_permute")) {
+                // in place, as HW1 task3 does; mixChannels needs a separate destination
+                bmp::BMPImage work = img;
+                bmp::BMPImage naiveWork = img;
+                cvDst = cv::Mat(cvSrc.size(), cvSrc.type());
+                const bench::Stats naive = bench::measure(opt.warmup, reps, [&] { naiveSwap(naiveWork); });
+                report.add("channel_permute", "naive", n, naive);
+                const bench::Stats own = bench::measure(opt.warmup, reps, [&] { imgproc::permuteChannels(work, order); });
+                report.add("channel_permute", "imgproc", n, own);
+                report.add("channel_permute", "opencv", n,
+                           bench::measure(opt.warmup, reps, [&] { cv::mixChannels(&cvSrc, 1, &cvDst, 1, from_to, 3); }));
+                // both permuted in place warmup + reps times, so they end on the same pixels
+                if (naive.reps == own.reps && work.data != naiveWork.data)
+                    std::cout << "warning: channel_permute differs from the naive loop at size " << n << "\n";
+            }
+
+            if (opt.wants("permute_pipe")) {
+                // task3 written as pipe(permute<2, 0, 1>(), toBgr), in place
+                using namespace imgproc::ops;
+                bmp::BMPImage work = img;
+                cvDst = cv::Mat(cvSrc.size(), cvSrc.type());
+                report.add("permute_pipe", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { run(work, pipe(permute<2, 0, 1>(), toBgr)); }));
+                report.add("permute_pipe", "opencv", n,
+                           bench::measure(opt.warmup, reps, [&] { cv::mixChannels(&cvSrc, 1, &cvDst, 1, from_to, 3); }));
+            }
+
+            if (opt.wants("permute_planar")) {
+                // the whole round trip: planes, permutation (only the slots move), interleaved again
+                imgproc::PlanarImage planes;
+                cv::Mat cvPlanes[3], cvPermuted[3];
+                report.add("permute_planar", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                    imgproc::deinterleave(view, planes);
+                    imgproc::permuteChannels(planes, order);
+                    imgproc::interleave(planes, dst);
+                }));
+                report.add("permute_planar", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::split(cvSrc, cvPlanes);
+                    for (int i = 0; i < 3; ++i) cvPermuted[i] = cvPlanes[order[i]];
+                    cv::merge(cvPermuted, 3, cvDst);
+                }));
+            }
+
+            if (opt.wants("resize_nearest")) {
+                const imgproc::Factor f = imgproc::Factor::shrink(2);
+                report.add("resize_nearest", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { imgproc::resizeNearest(view, dst, f, f); }));
+                report.add("resize_nearest", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::resize(cvSrc, cvDst, cv::Size(half, half), 0, 0, cv::INTER_NEAREST);
+                }));
+            }
+
+            if (opt.wants("resize_bilinear")) {
+                report.add("resize_bilinear", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                    imgproc::resample(view, dst, half, half, imgproc::Filter::Bilinear);
+                }));
+                report.add("resize_bilinear", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::resize(cvSrc, cvDst, cv::Size(half, half), 0, 0, cv::INTER_LINEAR);
+                }));
+            }
+        }
+        report.write();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
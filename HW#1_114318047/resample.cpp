@@ -0,0 +1,303 @@
+#include "resample.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <cmath>
+#include <cstring> // for std::memcpy, std::memset
+#include <algorithm> // for std::min, std::max
+#include <stdexcept>
+#include <vector>
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+namespace imgproc {
+
+namespace {
+
+const int kPrecision = 14;                 // weights are fixed point with 14 fraction bits
+const int kOne = 1 << kPrecision;          // a weight of 1.0
+const int kHalf = 1 << (kPrecision - 1);   // rounding term before the shift
+const double kPi = 3.14159265358979323846;
+
+// Fewer rows than this per band and the source rows shared by two bands
+// (filtered horizontally by both) cost more than the band saves
+const int kMinRowsPerFilterBand = 32;
+
+double sinc(double x) {
+    if (x == 0.0) return 1.0;
+    x *= kPi;
+    return std::sin(x) / x;
+}
+
+double support(Filter filter) {
+    switch (filter) {
+        case Filter::Bilinear: return 1.0;
+        case Filter::Bicubic: return 2.0;
+        case Filter::Lanczos3: return 3.0;
+    }
+    return 1.0;
+}
+
+double kernel(Filter filter, double x) {
+    x = std::fabs(x);
+    switch (filter) {
+        case Filter::Bilinear:
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case Filter::Bicubic: {
+            const double a = -0.5;
+            if (x < 1.0) return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+            if (x < 2.0) return ((a * x - 5.0 * a) * x + 8.0 * a) * x - 4.0 * a;
+            return 0.0;
+        }
+        case Filter::Lanczos3:
+            return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+    return 0.0;
+}
+
+// Filter taps of one axis: output i = sum_k coef[i * count + k] * input[start[i] + k]
+// count is even so that taps can be taken in pairs; start may be negative or run past
+// the end of the input, those taps read the replicated edge
+struct Taps {
+    int count = 0;
+    std::vector<int> start;
+    std::vector<int16_t> coef;
+    std::vector<int32_t> pairs; // taps (k, k+1) packed as two int16 in one int32, for pmaddwd
+};
+
+/*
+    Output pixel i covers input [i * scale, (i + 1) * scale), its center is (i + 0.5) * scale
+    and input sample x sits at x + 0.5; when shrinking (scale > 1) the kernel is widened by
+    scale so every input pixel contributes, when enlarging it keeps its own support
+*/
+Taps computeTaps(int srcSize, int dstSize, Filter filter) {
+    const double scale = static_cast<double>(srcSize) / dstSize;
+    const double filterScale = std::max(scale, 1.0);
+    const double reach = support(filter) * filterScale;
+
+    // first pass: real weights over a generous window, trimmed to the non-zero taps
+    const int window = static_cast<int>(std::ceil(reach)) * 2 + 2;
+    std::vector<double> weights(static_cast<size_t>(dstSize) * window);
+    std::vector<int> first(dstSize), last(dstSize);
+    int count = 2;
+    for (int i = 0; i < dstSize; ++i) {
+        const double center = (i + 0.5) * scale;
+        const int x0 = static_cast<int>(std::floor(center - reach));
+        double* w = &weights[static_cast<size_t>(i) * window];
+        double sum = 0.0;
+        first[i] = window;
+        last[i] = -1;
+        for (int k = 0; k < window; ++k) {
+            w[k] = kernel(filter, (x0 + k + 0.5 - center) / filterScale);
+            sum += w[k];
+            if (w[k] != 0.0) {
+                first[i] = std::min(first[i], k);
+                last[i] = k;
+            }
+        }
+        for (int k = 0; k < window; ++k) w[k] /= sum;
+        count = std::max(count, last[i] - first[i] + 1);
+    }
+    count += count & 1; // round up to a whole number of pairs
+
+    // second pass: 14-bit weights, the rounding error goes to the largest tap so
+    // every output sums to exactly 1.0 and flat areas stay flat
+    Taps taps;
+    taps.count = count;
+    taps.start.resize(dstSize);
+    taps.coef.assign(static_cast<size_t>(dstSize) * count, 0);
+    for (int i = 0; i < dstSize; ++i) {
+        const double center = (i + 0.5) * scale;
+        const int x0 = static_cast<int>(std::floor(center - reach));
+        const double* w = &weights[static_cast<size_t>(i) * window];
+        int16_t* c = &taps.coef[static_cast<size_t>(i) * count];
+        taps.start[i] = x0 + first[i];
+
+        int sum = 0;
+        int largest = 0;
+        for (int k = 0; first[i] + k <= last[i]; ++k) {
+            c[k] = static_cast<int16_t>(std::lround(w[first[i] + k] * kOne));
+            sum += c[k];
+            if (std::abs(c[k]) > std::abs(c[largest])) largest = k;
+        }
+        c[largest] = static_cast<int16_t>(c[largest] + (kOne - sum));
+    }
+
+    taps.pairs.resize(taps.coef.size() / 2);
+    for (size_t j = 0; j < taps.pairs.size(); ++j) {
+        const uint16_t lo = static_cast<uint16_t>(taps.coef[2 * j]);
+        const uint16_t hi = static_cast<uint16_t>(taps.coef[2 * j + 1]);
+        taps.pairs[j] = static_cast<int32_t>(lo | (static_cast<uint32_t>(hi) << 16));
+    }
+    return taps;
+}
+
+inline uint8_t clamp8(int v) {
+    return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Horizontal pass over one padded row (pad pixels of replicated edge on the left)
+void horizontalScalar(const uint8_t* padded, int pad, uint8_t* out, int dstWidth, const Taps& tx) {
+    for (int i = 0; i < dstWidth; ++i) {
+        const uint8_t* p = padded + (tx.start[i] + pad) * 3;
+        const int16_t* c = &tx.coef[static_cast<size_t>(i) * tx.count];
+        int b = kHalf, g = kHalf, r = kHalf;
+        for (int k = 0; k < tx.count; ++k, p += 3) {
+            b += p[0] * c[k];
+            g += p[1] * c[k];
+            r += p[2] * c[k];
+        }
+        out[i * 3 + 0] = clamp8(b >> kPrecision);
+        out[i * 3 + 1] = clamp8(g >> kPrecision);
+        out[i * 3 + 2] = clamp8(r >> kPrecision);
+    }
+}
+
+// Vertical pass: out[i] = sum_k coef[k] * rows[k][i] over bytes [from, bytes)
+void verticalScalar(const uint8_t* const* rows, const int16_t* coef, int count, uint8_t* out, int from, int bytes) {
+    for (int i = from; i < bytes; ++i) {
+        int acc = kHalf;
+        for (int k = 0; k < count; ++k) acc += rows[k][i] * coef[k];
+        out[i] = clamp8(acc >> kPrecision);
+    }
+}
+
+#if ACV_X86
+
+// Horizontal pass, one output pixel per iteration, two taps per pmaddwd
+/*
+    8 bytes at tap k = pixels k and k+1 (+2 spare bytes), widened and interleaved to
+    words [B0 B1 G0 G1 R0 R1 0 0]; pmaddwd with [c0 c1 c0 c1 ...] gives [B G R 0] in int32
+    the result is stored as 4 bytes, the 4th is overwritten by the next pixel
+    (each ring row has one spare byte at the end for the last one)
+*/
+ACV_TARGET("ssse3")
+void horizontalSSSE3(const uint8_t* padded, int pad, uint8_t* out, int dstWidth, const Taps& tx) {
+    const __m128i widen = _mm_setr_epi8(0, -128, 3, -128, 1, -128, 4, -128, 2, -128, 5, -128, -128, -128, -128, -128);
+    const __m128i round = _mm_set1_epi32(kHalf);
+    for (int i = 0; i < dstWidth; ++i) {
+        const uint8_t* p = padded + (tx.start[i] + pad) * 3;
+        const int32_t* pairs = &tx.pairs[static_cast<size_t>(i) * tx.count / 2];
+        __m128i acc = round;
+        for (int k = 0; k < tx.count / 2; ++k, p += 6) {
+            const __m128i px = _mm_shuffle_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), widen);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(pairs[k])));
+        }
+        acc = _mm_srai_epi32(acc, kPrecision);
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+        const int32_t bgr = _mm_cvtsi128_si32(packed);
+        std::memcpy(out + i * 3, &bgr, 4);
+    }
+}
+
+// Vertical pass, 16 bytes per iteration, two rows per pmaddwd; returns bytes done
+ACV_TARGET("ssse3")
+int verticalSSSE3(const uint8_t* const* rows, const int32_t* pairs, int count, uint8_t* out, int bytes) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(kHalf);
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+        for (int k = 0; k < count; k += 2) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + i));
+            const __m128i c = _mm_set1_epi32(pairs[k / 2]);
+            const __m128i aLo = _mm_unpacklo_epi8(a, zero), aHi = _mm_unpackhi_epi8(a, zero);
+            const __m128i bLo = _mm_unpacklo_epi8(b, zero), bHi = _mm_unpackhi_epi8(b, zero);
+            // [a0 b0 a1 b1 ...] * [c0 c1 c0 c1 ...] => a0*c0 + b0*c1, ...
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(aLo, bLo), c));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(aLo, bLo), c));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(aHi, bHi), c));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(aHi, bHi), c));
+        }
+        const __m128i lo = _mm_packs_epi32(_mm_srai_epi32(acc0, kPrecision), _mm_srai_epi32(acc1, kPrecision));
+        const __m128i hi = _mm_packs_epi32(_mm_srai_epi32(acc2, kPrecision), _mm_srai_epi32(acc3, kPrecision));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+#endif // ACV_X86
+
+} // namespace
+
+void resample(const bmp::BMPImageView& src, bmp::BMPImage& dst, int dstWidth, int dstHeight, Filter filter) {
+    TRACE_SPAN("imgproc: resample");
+    if (dstWidth <= 0 || dstHeight <= 0) {
+        throw std::invalid_argument("resample: output size must be positive");
+    }
+
+    const Taps tx = computeTaps(src.width, dstWidth, filter);
+    const Taps ty = computeTaps(src.height, dstHeight, filter);
+
+    // source rows are copied into a buffer with replicated edges, so the horizontal
+    // pass never needs a bounds check (right side: +1 pixel and 8 bytes for the 8-byte loads)
+    int lowest = 0, highest = src.width;
+    for (int i = 0; i < dstWidth; ++i) {
+        lowest = std::min(lowest, tx.start[i]);
+        highest = std::max(highest, tx.start[i] + tx.count + 1);
+    }
+    const int padLeft = -lowest;
+    const int padRight = highest - src.width;
+    const int rowBytes = dstWidth * 3;
+
+    dst.width = dstWidth;
+    dst.height = dstHeight;
+    const int dstRow = bmp::rowSizeBytes(dstWidth);
+    dst.data.resize(static_cast<size_t>(dstRow) * dstHeight);
+
+#if ACV_X86
+    const bool simd = cpu::hasSSSE3();
+#else
+    const bool simd = false;
+#endif
+
+    // bands of dst rows in parallel, every band with its own buffers
+    parallel::parallelRows(dstHeight, kMinRowsPerFilterBand, [&](int y0, int y1) {
+        std::vector<uint8_t> padded(static_cast<size_t>(padLeft + src.width + padRight) * 3 + 8);
+
+        // ring of horizontally filtered rows, slot = source row % ty.count
+        // (one spare byte per row for the 4-byte stores of the horizontal pass)
+        const int ringStride = rowBytes + 1;
+        std::vector<uint8_t> ring(static_cast<size_t>(ty.count) * ringStride);
+        std::vector<int> slotRow(ty.count, -1);
+        std::vector<const uint8_t*> rows(ty.count);
+
+        for (int y = y0; y < y1; ++y) {
+            for (int k = 0; k < ty.count; ++k) {
+                const int sr = std::min(std::max(ty.start[y] + k, 0), src.height - 1);
+                const int slot = sr % ty.count;
+                uint8_t* filtered = &ring[static_cast<size_t>(slot) * ringStride];
+                if (slotRow[slot] != sr) {
+                    // horizontal pass, once per source row (per band)
+                    const uint8_t* in = src.row(sr);
+                    uint8_t* p = padded.data();
+                    for (int x = 0; x < padLeft; ++x, p += 3) std::memcpy(p, in, 3);
+                    std::memcpy(p, in, static_cast<size_t>(src.width) * 3);
+                    p += src.width * 3;
+                    for (int x = 0; x < padRight; ++x, p += 3) std::memcpy(p, in + (src.width - 1) * 3, 3);
+#if ACV_X86
+                    if (simd) horizontalSSSE3(padded.data(), padLeft, filtered, dstWidth, tx);
+                    else
+#endif
+                        horizontalScalar(padded.data(), padLeft, filtered, dstWidth, tx);
+                    slotRow[slot] = sr;
+                }
+                rows[k] = filtered;
+            }
+
+            uint8_t* out = &dst.data[static_cast<size_t>(y) * dstRow];
+            const int16_t* coef = &ty.coef[static_cast<size_t>(y) * ty.count];
+            int done = 0;
+#if ACV_X86
+            if (simd) done = verticalSSSE3(rows.data(), &ty.pairs[static_cast<size_t>(y) * ty.count / 2], ty.count, out, rowBytes);
+#endif
+            verticalScalar(rows.data(), coef, ty.count, out, done, rowBytes);
+            std::memset(out + rowBytes, 0, dstRow - rowBytes); // row padding
+        }
+    });
+}
+
+} // namespace imgproc
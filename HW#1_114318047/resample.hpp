@@ -0,0 +1,37 @@
+#pragma once
+#include "bmp.hpp" // bmp::BMPImage, bmp::BMPImageView
+
+namespace imgproc {
+
+// Interpolation kernels for resample()
+enum class Filter {
+    Bilinear, // triangle, support 1      (= cv::INTER_LINEAR when enlarging)
+    Bicubic,  // Keys cubic a = -0.5, support 2
+    Lanczos3  // sinc(x) * sinc(x / 3), support 3
+};
+
+// Resize src to dstWidth x dstHeight with a separable filter, any (non-integer) scale
+// dst is resized, so reusing the same dst between calls does not reallocate
+/*
+    The filter taps for every output column and every output row are computed once
+    up front as 14-bit fixed-point int16 weights (each set sums to exactly 1 << 14).
+    When shrinking, the kernel is stretched by the scale factor so it also low-passes.
+
+    horizontal pass: src row -> dstWidth pixels, 2 taps per pmaddwd (SSSE3)
+    vertical pass:   the horizontally filtered rows live in a ring buffer of as many
+                     rows as the vertical kernel has taps, every src row is filtered
+                     horizontally once, then 16 bytes per pmaddwd pair
+    dst rows are split into bands over the thread pool, each band has its own ring
+    (the few src rows shared by two bands are filtered by both)
+
+    Pixels outside the image repeat the edge pixel (like BORDER_REPLICATE)
+*/
+void resample(const bmp::BMPImageView& src, bmp::BMPImage& dst, int dstWidth, int dstHeight, Filter filter);
+
+inline bmp::BMPImage resample(const bmp::BMPImageView& src, int dstWidth, int dstHeight, Filter filter) {
+    bmp::BMPImage dst;
+    resample(src, dst, dstWidth, dstHeight, filter);
+    return dst;
+}
+
+} // namespace imgproc
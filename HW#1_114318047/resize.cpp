@@ -0,0 +1,154 @@
+#include "resize.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <cstring> // for std::memcpy, std::memset
+#include <algorithm> // for std::min, std::max
+#include <stdexcept>
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+namespace imgproc {
+
+namespace {
+
+inline void copyPixel(uint8_t* dst, const uint8_t* src) {
+    dst[0] = src[0]; // B
+    dst[1] = src[1]; // G
+    dst[2] = src[2]; // R
+}
+
+// Destination pixels [c, dstWidth), one at a time
+void resizeTail(const uint8_t* src, uint8_t* dst, int c, int dstWidth, Factor fx) {
+    if (fx.up == 1) {
+        // shrinking: src index grows by fx.down per pixel
+        for (const uint8_t* s = src + static_cast<size_t>(c) * fx.down * 3; c < dstWidth; ++c, s += fx.down * 3) {
+            copyPixel(dst + c * 3, s);
+        }
+        return;
+    }
+    for (; c < dstWidth; ++c) {
+        copyPixel(dst + c * 3, src + fx.source(c) * 3);
+    }
+}
+
+#if ACV_X86
+
+// Enlarge by k = 2..4: 5 destination pixels per 16-byte store
+/*
+    dst pixels o..o+4 come from src pixels o/k .. (o+4)/k, at most 5 source pixels,
+    so one 16-byte load at src pixel o/k covers them; which source pixel each
+    destination pixel takes only depends on the phase o % k, one mask per phase
+    byte 15 of every store is overwritten by the next store (or the scalar tail)
+*/
+ACV_TARGET("ssse3")
+int expandSmallSSSE3(const uint8_t* src, int srcWidth, uint8_t* dst, int dstWidth, int k) {
+    __m128i mask[4];
+    for (int phase = 0; phase < k; ++phase) {
+        alignas(16) int8_t m[16];
+        m[15] = -128;
+        for (int i = 0; i < 5; ++i) {
+            const int from = (phase + i) / k;
+            for (int b = 0; b < 3; ++b) m[i * 3 + b] = static_cast<int8_t>(from * 3 + b);
+        }
+        mask[phase] = _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+    }
+
+    int o = 0;
+    int phase = 0;
+    for (; o * 3 + 16 <= dstWidth * 3 && (o / k) * 3 + 16 <= srcWidth * 3; o += 5) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (o / k) * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + o * 3), _mm_shuffle_epi8(v, mask[phase]));
+        phase = (phase + 5) % k;
+    }
+    return o;
+}
+
+// Enlarge by k >= 5: every source pixel becomes a run of 3k bytes, written as 16-byte
+// stores of the repeating BGR pattern; the run's last store may spill into the next
+// pixel's run, which is written afterwards, but never past the end of the row
+/*
+    16 % 3 == 1, so store j of a run starts with channel j % 3:
+    j=0: B G R B G R ... B    j=1: G R B ... G    j=2: R B G ... R
+*/
+ACV_TARGET("ssse3")
+int expandLargeSSSE3(const uint8_t* src, uint8_t* dst, int dstWidth, int k) {
+    __m128i pattern[3];
+    for (int start = 0; start < 3; ++start) {
+        alignas(16) int8_t m[16];
+        for (int i = 0; i < 16; ++i) m[i] = static_cast<int8_t>((start + i) % 3);
+        pattern[start] = _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+    }
+
+    const int rowEnd = dstWidth * 3;
+    const int runBytes = k * 3;
+    int s = 0;
+    for (; (s + 1) * runBytes <= rowEnd; ++s) {
+        const uint8_t* px = src + s * 3;
+        const __m128i bgr = _mm_cvtsi32_si128(px[0] | (px[1] << 8) | (px[2] << 16));
+        uint8_t* run = dst + s * runBytes;
+        int j = 0;
+        for (; j * 16 < runBytes && s * runBytes + j * 16 + 16 <= rowEnd; ++j) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(run + j * 16), _mm_shuffle_epi8(bgr, pattern[j % 3]));
+        }
+        if (j * 16 < runBytes) break; // too close to the row end, the scalar tail does the rest
+    }
+    return s * k;
+}
+
+#endif // ACV_X86
+
+} // namespace
+
+void resizeRowNearest(const uint8_t* src, int srcWidth, uint8_t* dst, int dstWidth, Factor fx) {
+    if (fx.up == 1 && fx.down == 1) {
+        std::memcpy(dst, src, static_cast<size_t>(std::min(srcWidth, dstWidth)) * 3);
+        return;
+    }
+
+    int c = 0;
+#if ACV_X86
+    if (fx.down == 1 && cpu::hasSSSE3()) {
+        c = fx.up <= 4 ? expandSmallSSSE3(src, srcWidth, dst, dstWidth, fx.up)
+                       : expandLargeSSSE3(src, dst, dstWidth, fx.up);
+    }
+#endif
+    resizeTail(src, dst, c, dstWidth, fx);
+}
+
+void resizeNearest(const bmp::BMPImageView& src, bmp::BMPImage& dst, Factor fx, Factor fy) {
+    TRACE_SPAN("imgproc: resize nearest");
+    if (fx.up < 1 || fx.down < 1 || fy.up < 1 || fy.down < 1) {
+        throw std::invalid_argument("resizeNearest: scale factors must be positive");
+    }
+    const int dstW = fx.apply(src.width);
+    const int dstH = fy.apply(src.height);
+    if (dstW <= 0 || dstH <= 0) {
+        throw std::invalid_argument("resizeNearest: image is smaller than the shrink factor");
+    }
+
+    dst.width = dstW;
+    dst.height = dstH;
+    const int dstRow = bmp::rowSizeBytes(dstW);
+    const int padding = dstRow - dstW * 3;
+    dst.data.resize(static_cast<size_t>(dstRow) * dstH);
+    uint8_t* out = dst.data.data();
+
+    parallel::parallelRows(dstH, parallel::kMinRowsPerBand, [&](int r0, int r1) {
+        for (int r = r0; r < r1; ++r) {
+            uint8_t* row = out + static_cast<size_t>(r) * dstRow;
+            // same source row as the row below it: replicate instead of rebuilding
+            if (r > r0 && fy.source(r) == fy.source(r - 1)) {
+                std::memcpy(row, row - dstRow, dstRow);
+                continue;
+            }
+            resizeRowNearest(src.row(fy.source(r)), src.width, row, dstW, fx);
+            // zero the row padding once here; the replicated rows copy it along with the pixels
+            if (padding) std::memset(row + dstW * 3, 0, padding);
+        }
+    });
+}
+
+} // namespace imgproc
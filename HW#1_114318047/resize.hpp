@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include "bmp.hpp" // bmp::BMPImage, bmp::BMPImageView
+
+namespace imgproc {
+
+// Integer scale factor along one axis: size * up / down
+// Nearest neighbour maps destination index i to source index i * down / up
+/*
+    Factor::enlarge(8)  => 512 -> 4096, dst 0..7 <- src 0, dst 8..15 <- src 1 ...
+    Factor::shrink(2)   => 512 -> 256,  dst i <- src 2i (odd sizes round down)
+*/
+struct Factor {
+    int up = 1;
+    int down = 1;
+
+    static Factor enlarge(int n) { Factor f; f.up = n; return f; }
+    static Factor shrink(int n) { Factor f; f.down = n; return f; }
+
+    int apply(int size) const { return static_cast<int>(static_cast<long long>(size) * up / down); }
+    int source(int dstIndex) const { return static_cast<int>(static_cast<long long>(dstIndex) * down / up); }
+};
+
+// Build one destination row of dstWidth pixels from a source row (no padding written)
+// Enlarging uses a SIMD pixel-expansion kernel when SSSE3 is available
+void resizeRowNearest(const uint8_t* src, int srcWidth, uint8_t* dst, int dstWidth, Factor fx);
+
+// Nearest-neighbour resize by integer factors, dst is resized (reusing dst does not reallocate)
+/*
+    When enlarging vertically, each distinct destination row is built once and the
+    other fy.up - 1 copies are memcpy'd; rows are split into bands over all cores
+*/
+void resizeNearest(const bmp::BMPImageView& src, bmp::BMPImage& dst, Factor fx, Factor fy);
+
+inline bmp::BMPImage resizeNearest(const bmp::BMPImageView& src, Factor fx, Factor fy) {
+    bmp::BMPImage dst;
+    resizeNearest(src, dst, fx, fy);
+    return dst;
+}
+
+} // namespace imgproc
@@ -0,0 +1,205 @@
+#include "rotate.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <cstring> // for std::memcpy
+#include <algorithm> // for std::min
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+namespace imgproc {
+
+namespace {
+
+// Tile edge in pixels: 32 rows * 32 pixels * 3 bytes = 3 KB per side,
+// source and destination tile together stay well inside a 32 KB L1
+const int kTile = 32;
+
+/*
+    Coordinates below are storage coordinates (row 0 = bottom row, like BMPImage::data)
+    src is W x H, dst is H x W for the two transposing rotations
+
+    CW270: dst(r, c) = src(H-1-c, r)      (the HW1 task2 loop: (r,c) -> (c, N-1-r))
+    CW90:  dst(r, c) = src(c, W-1-r)
+*/
+
+inline void copyPixel(uint8_t* dst, const uint8_t* src) {
+    dst[0] = src[0]; // B
+    dst[1] = src[1]; // G
+    dst[2] = src[2]; // R
+}
+
+// Scalar transpose of the dst block [r0, r1) x [c0, c1)
+void transposeScalar(const bmp::BMPImageView& src, bmp::BMPImage& dst, bool cw90,
+                     int r0, int r1, int c0, int c1) {
+    const int dstRow = bmp::rowSizeBytes(dst.width);
+    for (int r = r0; r < r1; ++r) {
+        uint8_t* dstPx = &dst.data[static_cast<size_t>(r) * dstRow + c0 * 3];
+        for (int c = c0; c < c1; ++c, dstPx += 3) {
+            const uint8_t* srcPx = cw90 ? src.row(c) + (src.width - 1 - r) * 3
+                                        : src.row(src.height - 1 - c) + r * 3;
+            copyPixel(dstPx, srcPx);
+        }
+    }
+}
+
+#if ACV_X86
+
+// 12-byte (4 pixel) loads and stores, never touching the bytes after the block
+ACV_TARGET("ssse3")
+inline __m128i load12(const uint8_t* p) {
+    int32_t tail;
+    std::memcpy(&tail, p + 8, 4);
+    return _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_cvtsi32_si128(tail));
+}
+
+ACV_TARGET("ssse3")
+inline void store12(uint8_t* p, __m128i v) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+    const int32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    std::memcpy(p + 8, &tail, 4);
+}
+
+// Shuffle mask moving pixel `from` of a 4-pixel vector into pixel slot `to`, zero elsewhere
+ACV_TARGET("ssse3")
+inline __m128i pixelMask(int from, int to) {
+    alignas(16) int8_t m[16];
+    for (int i = 0; i < 16; ++i) m[i] = -128; // 0x80 => zero
+    for (int b = 0; b < 3; ++b) m[to * 3 + b] = static_cast<int8_t>(from * 3 + b);
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(m));
+}
+
+// Transpose the dst block [r0, r1) x [c0, c1), 4x4 pixels at a time
+/*
+    CW270, dst rows r..r+3, dst cols c..c+3:
+    v[j] = 4 pixels of src row (H-1-c-j) starting at column r
+    dst row r+i = { v[0].px[i], v[1].px[i], v[2].px[i], v[3].px[i] }
+    CW90 reads src row (c+j) starting at column W-4-r, so pixel i is v[j].px[3-i]
+*/
+ACV_TARGET("ssse3")
+void transposeSSSE3(const bmp::BMPImageView& src, bmp::BMPImage& dst, bool cw90,
+                    int r0, int r1, int c0, int c1) {
+    __m128i mask[4][4];
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            mask[i][j] = pixelMask(cw90 ? 3 - i : i, j);
+
+    const int dstRow = bmp::rowSizeBytes(dst.width);
+    const int r4 = r0 + (r1 - r0) / 4 * 4;
+    const int c4 = c0 + (c1 - c0) / 4 * 4;
+
+    for (int r = r0; r < r4; r += 4) {
+        const int srcCol = cw90 ? src.width - 4 - r : r;
+        for (int c = c0; c < c4; c += 4) {
+            __m128i v[4];
+            for (int j = 0; j < 4; ++j) {
+                const int srcRow = cw90 ? c + j : src.height - 1 - c - j;
+                v[j] = load12(src.row(srcRow) + srcCol * 3);
+            }
+            for (int i = 0; i < 4; ++i) {
+                __m128i out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], mask[i][0]), _mm_shuffle_epi8(v[1], mask[i][1])),
+                                           _mm_or_si128(_mm_shuffle_epi8(v[2], mask[i][2]), _mm_shuffle_epi8(v[3], mask[i][3])));
+                store12(&dst.data[static_cast<size_t>(r + i) * dstRow + c * 3], out);
+            }
+        }
+    }
+
+    // leftovers of a tile that is not a multiple of 4
+    if (c4 < c1) transposeScalar(src, dst, cw90, r0, r4, c4, c1);
+    if (r4 < r1) transposeScalar(src, dst, cw90, r4, r1, c0, c1);
+}
+
+// Reverse the order of the pixels of one row (4 pixels per shuffle)
+ACV_TARGET("ssse3")
+void reverseRowSSSE3(const uint8_t* src, uint8_t* dst, int width) {
+    const __m128i rev = _mm_setr_epi8(9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2, -128, -128, -128, -128);
+    int c = 0;
+    for (; c + 4 <= width; c += 4) {
+        // dst pixels c..c+3 are src pixels W-1-c .. W-4-c
+        store12(dst + c * 3, _mm_shuffle_epi8(load12(src + (width - 4 - c) * 3), rev));
+    }
+    for (; c < width; ++c) {
+        copyPixel(dst + c * 3, src + (width - 1 - c) * 3);
+    }
+}
+
+#endif // ACV_X86
+
+void reverseRowScalar(const uint8_t* src, uint8_t* dst, int width) {
+    for (int c = 0; c < width; ++c) {
+        copyPixel(dst + c * 3, src + (width - 1 - c) * 3);
+    }
+}
+
+} // namespace
+
+void rotate(const bmp::BMPImageView& src, bmp::BMPImage& dst, Rotation op) {
+    TRACE_SPAN("imgproc: rotate");
+    const bool transpose = (op == Rotation::CW90 || op == Rotation::CW270);
+    dst.width = transpose ? src.height : src.width;
+    dst.height = transpose ? src.width : src.height;
+    const int dstRow = bmp::rowSizeBytes(dst.width);
+    dst.data.resize(static_cast<size_t>(dstRow) * dst.height);
+
+    // a reused dst may hold old pixels in the row padding, keep the output deterministic
+    if (dstRow != dst.width * 3) {
+        for (int r = 0; r < dst.height; ++r) {
+            std::memset(&dst.data[static_cast<size_t>(r) * dstRow + dst.width * 3], 0, dstRow - dst.width * 3);
+        }
+    }
+
+#if ACV_X86
+    const bool simd = cpu::hasSSSE3();
+#else
+    const bool simd = false;
+#endif
+
+    if (transpose) {
+        const bool cw90 = (op == Rotation::CW90);
+        // walk dst in tiles; each tile reads a kTile x kTile block of src
+        // (bands of dst rows in parallel, whole tile rows per band)
+        parallel::parallelRows(dst.height, kTile, [&](int band0, int band1) {
+            for (int r0 = band0; r0 < band1; r0 += kTile) {
+                const int r1 = std::min(r0 + kTile, band1);
+                for (int c0 = 0; c0 < dst.width; c0 += kTile) {
+                    const int c1 = std::min(c0 + kTile, dst.width);
+#if ACV_X86
+                    if (simd) {
+                        transposeSSSE3(src, dst, cw90, r0, r1, c0, c1);
+                        continue;
+                    }
+#endif
+                    transposeScalar(src, dst, cw90, r0, r1, c0, c1);
+                }
+            }
+        });
+        return;
+    }
+
+    // the rest are row operations: rows keep their order (FlipHorizontal),
+    // are taken in reverse order (FlipVertical), or both (CW180)
+    const bool reverseRows = (op == Rotation::FlipVertical || op == Rotation::CW180);
+    const bool reversePixels = (op == Rotation::FlipHorizontal || op == Rotation::CW180);
+    const int rowBytes = src.width * 3;
+    parallel::parallelRows(dst.height, parallel::kMinRowsPerBand, [&](int r0, int r1) {
+        for (int r = r0; r < r1; ++r) {
+            const uint8_t* srcRow = src.row(reverseRows ? src.height - 1 - r : r);
+            uint8_t* dstRowPtr = &dst.data[static_cast<size_t>(r) * dstRow];
+            if (!reversePixels) {
+                std::memcpy(dstRowPtr, srcRow, rowBytes);
+                continue;
+            }
+#if ACV_X86
+            if (simd) {
+                reverseRowSSSE3(srcRow, dstRowPtr, src.width);
+                continue;
+            }
+#endif
+            reverseRowScalar(srcRow, dstRowPtr, src.width);
+        }
+    });
+}
+
+} // namespace imgproc
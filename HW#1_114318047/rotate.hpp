@@ -0,0 +1,31 @@
+#pragma once
+#include "bmp.hpp" // bmp::BMPImage, bmp::BMPImageView
+
+namespace imgproc {
+
+// Right-angle rotations (clockwise, as seen on screen) and mirror flips
+enum class Rotation {
+    CW90,           // = cv::ROTATE_90_CLOCKWISE
+    CW180,          // = cv::ROTATE_180
+    CW270,          // = cv::ROTATE_90_COUNTERCLOCKWISE
+    FlipHorizontal, // mirror left <-> right
+    FlipVertical    // mirror top <-> bottom
+};
+
+// Rotate/flip src into dst, works for any width and height (CW90/CW270 swap them)
+// dst is resized, so reusing the same dst between calls does not reallocate
+/*
+    The 90/270 cases are a transpose: a naive loop reads rows but writes columns,
+    so every store touches a different cache line. Here the image is walked in
+    small tiles that fit in L1, and inside a tile 4x4 pixel blocks are transposed
+    in SSE registers (4 loads of 12 bytes -> 4 stores of 12 bytes)
+*/
+void rotate(const bmp::BMPImageView& src, bmp::BMPImage& dst, Rotation op);
+
+inline bmp::BMPImage rotate(const bmp::BMPImageView& src, Rotation op) {
+    bmp::BMPImage dst;
+    rotate(src, dst, op);
+    return dst;
+}
+
+} // namespace imgproc
@@ -0,0 +1,203 @@
+#include "trace.hpp"
+#include <algorithm> // for std::sort, std::min
+#include <chrono>
+#include <cstring> // for std::strcmp, std::strncmp
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory> // for std::shared_ptr
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace trace {
+
+namespace detail {
+std::atomic<bool> enabled(false);
+} // namespace detail
+
+namespace {
+
+// Spans kept per thread, the oldest are overwritten first
+const size_t kRingEvents = 32768;
+
+struct Event {
+    const char* name;
+    int64_t start;
+    int64_t end;
+};
+
+// One thread's spans; written by its thread only, read when no thread records
+struct Ring {
+    std::vector<Event> events = std::vector<Event>(kRingEvents);
+    std::atomic<uint64_t> written{0}; // events ever recorded (release: the event is complete)
+    int tid = 0;
+    std::string threadName;
+};
+
+std::mutex registryMutex;
+std::vector<std::shared_ptr<Ring>>& registry() {
+    static std::vector<std::shared_ptr<Ring>> rings; // outlive their threads
+    return rings;
+}
+
+thread_local Ring* currentRing = nullptr;
+thread_local std::string currentName;
+
+std::string tracePath; // --trace FILE
+
+const std::chrono::steady_clock::time_point& epoch() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return start;
+}
+
+Ring& ring() {
+    if (!currentRing) {
+        std::shared_ptr<Ring> r = std::make_shared<Ring>();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        r->tid = static_cast<int>(registry().size()) + 1;
+        r->threadName = currentName.empty() ? "thread " + std::to_string(r->tid) : currentName;
+        registry().push_back(r);
+        currentRing = r.get();
+    }
+    return *currentRing;
+}
+
+// The events still in a ring, oldest first
+std::vector<Event> eventsOf(const Ring& r) {
+    const uint64_t written = r.written.load(std::memory_order_acquire);
+    const uint64_t kept = std::min<uint64_t>(written, kRingEvents);
+    std::vector<Event> events;
+    events.reserve(kept);
+    for (uint64_t i = written - kept; i < written; ++i) events.push_back(r.events[i % kRingEvents]);
+    return events;
+}
+
+std::string jsonString(const std::string& s) {
+    std::string q = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') q += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) continue;
+        q += c;
+    }
+    return q + "\"";
+}
+
+} // namespace
+
+void enable(bool on) {
+    epoch(); // start the clock before the first span
+    detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch()).count();
+}
+
+void record(const char* name, int64_t start, int64_t end) {
+    Ring& r = ring();
+    const uint64_t w = r.written.load(std::memory_order_relaxed);
+    r.events[w % kRingEvents] = Event{name, start, end};
+    r.written.store(w + 1, std::memory_order_release);
+}
+
+void nameThread(const std::string& name) {
+    currentName = name;
+    if (currentRing) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        currentRing->threadName = name;
+    }
+}
+
+void writeChromeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("cannot write " + path);
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    // one "X" (complete) event per span, timestamps in microseconds
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const std::shared_ptr<Ring>& r : registry()) {
+        out << (first ? "" : ",\n") << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << r->tid
+            << ", \"args\": {\"name\": " << jsonString(r->threadName) << "}}";
+        first = false;
+        for (const Event& e : eventsOf(*r)) {
+            out << ",\n  {\"name\": " << jsonString(e.name) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << r->tid
+                << ", \"ts\": " << e.start / 1000.0 << ", \"dur\": " << (e.end - e.start) / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+void printSummary(std::ostream& out) {
+    std::map<std::string, std::vector<double>> durations; // microseconds per span name
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const std::shared_ptr<Ring>& r : registry()) {
+            const uint64_t written = r->written.load(std::memory_order_acquire);
+            if (written > kRingEvents) dropped += written - kRingEvents;
+            for (const Event& e : eventsOf(*r)) durations[e.name].push_back((e.end - e.start) / 1000.0);
+        }
+    }
+
+    // largest total first
+    std::vector<std::pair<double, std::string>> order;
+    for (auto& entry : durations) {
+        std::sort(entry.second.begin(), entry.second.end());
+        double total = 0;
+        for (double d : entry.second) total += d;
+        order.emplace_back(-total, entry.first);
+    }
+    std::sort(order.begin(), order.end());
+
+    const std::ios::fmtflags flags = out.flags();
+    out << "\nTrace summary" << (dropped ? " (" + std::to_string(dropped) + " oldest spans overwritten)" : "") << "\n"
+        << std::left << std::setw(28) << "span" << std::right << std::setw(8) << "count" << std::setw(12) << "total ms"
+        << std::setw(11) << "mean us" << std::setw(11) << "p50 us" << std::setw(11) << "p99 us" << std::setw(11)
+        << "max us" << "\n";
+    for (const auto& item : order) {
+        const std::vector<double>& d = durations[item.second];
+        const size_t n = d.size();
+        out << std::left << std::setw(28) << item.second << std::right << std::setw(8) << n << std::fixed
+            << std::setprecision(3) << std::setw(12) << -item.first / 1000.0 << std::setprecision(1) << std::setw(11)
+            << -item.first / n << std::setw(11) << d[n / 2] << std::setw(11)
+            << d[std::min(n - 1, static_cast<size_t>(0.99 * n))] << std::setw(11) << d[n - 1] << "\n";
+
+        // spans per power-of-two bucket: "<=4us 12" = 12 spans of 2 to 4 us
+        out << std::left << std::setw(28) << "" << "  ";
+        size_t i = 0;
+        for (double bound = 1; i < n; bound *= 2) {
+            size_t count = 0;
+            for (; i < n && d[i] <= bound; ++i) ++count;
+            if (count) out << "<=" << std::setprecision(0) << bound << "us " << count << "  ";
+        }
+        out << "\n";
+    }
+    out.flags(flags);
+}
+
+void applyTraceOption(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--trace") == 0) {
+            if (i + 1 == argc) throw std::invalid_argument("--trace needs a file name");
+            tracePath = argv[++i];
+        } else if (std::strncmp(argv[i], "--trace=", 8) == 0) {
+            tracePath = argv[i] + 8;
+            if (tracePath.empty()) throw std::invalid_argument("--trace needs a file name");
+        }
+    }
+    if (!tracePath.empty()) {
+        nameThread("main");
+        enable();
+    }
+}
+
+void finish(std::ostream& out) {
+    if (tracePath.empty()) return;
+    writeChromeTrace(tracePath);
+    printSummary(out);
+    out << "Trace written to " << tracePath << " (open in chrome://tracing or ui.perfetto.dev)\n";
+}
+
+} // namespace trace
@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/********************************************************
+* Filename    : trace.hpp
+* Note        : Scoped spans for profiling the stages: thread-local rings of
+*               events, Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+*               and a per-stage summary
+*********************************************************/
+
+namespace trace {
+
+namespace detail {
+extern std::atomic<bool> enabled;
+} // namespace detail
+
+// True while spans are recorded; off until enable() or --trace
+inline bool enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+void enable(bool on = true);
+
+// Nanoseconds of the trace clock (steady, 0 = first use)
+int64_t now();
+
+// Add a finished span to the calling thread's ring; name must live as long as the
+// trace (a string literal)
+void record(const char* name, int64_t start, int64_t end);
+
+// Times the scope it lives in
+/*
+    TRACE_SPAN("rotate"); at the top of a block records [construction, end of the block]
+    on the calling thread. Spans nest (a span inside another one is drawn under it)
+    and every thread has its own ring, so recording never takes a lock.
+
+    Disabled, a span is one relaxed atomic load. With micros, the duration is also
+    stored there whether tracing is enabled or not (for programs that print their own
+    timing); end() stops the span before the end of the scope.
+*/
+class Span {
+public:
+    explicit Span(const char* name, double* micros = nullptr)
+        : name_(name), micros_(micros), start_(micros || enabled() ? now() : -1) {}
+    ~Span() { end(); }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    void end() {
+        if (start_ < 0) return;
+        const int64_t stop = now();
+        if (micros_) *micros_ = (stop - start_) / 1000.0;
+        if (enabled()) record(name_, start_, stop);
+        start_ = -1;
+    }
+
+private:
+    const char* name_;
+    double* micros_;
+    int64_t start_; // -1: not timing
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// -DACV_NO_TRACE compiles the spans out completely
+#ifdef ACV_NO_TRACE
+#define TRACE_SPAN(name) ((void)0)
+#else
+#define TRACE_SPAN(name) ::trace::Span TRACE_CONCAT(traceSpan_, __LINE__)(name)
+#endif
+
+// Name of the calling thread in the trace ("main", "batch worker 2", ...)
+void nameThread(const std::string& name);
+
+// The functions below read every thread's ring: call them while no other thread records
+// (e.g. after a batch, or between two menu tasks)
+
+// Chrome trace event JSON of the spans in the rings (each ring keeps the last
+// 32768 spans of its thread); throws std::runtime_error when path cannot be written
+void writeChromeTrace(const std::string& path);
+
+// Per span name: count, total, mean, p50, p99, max, and the durations in
+// power-of-two buckets
+void printSummary(std::ostream& out);
+
+// "--trace FILE" (or "--trace=FILE"): enable tracing, finish() writes FILE;
+// throws std::invalid_argument when FILE is missing
+void applyTraceOption(int argc, char** argv);
+
+// With --trace: write its file and print the summary to out; otherwise nothing
+void finish(std::ostream& out);
+
+} // namespace trace
@@ -7,9 +7,23 @@
 #include <cstdint> // for uint8_t
 #include <opencv2/opencv.hpp>
 #include "bmp.hpp"  // declares bmp::BMPImage, bmp::readBMP, bmp::writeBMP
-#include <queue>
+#include "binary_mask.hpp" // imgproc::BinaryMask
+#include "pipeline.hpp" // imgproc::MaskPipeline
+#include "morphology.hpp" // imgproc::Morphology
+#include "integral.hpp" // imgproc::adaptiveBinarizeToMask
+#include "histogram.hpp" // imgproc::intensityHistogram, imgproc::multiOtsuThresholds
+#include "components.hpp" // imgproc::labelComponents
+#include "run_mask.hpp" // imgproc::RunLabelScratch, imgproc::removeSmallComponents
+#include "geometry.hpp" // imgproc::pointSetDiameter
+#include "thread_pool.hpp" // parallel::parallelRows, parallel::applyThreadsOption
+#include "batch.hpp" // batch::run
+#include "trace.hpp" // trace::Span, trace::applyTraceOption
+#include "perf_counters.hpp" // perf::Stage, perf::takeCountersOption
+#include <tuple> // for std::tuple
+#include <algorithm> // for std::min
 #include <utility> // for std::pair
-#include <chrono> // for timing
+#include <cstring> // for std::strncmp, std::strchr
+#include <string> // for std::string, std::stoi
 
 /********************************************************
 * Filename    : HW2.cpp
@@ -19,153 +33,118 @@
 
 // Helpers functions
 
-// Task 1 Helpers
-// Check if it's white(B=255,G=255,R=255)
-static bool isWhite(const bmp::BMPImage& img, int rowSize, int r, int c) {
-    const uint8_t* px = &img.data[r * rowSize + c * 3];
-    return (px[0] == 255 && px[1] == 255 && px[2] == 255); 
-}
-
-// Set pixel to black
-static void setBlack(bmp::BMPImage& img, int rowSize, int r, int c) {
-    uint8_t* px = &img.data[r * rowSize + c * 3];
-    px[0] = px[1] = px[2] = 0; // B,G,R
+// How task1, task3 and the batch pipelines binarize (--threshold, --window, --classes)
+struct ThresholdChoice {
+    enum Mode { Fixed, Auto, Bradley, Sauvola };
+    Mode mode = Fixed; // the global thresholds of the assignment (98, 110)
+    int window = 0;    // side of the local window, 0 = 1/8 of the shorter image side
+    int classes = 2;   // auto: Otsu classes, the brightest one is white
+};
+static ThresholdChoice thresholdChoice;
+
+// --threshold auto: the (multi-level) Otsu threshold below the brightest class
+static int autoThreshold(const imgproc::IntensityHistogram& histogram)
+{
+    if (thresholdChoice.classes == 2)
+        return imgproc::otsuThreshold(histogram);
+    return imgproc::multiOtsuThresholds(histogram, thresholdChoice.classes).back();
 }
 
-// BFS subfunction for connected component analysis
-static void bfs(const bmp::BMPImage& img, int rowSize, int width, int height, std::vector<int>& visited, int sr, int sc, std::vector<std::pair<int, int>>& component_pixels, bool targetWhite)
+// Global threshold of img: fixedThreshold, or with --threshold auto the one of its
+// histogram (one more pass over the image)
+static int globalThreshold(const bmp::BMPImageView& img, int fixedThreshold)
 {
-    // 4-neighbors
-    const int dr[4] = {-1, 1, 0, 0};
-    const int dc[4] = { 0, 0, -1, 1};
-
-    std::queue<std::pair<int, int>> q;
-    q.push({sr, sc});
-
-    // occupy starting pixel
-    visited[sr * width + sc] = 1;
-
-    while (!q.empty()) {
-        auto front = q.front();
-        int r = front.first;
-        int c = front.second;
-
-        q.pop();
-
-        // Add to component pixels
-        component_pixels.push_back({r, c});
-
-        for (int k = 0; k < 4; ++k) {
-            int nr = r + dr[k];
-            int nc = c + dc[k];
-
-            // Check bounds
-            if (nr < 0 || nr >= height || nc < 0 || nc >= width)
-                continue;
-
-            int index = nr * width + nc;
-
-            // If already visited, skip
-            if (visited[index]) continue;
-
-            // Check pixel color
-            const uint8_t* np = &img.data[nr * rowSize + nc * 3];
-            bool isWhite = (np[0] == 255 && np[1] == 255 && np[2] == 255);
-            bool isBlack = (np[0] == 0 && np[1] == 0 && np[2] == 0);
-
-            // Based on targetWhite flag
-            if ((targetWhite && isWhite) || (!targetWhite && isBlack)) {
-                // occupy and enqueue
-                visited[index] = 1;
-                q.push({nr, nc});
-            }
-        }
-    }
+    if (thresholdChoice.mode != ThresholdChoice::Auto)
+        return fixedThreshold;
+    return autoThreshold(imgproc::intensityHistogram(img));
 }
 
-// Task3 helpers
-// Dilation
-static void apply_dilatation(const bmp::BMPImage& img, bmp::BMPImage& dilated, int kernel_size) {
-    const int width = img.width;
-    const int height = img.height;
-    const int rowSize = bmp::rowSizeBytes(width);
-
-    for (int r = 0; r < height; ++r) {
-        for (int c = 0; c < width; ++c) {
+// Buffers of binarize, kept between images
+struct BinarizeScratch {
+    imgproc::LazyImage image;        // --threshold auto: the planes read by the histogram and the binarizer
+    imgproc::IntegralImage integral; // --threshold bradley / sauvola: summed-area tables
+};
 
-            // dilate_pixel indicates whether to set current pixel to white
-            bool dilate_pixel = false;
-
-            // initial kernel_r, kernel_c is -center of kernel
-            for (int kernel_r = -kernel_size / 2; kernel_r <= kernel_size / 2; ++kernel_r) {
-                for (int kernel_c = -kernel_size / 2; kernel_c <= kernel_size / 2; ++kernel_c) {
-
-                    // neighbor row and column
-                    int neighbor_r = r + kernel_r, neighbor_c = c + kernel_c;
-
-                    // check bounds
-                    if (neighbor_r >= 0 && neighbor_r < height && neighbor_c >= 0 && neighbor_c < width) {
-
-                        // np points to neighbor pixel
-                        const uint8_t* neighbor_pixel = &img.data[neighbor_r * rowSize + neighbor_c * 3];
-                        if (neighbor_pixel[0] == 255 && neighbor_pixel[1] == 255 && neighbor_pixel[2] == 255) { // white pixel
-
-                            // set current pixel to white
-                            dilate_pixel = true;
-                            break;
-                        }
-                    }
-                }
-
-                // Break, if already decided to dilate
-                if (dilate_pixel) 
-                    break;
-            }
-
-            // dilate_p points to current pixel in dilated image
-            uint8_t* dilate_p = &dilated.data[r * rowSize + c * 3];
-            if (dilate_pixel) {
-                dilate_p[0] = 255; dilate_p[1] = 255; dilate_p[2] = 255; // Set to white
-            } else {
-                dilate_p[0] = 0; dilate_p[1] = 0; dilate_p[2] = 0; // Set to black
-            }
-        }
+// Mask of img into out: average intensity > the global threshold, or the local threshold of
+// --threshold bradley / sauvola; returns the global threshold, -1 for a local one
+static int binarize(const bmp::BMPImageView& img, int fixedThreshold, BinarizeScratch& scratch,
+                    imgproc::BinaryMask& out)
+{
+    if (thresholdChoice.mode == ThresholdChoice::Fixed) {
+        imgproc::binarizeToMask(img, fixedThreshold, out);
+        return fixedThreshold;
     }
+    if (thresholdChoice.mode == ThresholdChoice::Auto) {
+        // two kernels read every pixel: one deinterleave, then both run on the planes
+        // (no shuffles); the mask is the output, nothing is converted back
+        scratch.image.assign(img);
+        imgproc::IntensityHistogram histogram;
+        scratch.image.run(imgproc::HistogramKernel(), histogram);
+        imgproc::BinarizeKernel binarizer;
+        binarizer.threshold = autoThreshold(histogram);
+        scratch.image.run(binarizer, out);
+        scratch.image.assign(bmp::BMPImageView()); // do not keep img alive (or mapped) in the scratch
+        return binarizer.threshold;
+    }
+    int window = thresholdChoice.window;
+    if (window == 0)
+        window = std::max(3, std::min(img.width, img.height) / 8) | 1;
+    const imgproc::AdaptiveThreshold threshold = thresholdChoice.mode == ThresholdChoice::Bradley
+        ? imgproc::AdaptiveThreshold::bradley(window)
+        : imgproc::AdaptiveThreshold::sauvola(window);
+    imgproc::adaptiveBinarizeToMask(img, threshold, scratch.integral, out);
+    return -1;
 }
 
-// Erosion
-static void apply_erosion(const bmp::BMPImage& img, bmp::BMPImage& eroded, int kernel_size) {
-    const int width = img.width;
-    const int height = img.height;
-    const int rowSize = bmp::rowSizeBytes(width);
+// Take "--threshold fixed|auto|bradley|sauvola", "--window N" (odd) and "--classes N" out of
+// the command line, so batch mode does not see them; throws std::invalid_argument for a bad value
+static void takeThresholdOptions(int& argc, char** argv)
+{
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        const bool threshold = std::strncmp(argv[i], "--threshold", 11) == 0 && (argv[i][11] == '\0' || argv[i][11] == '=');
+        const bool window = std::strncmp(argv[i], "--window", 8) == 0 && (argv[i][8] == '\0' || argv[i][8] == '=');
+        const bool classes = std::strncmp(argv[i], "--classes", 9) == 0 && (argv[i][9] == '\0' || argv[i][9] == '=');
+        if (!threshold && !window && !classes) {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        const char* eq = std::strchr(argv[i], '=');
+        std::string value;
+        if (eq) {
+            value = eq + 1;
+        } else {
+            if (i + 1 == argc) throw std::invalid_argument(std::string(argv[i]) + " needs a value");
+            value = argv[++i];
+        }
 
-    for (int r = 0; r < height; ++r) {
-        for (int c = 0; c < width; ++c) {
-            bool erode_pixel = false;
-
-            // initial kernel_r, kernel_c is -center of kernel
-            for (int kernel_r = -kernel_size / 2; kernel_r <= kernel_size / 2; ++kernel_r) {
-                for (int kernel_c = -kernel_size / 2; kernel_c <= kernel_size / 2; ++kernel_c) {
-                    // neighbor row and column
-                    int nr = r + kernel_c, nc = c + kernel_c;
-                    if (nr >= 0 && nr < height && nc >= 0 && nc < width) {
-                        const uint8_t* neighbor_pixel = &img.data[nr * rowSize + nc * 3];
-                        if (neighbor_pixel[0] == 0 && neighbor_pixel[1] == 0 && neighbor_pixel[2] == 0) { // black pixel
-                            erode_pixel = true;
-                            break;
-                        }
-                    }
-                }
-                if (erode_pixel) break;
+        if (threshold) {
+            if (value == "fixed") thresholdChoice.mode = ThresholdChoice::Fixed;
+            else if (value == "auto") thresholdChoice.mode = ThresholdChoice::Auto;
+            else if (value == "bradley") thresholdChoice.mode = ThresholdChoice::Bradley;
+            else if (value == "sauvola") thresholdChoice.mode = ThresholdChoice::Sauvola;
+            else throw std::invalid_argument("--threshold needs fixed, auto, bradley or sauvola, got " + value);
+        } else {
+            size_t used = 0;
+            int n = 0;
+            try {
+                n = std::stoi(value, &used);
+            } catch (const std::exception&) {
+                used = 0;
             }
-            uint8_t* erode_p = &eroded.data[r * rowSize + c * 3];
-            if (erode_pixel) {
-                erode_p[0] = 0; erode_p[1] = 0; erode_p[2] = 0; // Set to black
+            if (window) {
+                if (used == 0 || used != value.size() || n < 1 || n % 2 == 0)
+                    throw std::invalid_argument("--window needs an odd positive number, got " + value);
+                thresholdChoice.window = n;
             } else {
-                erode_p[0] = 255; erode_p[1] = 255; erode_p[2] = 255; // Set to white
+                if (used == 0 || used != value.size() || n < 2 || n > 5)
+                    throw std::invalid_argument("--classes needs a number from 2 to 5, got " + value);
+                thresholdChoice.classes = n;
             }
         }
     }
+    argc = kept;
+    argv[argc] = nullptr;
 }
 
 // Draw bounding box
@@ -208,163 +187,153 @@ static void drawBoundingBox(bmp::BMPImage& img, int minR, int minC, int maxR, in
     }
 }
 
-// Task1
-static void task1(const char* input, const char* output)
+// Working memory of roadMask and labelForest; batch mode keeps one per worker, so the
+// buffers are reused from image to image instead of being allocated for every image
+struct RegionScratch {
+    imgproc::BinaryMask mask;        // roadMask's result
+    BinarizeScratch binarize;        // planes / summed-area tables of --threshold auto / bradley / sauvola
+    imgproc::RunLabelScratch runs;   // runs, union-find and areas of roadMask's area filtering
+    imgproc::ComponentLabels labels; // label image and component statistics (labelForest)
+    std::vector<int> regionOf;       // label -> region index (labelForest)
+};
+
+// Road mask of task1 into scratch.mask: white = road; returns the intensity threshold
+// (-1 for a local one)
+static int roadMask(const bmp::BMPImageView& img, RegionScratch& scratch)
 {
-    // Generate a binarized image of road using intensity, color information and area filtering
-
-    // Read image
-    bmp::BMPImage img = bmp::readBMP(input);
-    const int width = img.width;
-    const int height = img.height;
-    const int rowSize = bmp::rowSizeBytes(width);
-
     // Thresholds for road detection(color, intensity, area)
     const int road_intensity_threshold = 98; // Intensity threshold
     const int MIN_AREA = 900; // Minimum area for connected components 400
 
-    // Process each pixel(Filter by color and intensity first)
-    for (int r = 0; r < height; ++r) {
-        uint8_t* rowPtr = &img.data[r * rowSize];
-        for (int c = 0; c < width; ++c) {
-            uint8_t* px = &rowPtr[c * 3]; // B, G, R
-
-            // Calculate average intensity
-            int average_intensity = ((int)px[0] + (int)px[1] + (int)px[2]) / 3;
-
-            // Binarization condition for road using intensity and color thresholds
-            if (average_intensity > road_intensity_threshold) {
-                // white (road)
-                px[0] = 255;   // B
-                px[1] = 255;   // G
-                px[2] = 255;   // R
-            } else {
-                // black (forest)
-                px[0] = 0; // B
-                px[1] = 0; // G
-                px[2] = 0; // R
-            }
-        }
-    }
+    // Process each pixel(Filter by color and intensity first), 1 bit per pixel
+    const int threshold = binarize(img, road_intensity_threshold, scratch.binarize, scratch.mask);
 
-    // Connected Component Analysis to remove small components (area filtering)
-    std::vector<int> visited(width * height);
-
-    for (int sr = 0; sr < height; ++sr) {
-        for (int sc = 0; sc < width; ++sc) {
-            // If not visited and is white pixel, start BFS
-            if (!visited[sr * width + sc] && isWhite(img, rowSize, sr, sc)) {
-                std::vector<std::pair<int, int>> component_pixels;
-                bfs(img, rowSize, width, height, visited, sr, sc, component_pixels,true);
-
-                // If component area is less than MIN_AREA, set all its pixels to black
-                if ((int)component_pixels.size() < MIN_AREA) {
-                    for (std::pair<int, int>& p : component_pixels) {
-                        setBlack(img, rowSize, p.first, p.second);
-                    }
-                }
-            }
-        }
-    }
+    // Connected Component Analysis to remove small components (area filtering), on the runs
+    // of the mask: no label image, only the runs of the small components are cleared
+    imgproc::removeSmallComponents(scratch.mask, MIN_AREA, 4, scratch.runs);
+    return threshold;
+}
+
+// Task1
+static void task1(const char* input, const char* output)
+{
+    // Generate a binarized image of road using intensity, color information and area filtering
+
+    TRACE_SPAN("task1");
+    // Read image (mapped, the pixels are only read once by the binarizer)
+    bmp::BMPImageView img = bmp::mapBMP(input);
+    RegionScratch scratch;
+    const int threshold = roadMask(img, scratch);
+    if (thresholdChoice.mode == ThresholdChoice::Auto)
+        std::cout << "Automatic threshold (Otsu): average intensity > " << threshold << "\n";
 
-    // Write image
-    bmp::writeBMP(output, img);
+    // Write image (1 bit per pixel, straight from the mask)
+    imgproc::writeMaskBMP(output, scratch.mask);
     std::cout << "Binarized image saved as " << output << "\n";
 }
 
 // Label the forest regions with 4-connected neighbors, assign unique colors, and draw bounding boxes
-// Label components on mask, draw boxes on original
-static void task2(const char* maskPath, const char* originalPath, const char* outputFill, const char* outputBox)
+// original: the regions are filled with color in place; null skips the fill
+// BBox: a copy of the original, gets the bounding boxes and centroids (not the fill)
+// verbose: print area and centroid of every region
+// scratch: labels and regionOf are overwritten (forest may be scratch.mask)
+static void labelForest(const imgproc::BinaryMask& forest, bmp::BMPImage* original, bmp::BMPImage& BBox, bool verbose,
+                        RegionScratch& scratch)
 {
-    // mask = task1.bmp(binarized image)
-    bmp::BMPImage mask = bmp::readBMP(maskPath);
-    bmp::BMPImage original = bmp::readBMP(originalPath);
-    bmp::BMPImage BBox = original;  
-
-    const int width  = mask.width;
-    const int height = mask.height;
+    const int width  = forest.width();
+    const int height = forest.height();
     const int rowSize = bmp::rowSizeBytes(width);
 
-    if (original.width != width || original.height != height)
+    if (BBox.width != width || BBox.height != height ||
+        (original && (original->width != width || original->height != height)))
         throw std::runtime_error("mask and original size mismatch");
 
-    std::vector<int> visited(width * height);
     const int MIN_FOREST_AREA = 5000; // Minimum pixel count for a valid region
 
+    // 4-connected black regions, in the order a raster scan first reaches them
+    // (label image + area, bounding box and centroid sums in one labelling pass)
+    imgproc::labelComponents(forest, scratch.labels, 4);
+    const imgproc::ComponentLabels& labels = scratch.labels;
+
+    // regionIndex of every large enough component (by label), -1 for the background and the skipped small ones
+    std::vector<int>& regionOf = scratch.regionOf;
+    regionOf.assign(labels.stats.size() + 1, -1);
     int regionIndex = 0;
+    for (size_t i = 0; i < labels.stats.size(); ++i) {
+        if (labels.stats[i].area >= MIN_FOREST_AREA)
+            regionOf[i + 1] = regionIndex++;
+    }
+
+    // Fill the regions with color
+    if (original) parallel::parallelRows(height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) {
+            const int32_t* label = labels.row(r);
+            uint8_t* opx = &original->data[r * rowSize];
+            for (int c = 0; c < width; ++c, opx += 3) {
+                const int region = regionOf[label[c]];
+                if (region < 0)
+                    continue;  // background or small region
+
+                // red, green, blue colors 
+                opx[0] = (region % 3 == 2) ? 255 : 0; // Blue for regionIndex % 3 == 2
+                opx[1] = (region % 3 == 1) ? 255 : 0; // Green for regionIndex % 3 == 1
+                opx[2] = (region % 3 == 0) ? 255 : 0; // Red for regionIndex % 3 == 0
+            }
+        }
+    });
+
+    for (size_t i = 0; i < labels.stats.size(); ++i) {
+        const int region = regionOf[i + 1];
+        if (region < 0)
+            continue;
+
+        const imgproc::MaskComponent& comp = labels.stats[i];
+        uint8_t rColor = (region % 3 == 0) ? 255 : 0;
+        uint8_t gColor = (region % 3 == 1) ? 255 : 0;
+        uint8_t bColor = (region % 3 == 2) ? 255 : 0;
+
+        // Compute centroid (average of pixels)
+        int centroid_R = (int)(comp.sumR / comp.area);
+        int centroid_C = (int)(comp.sumC / comp.area);
+
+        if (verbose)
+            std::cout << "Region " << region + 1 << ": Area=" << comp.area << ", Centroid=(" << centroid_C << "," << centroid_R << ")\n";
 
-    for (int r = 0; r < height; ++r) {
-        for (int c = 0; c < width; ++c) {
-            if (!visited[r * width + c]) {
-                uint8_t* px = &mask.data[r * rowSize + c * 3];
-
-                // If it's black pixel (RGB=0)
-                if (px[0] == 0 && px[1] == 0 && px[2] == 0) {
-                    std::vector<std::pair<int, int>> component_pixels;
-                    bfs(mask, rowSize, width, height, visited, r, c, component_pixels, false);
-
-                    int area = (int)component_pixels.size();
-                    if (area < MIN_FOREST_AREA) 
-                        continue;  // skip small regions
-
-                    // red, green, blue colors 
-                    uint8_t rColor = (regionIndex % 3 == 0) ? 255 : 0; // Red for regionIndex % 3 == 0
-                    uint8_t gColor = (regionIndex % 3 == 1) ? 255 : 0; // Green for regionIndex % 3 == 1
-                    uint8_t bColor = (regionIndex % 3 == 2) ? 255 : 0; // Blue for regionIndex % 3 == 2
-
-                    // Fill the region with color
-                    int minR = height, maxR = -1, minC = width, maxC = -1;
-                    for (const auto& p : component_pixels) {
-                        int rr = p.first, cc = p.second;
-                        uint8_t* opx = &original.data[rr * rowSize + cc * 3];
-                        opx[0] = bColor;
-                        opx[1] = gColor;
-                        opx[2] = rColor;
-
-                        minR = std::min(minR, rr);
-                        maxR = std::max(maxR, rr);
-                        minC = std::min(minC, cc);
-                        maxC = std::max(maxC, cc);
-                    }
-
-                    // Compute centroid (average of pixels)
-                    long sumR = 0, sumC = 0;
-                    for (const auto& p : component_pixels) {
-                        sumR += p.first;
-                        sumC += p.second;
-                    }
-                    int centroid_R = (int)(sumR / component_pixels.size());
-                    int centroid_C = (int)(sumC / component_pixels.size());
-
-                    std::cout << "Region " << regionIndex + 1 << ": Area=" << area << ", Centroid=(" << centroid_C << "," << centroid_R << ")\n";
-
-                    // Draw bounding box 
-                    uint8_t red_Box = std::min(255, rColor + 60);
-                    uint8_t green_Box = std::min(255, gColor + 60);
-                    uint8_t blue_Box = std::min(255, bColor + 60);
-
-                    drawBoundingBox(BBox, minR, minC, maxR, maxC, red_Box, green_Box, blue_Box, 2);
-
-                    // Draw centroid cross 
-                    const int size = 5;
-                    for (int dr = -size; dr <= size; ++dr) {
-                        for (int dc = -size; dc <= size; ++dc) {
-                            if ((dr == 0 || dc == 0) &&
-                                centroid_R + dr >= 0 && centroid_R + dr < height &&
-                                centroid_C + dc >= 0 && centroid_C + dc < width) {
-
-                                // centroid_pointer: pointer to centroid pixel in BBox image
-                                uint8_t* centroid_pointer = &BBox.data[(centroid_R + dr) * rowSize + (centroid_C + dc) * 3];
-                                centroid_pointer[0] = 255; centroid_pointer[1] = 255; centroid_pointer[2] = 0;
-                            }
-                        }
-                    }
-
-                    regionIndex++;
+        // Draw bounding box 
+        uint8_t red_Box = std::min(255, rColor + 60);
+        uint8_t green_Box = std::min(255, gColor + 60);
+        uint8_t blue_Box = std::min(255, bColor + 60);
+
+        drawBoundingBox(BBox, comp.minR, comp.minC, comp.maxR, comp.maxC, red_Box, green_Box, blue_Box, 2);
+
+        // Draw centroid cross 
+        const int size = 5;
+        for (int dr = -size; dr <= size; ++dr) {
+            for (int dc = -size; dc <= size; ++dc) {
+                if ((dr == 0 || dc == 0) &&
+                    centroid_R + dr >= 0 && centroid_R + dr < height &&
+                    centroid_C + dc >= 0 && centroid_C + dc < width) {
+
+                    // centroid_pointer: pointer to centroid pixel in BBox image
+                    uint8_t* centroid_pointer = &BBox.data[(centroid_R + dr) * rowSize + (centroid_C + dc) * 3];
+                    centroid_pointer[0] = 255; centroid_pointer[1] = 255; centroid_pointer[2] = 0;
                 }
             }
         }
     }
+}
+
+// Label components on mask, draw boxes on original
+static void task2(const char* maskPath, const char* originalPath, const char* outputFill, const char* outputBox)
+{
+    TRACE_SPAN("task2");
+    // mask = task1.bmp(binarized image), forest = black pixels
+    imgproc::BinaryMask forest = imgproc::maskFromBMP(bmp::mapBMP(maskPath), false);
+    bmp::BMPImage original = bmp::readBMP(originalPath);
+    bmp::BMPImage BBox = original;  
+
+    RegionScratch scratch;
+    labelForest(forest, &original, BBox, true, scratch);
 
     bmp::writeBMP(outputFill, original);
     bmp::writeBMP(outputBox, BBox);
@@ -375,142 +344,107 @@ static void task2(const char* maskPath, const char* originalPath, const char* ou
 
 std::pair<double, double> task3(const char* input, const char* output, bool analyzeTime, bool LongestAxis, bool targetWhite=true)
 {
-    using namespace std::chrono;
-
     // Use average intensity to filter first, then apply morphological operations
-    // Read image
-    bmp::BMPImage img = bmp::readBMP(input);
+    // Read image (mapped, the pixels are only read once by the binarizer)
+    bmp::BMPImageView img = bmp::mapBMP(input);
     const int width = img.width;
-    const int height = img.height;
     const int rowSize = bmp::rowSizeBytes(width);
 
-    // Timing variables
-    auto start = high_resolution_clock::now();
-    auto stage1_start = start;
+    // Timing variables: every stage is a trace span (drawn in the --trace file), its
+    // duration in us is also kept here for the timing report
+    // (with --counters every stage also reads the hardware counters, see perf::Stage)
+    double stage12_duration = 0, stage3_duration = 0, stage4_duration = 0, stage5_duration = 0, total_duration = 0;
+    const uint64_t pixels = static_cast<uint64_t>(width) * img.height;
+    perf::clearReport();
+    trace::Span total("task3", &total_duration);
+    trace::Span stage12("task3: binarize + morphology", &stage12_duration);
+    perf::Stage stage12Counters("Stage 1 + 2 (Binarization + Morphology)", pixels);
 
     // Stage 1: Binarizing
+    // average intensity < 110 => black, else white (i.e. white when average > 109)
     const int intensity_threshold = 110;
-    for (int r = 0; r < height; ++r) {
-        for (int c = 0; c < width; ++c) {
-            uint8_t* px = &img.data[r * rowSize + c * 3];
-            int average_intensity = ((int)px[0] + (int)px[1] + (int)px[2]) / 3;
-
-            if (average_intensity < intensity_threshold) {
-                px[0] = 0; px[1] = 0; px[2] = 0; // Set to black
-            } else {
-                px[0] = 255; px[1] = 255; px[2] = 255; // Set to white
-            }
-        }
-    }
-
-    // Stage 1: Binarizing - END
-    auto stage1_end = high_resolution_clock::now();
 
     // Stage 2: Morphological operations
-    auto stage2_start = high_resolution_clock::now();
     const int kernel_size = 3;
 
-    // Do Opening
-    bmp::BMPImage eroded = img; // Copy for erosion
-
-    // Erosion
-    apply_erosion(img, eroded, kernel_size);
-
-    bmp::BMPImage dilated = eroded; // Copy for first dilation
-
-    // call dilate function
-    apply_dilatation(eroded, dilated, kernel_size);
-
-    // one more Dilation to restore road width
-    bmp::BMPImage temp = dilated; // Copy for second dilation
-
-    // Dilation
-    apply_dilatation(dilated, temp, kernel_size+4);
-
-    dilated = temp; // Update dilated image
+    // Stages 1 and 2 are fused: every input row is thresholded and streamed through
+    // Opening (Erosion, then Dilation) and one more Dilation to restore road width,
+    // with a few line buffers instead of full-size intermediate masks
+    imgproc::BinaryMask dilatedMask;
+    if (thresholdChoice.mode == ThresholdChoice::Fixed || thresholdChoice.mode == ThresholdChoice::Auto) {
+        // auto: one histogram pass before the pipeline
+        const int threshold = globalThreshold(img, intensity_threshold - 1);
+        if (thresholdChoice.mode == ThresholdChoice::Auto)
+            std::cout << "Automatic threshold (Otsu): average intensity > " << threshold << "\n";
+        imgproc::MaskPipeline pipeline(threshold, {
+            imgproc::MorphStep::erode(kernel_size, kernel_size),
+            imgproc::MorphStep::dilate(kernel_size, kernel_size),
+            imgproc::MorphStep::dilate(kernel_size + 4, kernel_size + 4),
+        });
+        pipeline.run(img, dilatedMask);
+    } else {
+        // a local threshold needs the whole window around a row: full mask first, same steps after
+        BinarizeScratch binarizeScratch;
+        imgproc::BinaryMask binary;
+        binarize(img, intensity_threshold - 1, binarizeScratch, binary);
+        imgproc::Morphology morph;
+        morph.open(binary, dilatedMask, kernel_size, kernel_size);
+        morph.dilate(dilatedMask, dilatedMask, kernel_size + 4, kernel_size + 4);
+    }
 
-    // Stage 2: Morphological operations
-    auto stage2_end = high_resolution_clock::now();
+    // Stage 1 + 2: Binarizing and Morphological operations - END
+    stage12Counters.end();
+    stage12.end();
 
     // Stage 3: Connected Component Analysis and Area Filtering
-    auto stage3_start = high_resolution_clock::now();
+    trace::Span stage3("task3: components", &stage3_duration);
+    perf::Stage stage3Counters("Stage 3 (Connected Components)", pixels);
     const int MIN_ROAD_AREA = 2000; // Minimum area for road components
-    std::vector<int> visited(width * height);
-
-    for (int sr = 0; sr < height; ++sr) {
-        for (int sc = 0; sc < width; ++sc) {
-
-            // If not visited
-            if (!visited[sr * width + sc]) {
-                uint8_t* px = &dilated.data[sr * rowSize + sc * 3];
-
-                // based on targetWhite flag
-                bool isTarget = targetWhite
-                    ? (px[0] == 255 && px[1] == 255 && px[2] == 255)   // white pixel
-                    : (px[0] == 0   && px[1] == 0   && px[2] == 0);   // black pixel
 
-                if (isTarget) {
-                    std::vector<std::pair<int, int>> component_pixels;
+    // label once: the statistics of this pass are reused by Stage 4
+    // (stripes of rows labelled in parallel, same labels as the serial labelComponents)
+    imgproc::ComponentLabels labels;
+    std::vector<imgproc::StripeTiming> labelTiming; // per thread
+    imgproc::labelComponentsParallel(dilatedMask, labels, 4, &labelTiming);
 
-                    // Perform BFS to find all connected target pixels
-                    bfs(dilated, rowSize, width, height, visited, sr, sc,
-                        component_pixels, targetWhite);
-
-                    // If component area is less than MIN_ROAD_AREA, set all its pixels to black
-                    if ((int)component_pixels.size() < MIN_ROAD_AREA) {
-                        for (std::pair<int, int>& p : component_pixels) {
-                            setBlack(dilated, rowSize, p.first, p.second);
-                        }
-                    }
-                }
-            }
-        }
-    }
+    // small white components are set to black; small black components would be
+    // "set to black" as well, which leaves the mask unchanged
+    if (targetWhite)
+        imgproc::removeSmallComponents(dilatedMask, labels, MIN_ROAD_AREA);
 
     // Stage 3: Connected Component Analysis and Area Filtering - END
-    auto stage3_end = high_resolution_clock::now();
+    stage3Counters.end();
+    stage3.end();
 
     // Stage 4: Property Analysis
-    auto stage4_start = high_resolution_clock::now();
-
-    // Reset visited for bounding box drawing
-    std::fill(visited.begin(), visited.end(), 0);
+    trace::Span stage4("task3: properties", &stage4_duration);
+    perf::Stage stage4Counters("Stage 4 (Property Analysis)", pixels);
 
+    // area and bounding box of every remaining white component, collected while labelling
     std::vector<std::tuple<int, int, int, int>> boundingBoxes; // Store bounding boxes
     std::vector<int> componentAreas; // Store areas of components
-
-    for (int sr = 0; sr < height; ++sr) {
-        for (int sc = 0; sc < width; ++sc) {
-
-            // If not visited
-            if (!visited[sr * width + sc]) {
-                uint8_t* px = &dilated.data[sr * rowSize + sc * 3];
-                if (px[0] == 255 && px[1] == 255 && px[2] == 255) { // white pixel
-                    std::vector<std::pair<int, int>> component_pixels;
-                    bfs(dilated, rowSize, width, height, visited, sr, sc, component_pixels, true);
-
-                    // Find bounding box
-                    int minR = height, maxR = -1, minC = width, maxC = -1;
-                    for (const auto& p : component_pixels) {
-                        if (p.first < minR) minR = p.first;
-                        if (p.first > maxR) maxR = p.first;
-                        if (p.second < minC) minC = p.second;
-                        if (p.second > maxC) maxC = p.second;
-                    }
-
-                    // Store bounding box and area
-                    boundingBoxes.emplace_back(minR, minC, maxR, maxC);
-                    componentAreas.push_back((int)component_pixels.size());
-                }
-            }
-        }
+    std::vector<double> componentAxes; // Store longest axis of components
+    const std::vector<imgproc::Diameter> diameters = imgproc::componentDiameters(dilatedMask, labels);
+    for (size_t i = 0; i < labels.stats.size(); ++i) {
+        const imgproc::MaskComponent& comp = labels.stats[i];
+        if (targetWhite && comp.area < MIN_ROAD_AREA)
+            continue; // removed in Stage 3
+        componentAxes.push_back(diameters[i].length);
+        boundingBoxes.emplace_back(comp.minR, comp.minC, comp.maxR, comp.maxC);
+        componentAreas.push_back(comp.area);
     }
 
     // Stage 4: Property Analysis - END
-    auto stage4_end = high_resolution_clock::now();
+    stage4Counters.end();
+    stage4.end();
 
     // Stage 5: Draw Bounding Boxes
-    auto stage5_start = high_resolution_clock::now();
+    trace::Span stage5("task3: draw boxes", &stage5_duration);
+    perf::Stage stage5Counters("Stage 5 (Bounding Box Drawing)", pixels);
+
+    // the boxes and the axis are drawn in color, so expand the mask to BGR here
+    bmp::BMPImage dilated;
+    imgproc::maskToBMP(dilatedMask, dilated);
 
     for (size_t i = 0; i < boundingBoxes.size(); ++i) {
         int minR, minC, maxR, maxC;
@@ -522,49 +456,47 @@ std::pair<double, double> task3(const char* input, const char* output, bool anal
         // Output component properties
         std::cout << "Component " << i + 1 << ": Area = " << componentAreas[i]
                   << ", Bounding Box = [(" << minR << ", " << minC << "), ("
-                  << maxR << ", " << maxC << ")]\n";
+                  << maxR << ", " << maxC << ")], Longest Axis = " << componentAxes[i] << "\n";
     }
 
     // Stage 5: Draw Bounding Boxes - END
-    auto stage5_end = high_resolution_clock::now();
+    stage5Counters.end();
+    stage5.end();
+    total.end();
 
     // Extra: Find the length and orientation of longest axis, and draw it
-    std::vector<std::pair<int, int>> borderPoints;
-    
+    TRACE_SPAN("task3: longest axis");
+    std::vector<imgproc::GridPoint> borderPoints;
+
     // Find white dots on the border with a margin of 5 pixels
+    // (only the ends of every run of white pixels can be on the convex hull)
     const int margin = 5;
-    for (int r = 0; r < dilated.height; ++r) {
-        for (int c = 0; c < dilated.width; ++c) {
-            // r < margin: top border
-            // c < margin: left border
-            // c >= width - margin: right border
-            // r >= height - margin: bottom border
-            if ((r < margin || r >= dilated.height - margin || c < margin || c >= dilated.width - margin)) {
-                // px points to the pixel at (r, c) in dilated image
-                uint8_t* px = &dilated.data[r * rowSize + c * 3];
-                if (px[0] == 255 && px[1] == 255 && px[2] == 255) { // white pixel
-                    borderPoints.emplace_back(r, c); // Store as (row, column)
-                }
-            }
+    auto addRunEnds = [&](int r, int c0, int c1) {
+        for (int c = dilatedMask.nextSet(r, c0); c < c1; c = dilatedMask.nextSet(r, c)) {
+            const int end = std::min(dilatedMask.nextClear(r, c), c1);
+            borderPoints.emplace_back(r, c); // Store as (row, column)
+            if (end - 1 > c)
+                borderPoints.emplace_back(r, end - 1);
+            c = end;
         }
-    }
-    double maxDist = 0.0;
-    std::pair<int, int> p1, p2;
-
-    // Find the two border points with the maximum distance
-    for (size_t i = 0; i < borderPoints.size(); ++i) {
-        for (size_t j = i + 1; j < borderPoints.size(); ++j) {
-
-            // std::hypot(x, y) = sqrt(x^2 + y^2) => euclidean distance
-            double dist = std::hypot(borderPoints[i].first - borderPoints[j].first, borderPoints[i].second - borderPoints[j].second);
-            if (dist > maxDist) {
-                maxDist = dist;
-                p1 = borderPoints[i];
-                p2 = borderPoints[j];
-            }   
+    };
+    for (int r = 0; r < dilated.height; ++r) {
+        // r < margin: top border, r >= height - margin: bottom border => whole row
+        // otherwise c < margin: left border, c >= width - margin: right border
+        if (r < margin || r >= dilated.height - margin) {
+            addRunEnds(r, 0, dilated.width);
+        } else {
+            addRunEnds(r, 0, std::min(margin, dilated.width));
+            addRunEnds(r, std::max(margin, dilated.width - margin), dilated.width);
         }
     }
 
+    // Find the two border points with the maximum distance:
+    // convex hull (monotone chain) + rotating calipers, O(n log n) instead of all pairs
+    const imgproc::Diameter axis = imgproc::pointSetDiameter(std::move(borderPoints));
+    const double maxDist = axis.length;
+    const std::pair<int, int> p1 = axis.p1, p2 = axis.p2;
+
     // arctan2 to find angle in degrees
     double angle = std::atan2(p2.first - p1.first, p2.second - p1.second) * 180.0 / M_PI;
     std::cout << "Longest axis length: " << maxDist << "\n";
@@ -621,46 +553,188 @@ std::pair<double, double> task3(const char* input, const char* output, bool anal
         }
     }
 
-    // Write final image
-    bmp::writeBMP(output, dilated);
+    // Write final image (a mask with a few colored drawings: 8-bit palette instead of 24-bit)
+    bmp::writeBMP(output, dilated, 0);
 
     // Output timing information and time complexity analysis
     if (!analyzeTime) 
         return std::make_pair(0.0, 0.0);
 
-    auto stage1_duration = duration_cast<microseconds>(stage1_end - stage1_start).count();
-    auto stage2_duration = duration_cast<microseconds>(stage2_end - stage2_start).count();
-    auto stage3_duration = duration_cast<microseconds>(stage3_end - stage3_start).count();
-    auto stage4_duration = duration_cast<microseconds>(stage4_end - stage4_start).count();
-    auto stage5_duration = duration_cast<microseconds>(stage5_end - stage5_start).count();
-    auto total_duration  =  duration_cast<microseconds>(stage5_end - start).count();
-
+    // whole microseconds, as printed before the spans
+    auto us = [](double micros) { return static_cast<long long>(micros); };
     std::cout << "Task 3 Timing Information:\n";
-    std::cout << " Stage 1 (Binarization): " << stage1_duration << " us\n";
-    std::cout << " Stage 2 (Morphological Operations): " << stage2_duration << " us\n";
-    std::cout << " Stage 3 (Connected Component Analysis): " << stage3_duration << " us\n";
-    std::cout << " Stage 4 (Property Analysis): " << stage4_duration << " us\n";
-    std::cout << " Stage 5 (Bounding Box Drawing): " << stage5_duration << " us\n";
-    std::cout << " Total Time: " << total_duration << " us\n";
+    std::cout << " Stage 1 + 2 (Binarization + Morphological Operations, fused): " << us(stage12_duration) << " us\n";
+    std::cout << " Stage 3 (Connected Component Analysis): " << us(stage3_duration) << " us\n";
+    for (size_t i = 0; i < labelTiming.size(); ++i) {
+        std::cout << "   Labelling thread " << i + 1 << " (rows " << labelTiming[i].begin << "-" << labelTiming[i].end - 1
+                  << "): " << labelTiming[i].micros << " us\n";
+    }
+    std::cout << " Stage 4 (Property Analysis): " << us(stage4_duration) << " us\n";
+    std::cout << " Stage 5 (Bounding Box Drawing): " << us(stage5_duration) << " us\n";
+    std::cout << " Total Time: " << us(total_duration) << " us\n";
+    if (perf::enabled()) {
+        std::cout << "\n";
+        perf::printReport(std::cout);
+    }
 
     // Time complexity analysis
     std::cout << "\nTime Complexity Analysis:\n";
-    std::cout << " Stage 1 (Binarization): O(H * W)\n";
-    std::cout << " Stage 2 (Morphological Operations): O(H * W * K^2), where K is the kernel size\n";
-    std::cout << " Stage 3 (Connected Component Analysis): O(H * W)\n";
-    std::cout << " Stage 4 (Property Analysis): O(H * W)\n";
+    std::cout << " Stage 1 + 2 (Binarization + Morphological Operations): O(H * W), one read of the input and one write of the mask\n";
+    std::cout << " Stage 3 (Connected Component Analysis): O(H * W / T), T threads label stripes, borders merged with a lock-free union-find\n";
+    std::cout << " Stage 4 (Property Analysis): O(N + R log R), N = number of components, R = number of runs (longest axis of each component)\n";
     std::cout << " Stage 5 (Bounding Box Drawing): O(H * W)\n";
-    std::cout << " Overall Time Complexity: O(H * W * K^2), as morphological operations dominate\n";
+    std::cout << " Overall Time Complexity: O(H * W), binarization and drawing touch every pixel\n";
 
     return std::make_pair(0.0, 0.0);
 }
 
+// Strip as a view, for the kernels that take whole images
+static bmp::BMPImageView viewOfStrip(const bmp::Strip& strip)
+{
+    bmp::BMPImageView view;
+    view.width = strip.width;
+    view.height = strip.rows;
+    view.origin = strip.data.data();
+    view.stride = bmp::rowSizeBytes(strip.width);
+    return view;
+}
+
+// Binarize only (the first step of task1), streamed strip by strip
+// so images larger than RAM can be thresholded with constant memory;
+// written as a 1-bit BMP, 1/24 of the 24-bit output
+// (--threshold auto reads the file twice, histogram first; a local threshold is not
+// available here, a strip does not hold the windows of bradley / sauvola)
+static void binarize_large(const char* input, const char* output, int threshold)
+{
+    TRACE_SPAN("binarize large");
+    if (thresholdChoice.mode == ThresholdChoice::Auto) {
+        bmp::StripReader histogramReader(input);
+        imgproc::IntensityHistogram histogram;
+        bmp::Strip strip;
+        while (histogramReader.next(strip))
+            imgproc::accumulateHistogram(viewOfStrip(strip), histogram);
+        threshold = autoThreshold(histogram);
+        std::cout << "Automatic threshold (Otsu): average intensity > " << threshold << "\n";
+    }
+
+    bmp::StripReader reader(input);
+    const uint32_t palette[2] = {0x000000u, 0xFFFFFFu};
+    bmp::StripWriter writer(output, reader.width(), reader.height(), 1, palette, 2);
+
+    const int rowSize = bmp::rowSizeBytes(reader.width(), 1);
+    imgproc::BinaryMask bits(reader.width(), reader.rowsPerStrip());
+    std::vector<uint8_t> packed(static_cast<size_t>(rowSize) * reader.rowsPerStrip(), 0);
+    bmp::Strip strip;
+    while (reader.next(strip)) {
+        parallel::parallelRows(strip.rows, parallel::kMinRowsPerBand, [&](int begin, int end) {
+            for (int r = begin; r < end; ++r) {
+                imgproc::binarizeRow(strip.row(r), strip.width, threshold, bits.row(r));
+                imgproc::packMaskRow(bits.row(r), strip.width, &packed[static_cast<size_t>(r) * rowSize]);
+            }
+        });
+        writer.write(packed.data(), strip.rows);
+    }
+    writer.close();
+    std::cout << "Binarized image saved as " << output << "\n";
+}
+
 static void task4()
 {
     task3("Ian_island_square.bmp","task3.bmp",true,false);
 }   
 
-int main() {
+static void printUsage(const char* program, std::ostream& out = std::cerr)
+{
+    out << "Usage: " << program << " [--threads N] [--trace FILE] [--counters] [THRESHOLD]                 (menu)\n"
+        << "       " << program << " --pipeline NAME --in DIR --out DIR [--jobs N] [--threads N] [--trace FILE] [THRESHOLD]\n"
+        << "Pipelines: binarize (option 5), road (task1 mask), forest (task2 boxes)\n"
+        << "THRESHOLD: --threshold fixed (default) | auto [--classes N] | bradley | sauvola [--window N]\n"
+        << "  auto: Otsu, N classes (2-5) and the brightest is white; bradley, sauvola: local,"
+           " window N x N, default 1/8 of the shorter side\n"
+        << "--trace FILE: time the stages, write a Chrome trace (chrome://tracing, ui.perfetto.dev) and a summary\n"
+        << "--counters: cycles, instructions, cache and branch misses per pixel of every task 4 stage (Linux)\n";
+}
+
+// Batch mode: every BMP of --in through one pipeline, written to --out under the same name
+static int runBatch(int argc, char** argv)
+{
+    batch::Options opt;
+    try {
+        opt = batch::parseOptions(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // every call gets its own images and the scratch of its worker, so several workers
+    // can run them at once; out and the scratch keep their buffers between images
+    batch::Process process;
+    if (opt.pipeline == "binarize") {
+        process = [](const bmp::BMPImage& in, bmp::BMPImage& out, batch::Workspace& workspace) {
+            RegionScratch& scratch = workspace.get<RegionScratch>();
+            binarize(bmp::viewOf(in), 98, scratch.binarize, scratch.mask);
+            imgproc::maskToBMP(scratch.mask, out);
+        };
+    } else if (opt.pipeline == "road") {
+        process = [](const bmp::BMPImage& in, bmp::BMPImage& out, batch::Workspace& workspace) {
+            RegionScratch& scratch = workspace.get<RegionScratch>();
+            roadMask(bmp::viewOf(in), scratch);
+            imgproc::maskToBMP(scratch.mask, out);
+        };
+    } else if (opt.pipeline == "forest") {
+        // task2 on the task1 mask of the same image (forest = black pixels of the mask)
+        process = [](const bmp::BMPImage& in, bmp::BMPImage& out, batch::Workspace& workspace) {
+            RegionScratch& scratch = workspace.get<RegionScratch>();
+            roadMask(bmp::viewOf(in), scratch);
+            scratch.mask.invert();
+            out = in;
+            labelForest(scratch.mask, nullptr, out, false, scratch); // only the boxes are written
+        };
+    } else {
+        std::cerr << "Unknown pipeline: " << opt.pipeline << "\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        const batch::Summary summary = batch::run(opt.inDir, opt.outDir, opt.jobs, process);
+        std::cout << summary.processed << " images written to " << opt.outDir << ", " << summary.failed
+                  << " failed, " << summary.seconds << " s\n";
+        trace::finish(std::cout);
+        return summary.failed == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (batch::helpRequested(argc, argv)) {
+        printUsage(argv[0], std::cout);
+        return 0;
+    }
+
+    // --threads N: worker count of the kernels (default: one per core)
+    // --threshold MODE, --window N: how the images are binarized
+    // --trace FILE: spans of every stage, written when the program ends
+    // --counters: hardware counters of the task 4 stages (opened before the thread pool starts,
+    // so its workers count too)
+    try {
+        takeThresholdOptions(argc, argv);
+        perf::takeCountersOption(argc, argv);
+        parallel::applyThreadsOption(argc, argv);
+        trace::applyTraceOption(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // any other argument: batch mode, no menu
+    if (batch::requested(argc, argv))
+        return runBatch(argc, argv);
+
     std::cout << "----- Homework 2 Menu -----\n";
     while (true) {
         std::cout << "\n================ Results Menu ================\n"
@@ -668,6 +742,7 @@ int main() {
                   << " 2) Task 2  - Label forest + bounding boxes\n"
                   << " 3) Task 3  - Road extraction + orientation\n"
                   << " 4) Task 4  - Analyze timing\n"
+                  << " 5) Binarize only (streamed, for large images)\n"
                   << " 0) Exit\n"
                   << "Enter the question number: ";
 
@@ -675,7 +750,7 @@ int main() {
         if (!(std::cin >> choice)) {
             std::cin.clear();
             std::cin.ignore(1 << 20, '\n');
-            std::cout << "Invalid input. Please enter a number between 0 and 4.\n";
+            std::cout << "Invalid input. Please enter a number between 0 and 5.\n";
             continue;
         }
         if (choice == 0) break;
@@ -685,8 +760,15 @@ int main() {
             case 2: task2("task1.bmp","Ian_island_square.bmp","task2_fill.bmp", "task2.bmp"); break;
             case 3: task3("Ian_island_square.bmp","task3.bmp",false,false); break;
             case 4: task4(); break;
+            case 5: binarize_large("Ian_island_square.bmp","task1_binary.bmp",98); break;
             default: std::cout << "Unknown selection. Try 0-７.\n"; break; 
         }
     }
+    try {
+        trace::finish(std::cout);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
     return 0;
 }
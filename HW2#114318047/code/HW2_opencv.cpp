@@ -225,15 +225,20 @@ static void task3(const string& input, const string& output, bool analyzeTime)
             if ((r < margin || r >= vis.rows - margin || c < margin || c >= vis.cols - margin) && dilated.at<uchar>(r, c) == 255)
                 borderPts.emplace_back(c, r);
 
+    // The farthest pair is always two hull vertices, so only the hull is searched
+    vector<Point> hull;
+    if (!borderPts.empty())
+        convexHull(borderPts, hull);
+
     double maxDist = 0;
     Point p1, p2;
-    for (size_t i = 0; i < borderPts.size(); ++i)
-        for (size_t j = i + 1; j < borderPts.size(); ++j) {
-            double dist = norm(borderPts[i] - borderPts[j]);
+    for (size_t i = 0; i < hull.size(); ++i)
+        for (size_t j = i + 1; j < hull.size(); ++j) {
+            double dist = norm(hull[i] - hull[j]);
             if (dist > maxDist) {
                 maxDist = dist;
-                p1 = borderPts[i];
-                p2 = borderPts[j];
+                p1 = hull[i];
+                p2 = hull[j];
             }
         }
 
@@ -0,0 +1,293 @@
+#include "batch.hpp"
+#include "trace.hpp" // TRACE_SPAN, trace::nameThread
+#include <algorithm> // for std::sort, std::max
+#include <atomic>
+#include <cctype> // for std::tolower
+#include <chrono>
+#include <cstdlib> // _fullpath
+#include <cstring> // for std::strcmp, std::strncmp, _stricmp
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <utility> // for std::swap, std::move
+#include <cerrno> // EEXIST
+
+#ifdef _WIN32
+#include <direct.h>  // _mkdir
+#include <windows.h> // FindFirstFileA
+#else
+#include <dirent.h>   // opendir, readdir
+#include <sys/stat.h> // mkdir, stat
+#endif
+
+namespace batch {
+
+namespace {
+
+// --threads N and --trace FILE apply to the menu as well, their parsers are elsewhere
+bool isProgramOption(const char* arg) {
+    return std::strcmp(arg, "--threads") == 0 || std::strncmp(arg, "--threads=", 10) == 0 ||
+           std::strcmp(arg, "--trace") == 0 || std::strncmp(arg, "--trace=", 8) == 0;
+}
+
+// true for the forms that take the next argument as their value
+bool takesNextArgument(const char* arg) {
+    return std::strcmp(arg, "--threads") == 0 || std::strcmp(arg, "--trace") == 0;
+}
+
+bool endsWithBMP(const std::string& name) {
+    if (name.size() < 4) return false;
+    std::string ext = name.substr(name.size() - 4);
+    for (char& c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return ext == ".bmp";
+}
+
+bool isSeparator(char c) {
+#ifdef _WIN32
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+std::string joinPath(const std::string& dir, const std::string& name) {
+    if (dir.empty()) return name;
+    const char last = dir[dir.size() - 1];
+    return (last == '/' || last == '\\') ? dir + name : dir + "/" + name;
+}
+
+// True when both paths name the same existing directory, however they are spelled
+// ("out", "out/", "./out", a symlink)
+bool sameDirectory(const std::string& a, const std::string& b) {
+#ifdef _WIN32
+    char fullA[_MAX_PATH], fullB[_MAX_PATH];
+    if (!_fullpath(fullA, a.c_str(), _MAX_PATH) || !_fullpath(fullB, b.c_str(), _MAX_PATH)) return false;
+    std::string x = fullA, y = fullB;
+    while (x.size() > 3 && (x.back() == '\\' || x.back() == '/')) x.pop_back(); // keeps "C:\"
+    while (y.size() > 3 && (y.back() == '\\' || y.back() == '/')) y.pop_back();
+    return _stricmp(x.c_str(), y.c_str()) == 0;
+#else
+    struct stat sa, sb;
+    return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+double millisSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+bool requested(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (takesNextArgument(argv[i])) {
+            ++i; // its value
+            continue;
+        }
+        if (!isProgramOption(argv[i])) return true;
+    }
+    return false;
+}
+
+bool helpRequested(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (takesNextArgument(argv[i])) {
+            ++i; // its value
+            continue;
+        }
+        if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) return true;
+    }
+    return false;
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (isProgramOption(argv[i])) {
+            if (takesNextArgument(argv[i])) ++i;
+            continue;
+        }
+        const size_t eq = arg.find('=');
+        const std::string name = arg.substr(0, eq);
+        if (name != "--pipeline" && name != "--in" && name != "--out" && name != "--jobs") {
+            throw std::invalid_argument("unknown option " + arg);
+        }
+        std::string value;
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+        } else {
+            if (i + 1 == argc) throw std::invalid_argument(arg + " needs a value");
+            value = argv[++i];
+        }
+
+        if (name == "--pipeline") {
+            opt.pipeline = value;
+        } else if (name == "--in") {
+            opt.inDir = value;
+        } else if (name == "--out") {
+            opt.outDir = value;
+        } else {
+            size_t used = 0;
+            try {
+                opt.jobs = std::stoi(value, &used);
+            } catch (const std::exception&) {
+                used = 0;
+            }
+            if (used == 0 || used != value.size() || opt.jobs < 1) {
+                throw std::invalid_argument("--jobs needs a positive number, got " + value);
+            }
+        }
+    }
+    if (opt.pipeline.empty() || opt.inDir.empty() || opt.outDir.empty()) {
+        throw std::invalid_argument("batch mode needs --pipeline, --in and --out");
+    }
+    return opt;
+}
+
+std::vector<std::string> listBMPs(const std::string& dir) {
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE h = FindFirstFileA(joinPath(dir, "*").c_str(), &entry);
+    if (h == INVALID_HANDLE_VALUE) throw std::runtime_error("Cannot read directory: " + dir);
+    do {
+        if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && endsWithBMP(entry.cFileName)) {
+            names.push_back(entry.cFileName);
+        }
+    } while (FindNextFileA(h, &entry));
+    FindClose(h);
+#else
+    DIR* d = opendir(dir.c_str());
+    if (!d) throw std::runtime_error("Cannot read directory: " + dir);
+    while (dirent* entry = readdir(d)) {
+        const std::string name = entry->d_name;
+        struct stat st;
+        if (endsWithBMP(name) && stat(joinPath(dir, name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+#endif
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void makeDirectory(const std::string& dir) {
+    // one level at a time, from the first missing parent down to dir itself
+    for (size_t i = 1; i <= dir.size(); ++i) {
+        if (i < dir.size() && !isSeparator(dir[i])) continue;
+        if (isSeparator(dir[i - 1])) continue; // the root, or "a//b"
+        const std::string prefix = dir.substr(0, i);
+#ifdef _WIN32
+        if (prefix.size() == 2 && prefix[1] == ':') continue; // a drive, "C:"
+        const int failed = _mkdir(prefix.c_str());
+#else
+        const int failed = mkdir(prefix.c_str(), 0777);
+#endif
+        if (failed != 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create directory: " + prefix);
+        }
+    }
+}
+
+Summary run(const std::string& inDir, const std::string& outDir, int jobs, const Process& process) {
+    const auto start = std::chrono::steady_clock::now();
+    // outDir exists from here on, so the two can be compared by identity rather than by name
+    makeDirectory(outDir);
+    if (sameDirectory(inDir, outDir)) {
+        throw std::runtime_error("--out must not be the --in directory, the inputs would be overwritten");
+    }
+    const std::vector<std::string> names = listBMPs(inDir);
+    if (jobs <= 0) jobs = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    // every string is built here, the stages below only index them
+    std::vector<std::string> inPaths, outPaths;
+    inPaths.reserve(names.size());
+    outPaths.reserve(names.size());
+    for (const std::string& name : names) {
+        inPaths.push_back(joinPath(inDir, name));
+        outPaths.push_back(joinPath(outDir, name));
+    }
+
+    bmp::BufferPool buffers;
+    BoundedQueue<Job> toWork(jobs), toWrite(jobs);
+    Summary summary;
+
+    // Stage 1: read and decode, in file order, into buffers of the pool
+    std::thread reader([&] {
+        trace::nameThread("batch reader");
+        for (size_t i = 0; i < names.size(); ++i) {
+            Job job;
+            job.index = i;
+            try {
+                bmp::readBMP(inPaths[i].c_str(), job.image, buffers);
+            } catch (const std::exception& e) {
+                job.error = std::string("read: ") + e.what();
+            }
+            toWork.push(std::move(job));
+        }
+        toWork.close();
+    });
+
+    // Stage 2: compute; the last worker to finish closes the writer's queue
+    std::atomic<int> running(jobs);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < jobs; ++w) {
+        workers.emplace_back([&, w] {
+            trace::nameThread("batch worker " + std::to_string(w + 1));
+            Workspace workspace;
+            Job job;
+            bmp::BMPImage result;
+            size_t lastBytes = 0; // the next result is probably as large as the last one
+            while (toWork.pop(job)) {
+                if (job.error.empty()) {
+                    const auto t0 = std::chrono::steady_clock::now();
+                    try {
+                        TRACE_SPAN("batch: process");
+                        result.data = buffers.acquire(lastBytes);
+                        process(job.image, result, workspace);
+                        lastBytes = result.data.size();
+                        std::swap(job.image, result);
+                    } catch (const std::exception& e) {
+                        job.error = std::string("process: ") + e.what();
+                    }
+                    buffers.release(result); // the input, or the result that failed
+                    job.computeMs = millisSince(t0);
+                }
+                toWrite.push(std::move(job));
+            }
+            if (--running == 0) toWrite.close();
+        });
+    }
+
+    // Stage 3: encode and write (this thread); the only stage that prints
+    Job job;
+    size_t done = 0;
+    while (toWrite.pop(job)) {
+        ++done;
+        const std::string& name = names[job.index];
+        if (job.error.empty()) {
+            try {
+                bmp::writeBMP(outPaths[job.index].c_str(), job.image, 0); // masks as 1 / 8-bit
+            } catch (const std::exception& e) {
+                job.error = std::string("write: ") + e.what();
+            }
+        }
+        buffers.release(job.image); // back for the next result
+        if (job.error.empty()) {
+            ++summary.processed;
+            std::cout << "[" << done << "/" << names.size() << "] " << name << " (" << job.computeMs << " ms)\n";
+        } else {
+            ++summary.failed;
+            std::cerr << "[" << done << "/" << names.size() << "] " << name << " failed, " << job.error << "\n";
+        }
+    }
+
+    reader.join();
+    for (std::thread& t : workers) t.join();
+    summary.seconds = millisSince(start) / 1000.0;
+    return summary;
+}
+
+} // namespace batch
@@ -0,0 +1,158 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory> // for std::shared_ptr
+#include <mutex>
+#include <string>
+#include <utility> // for std::pair
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImage, bmp::BufferPool
+
+namespace batch {
+
+// FIFO of at most `capacity` items between two pipeline stages
+/*
+    push blocks while the queue is full, pop blocks while it is empty; after close()
+    push is not allowed any more and pop returns false once the queue is drained.
+    The items live in a ring of `capacity` slots allocated up front, so passing an
+    item on never allocates.
+*/
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : slots_(capacity < 1 ? 1 : capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [&] { return count_ < slots_.size(); });
+        slots_[(head_ + count_) % slots_.size()] = std::move(item);
+        ++count_;
+        notEmpty_.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [&] { return count_ > 0 || closed_; });
+        if (count_ == 0) return false;
+        item = std::move(slots_[head_]);
+        head_ = (head_ + 1) % slots_.size();
+        --count_;
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    std::vector<T> slots_;
+    size_t head_ = 0;  // oldest item
+    size_t count_ = 0; // items in the ring
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable notFull_, notEmpty_;
+};
+
+// One image of the batch on its way through the stages
+struct Job {
+    size_t index = 0;        // position in the sorted file list (its name, in --in and --out)
+    bmp::BMPImage image;     // decoded input, then the result (buffers of the batch's pool)
+    std::string error;       // set by the stage that failed, later stages pass the job on
+    double computeMs = 0;
+};
+
+// Scratch objects of one worker, kept for the whole batch
+/*
+    get<T>() returns this worker's T, default-constructed on first use. A pipeline keeps
+    its masks, label images and temporary images there instead of in locals, so after
+    the first images have grown the buffers it runs without heap allocations:
+
+        Scratch& s = workspace.get<Scratch>();
+        imgproc::binarizeToMask(view, 98, s.mask); // s.mask keeps its buffer
+
+    Every worker has its own workspace, nothing in it is shared between threads.
+*/
+class Workspace {
+public:
+    template <typename T>
+    T& get() {
+        const void* key = typeKey<T>();
+        for (const auto& slot : slots_) {
+            if (slot.first == key) return *static_cast<T*>(slot.second.get());
+        }
+        std::shared_ptr<T> object = std::make_shared<T>();
+        slots_.emplace_back(key, object);
+        return *object;
+    }
+
+private:
+    // one address per type, no RTTI needed
+    template <typename T>
+    static const void* typeKey() {
+        static const char key = 0;
+        return &key;
+    }
+
+    std::vector<std::pair<const void*, std::shared_ptr<void>>> slots_;
+};
+
+// in -> out, run by several workers at once (each call gets its own images and the
+// workspace of the worker that runs it); out arrives empty, with a reused buffer
+typedef std::function<void(const bmp::BMPImage&, bmp::BMPImage&, Workspace&)> Process;
+
+// --pipeline NAME --in DIR --out DIR [--jobs N]
+struct Options {
+    std::string pipeline;
+    std::string inDir;
+    std::string outDir;
+    int jobs = 0; // workers, 0 = one per core
+};
+
+// True when the command line has arguments other than --threads and --trace, i.e. batch mode
+bool requested(int argc, char** argv);
+
+// True when --help or -h is on the command line: print the usage and exit 0 before parsing
+bool helpRequested(int argc, char** argv);
+
+// Throws std::invalid_argument for an unknown option, a missing value or a bad number;
+// --threads and --trace are skipped (parallel::applyThreadsOption, trace::applyTraceOption)
+Options parseOptions(int argc, char** argv);
+
+// The *.bmp files (any case) directly in dir, sorted by name; throws std::runtime_error
+// when dir cannot be read
+std::vector<std::string> listBMPs(const std::string& dir);
+
+// Create dir and every missing parent of it; the ones that exist already are fine
+void makeDirectory(const std::string& dir);
+
+struct Summary {
+    int processed = 0;
+    int failed = 0;
+    double seconds = 0;
+};
+
+// Every BMP of inDir through process, written to outDir under the same name; throws
+// std::runtime_error when outDir is inDir (compared as directories, not as strings)
+/*
+    reader thread --> queue (jobs) --> `jobs` workers --> queue (jobs) --> writer thread
+      readBMP                             process                           writeBMP
+
+    The reader decodes the next images while the workers compute and the writer
+    encodes the previous results, so disk and CPU overlap; the bounded queues keep
+    at most about 4 * jobs images in memory. A file that fails to read, process or
+    write is reported and skipped, the others go on. The writer prints one line per file.
+    Results are written in the smallest lossless format (bmp::writeBMP with bitCount 0),
+    so masks are stored as 1-bit and masks with drawings as 8-bit BMPs.
+
+    Image buffers go round through one bmp::BufferPool (reader -> worker input, worker
+    output -> writer -> next output) and every worker has its own Workspace, so once
+    the first few images have filled the pool, an image costs no heap allocation
+    (paths are built up front, the queues are fixed rings).
+*/
+Summary run(const std::string& inDir, const std::string& outDir, int jobs, const Process& process);
+
+} // namespace batch
@@ -0,0 +1,254 @@
+#include "binary_mask.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "color.hpp" // imgproc::grayRow
+#include "point_ops.hpp" // imgproc::ops::pipe, imgproc::ops::run
+#include "run_mask.hpp" // imgproc::RunMask, imgproc::RunLabelScratch
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <algorithm> // for std::min, std::max
+#include <stdexcept>
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h> // _BitScanForward64, __popcnt64
+#endif
+
+namespace imgproc {
+
+namespace {
+
+inline int countTrailingZeros(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+inline int popCount(uint64_t x) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(x));
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+#if ACV_X86
+
+// One mask word: 64 pixels of three planes, 16 at a time (may read up to 63 bytes past the width)
+ACV_TARGET("ssse3")
+uint64_t binarizeWordSSSE3(const uint8_t* b, const uint8_t* g, const uint8_t* r, __m128i belowSum) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t word = 0;
+    for (int k = 0; k < 64; k += 16) {
+        const __m128i vb = _mm_load_si128(reinterpret_cast<const __m128i*>(b + k));
+        const __m128i vg = _mm_load_si128(reinterpret_cast<const __m128i*>(g + k));
+        const __m128i vr = _mm_load_si128(reinterpret_cast<const __m128i*>(r + k));
+        const __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(vb, zero), _mm_unpacklo_epi8(vg, zero)),
+                                         _mm_unpacklo_epi8(vr, zero));
+        const __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(vb, zero), _mm_unpackhi_epi8(vg, zero)),
+                                         _mm_unpackhi_epi8(vr, zero));
+        // sums <= 765 fit the signed compare; packs keeps the 0 / -1 of every pixel
+        const __m128i white = _mm_packs_epi16(_mm_cmpgt_epi16(lo, belowSum), _mm_cmpgt_epi16(hi, belowSum));
+        word |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(white))) << k;
+    }
+    return word;
+}
+
+#endif
+
+} // namespace
+
+BinaryMask::BinaryMask(int width, int height)
+    : width_(width), height_(height), words_((width + 63) / 64),
+      bits_(static_cast<size_t>((width + 63) / 64) * height, 0) {
+    if (width <= 0 || height <= 0) {
+        throw std::invalid_argument("BinaryMask: size must be positive");
+    }
+}
+
+uint64_t BinaryMask::lastWordMask() const {
+    const int used = width_ & 63;
+    return used ? (uint64_t(1) << used) - 1 : ~uint64_t(0);
+}
+
+int BinaryMask::nextSet(int r, int c) const {
+    const uint64_t* p = row(r);
+    int w = c >> 6;
+    if (w >= words_) return width_;
+    uint64_t x = p[w] & (~uint64_t(0) << (c & 63));
+    while (x == 0) {
+        if (++w == words_) return width_;
+        x = p[w];
+    }
+    return (w << 6) + countTrailingZeros(x);
+}
+
+// the padding bits are 0, so the search stops at the width by itself
+int BinaryMask::nextClear(int r, int c) const {
+    const uint64_t* p = row(r);
+    int w = c >> 6;
+    if (w >= words_) return width_;
+    uint64_t x = ~p[w] & (~uint64_t(0) << (c & 63));
+    while (x == 0) {
+        if (++w == words_) return width_;
+        x = ~p[w];
+    }
+    return std::min(width_, (w << 6) + countTrailingZeros(x));
+}
+
+void BinaryMask::clearRange(int r, int begin, int end) {
+    uint64_t* p = row(r);
+    while (begin < end) {
+        const int w = begin >> 6;
+        const int lo = begin & 63;
+        const int hi = std::min(64, lo + (end - begin)); // bits [lo, hi) of word w
+        const uint64_t bits = (hi == 64 ? ~uint64_t(0) : (uint64_t(1) << hi) - 1) & (~uint64_t(0) << lo);
+        p[w] &= ~bits;
+        begin += hi - lo;
+    }
+}
+
+void BinaryMask::invert() {
+    const uint64_t last = lastWordMask();
+    for (int r = 0; r < height_; ++r) {
+        uint64_t* p = row(r);
+        for (int w = 0; w < words_; ++w) p[w] = ~p[w];
+        p[words_ - 1] &= last;
+    }
+}
+
+long long BinaryMask::count() const {
+    long long n = 0;
+    for (uint64_t w : bits_) n += popCount(w);
+    return n;
+}
+
+void binarizeRow(const uint8_t* px, int width, int threshold, uint64_t* out) {
+    grayRow(px, width, Grayscale::average(), threshold, out, nullptr);
+}
+
+void binarizeToMask(const bmp::BMPImageView& img, int threshold, BinaryMask& out) {
+    TRACE_SPAN("imgproc: binarize");
+    // every word of every row is overwritten below, no need to clear a reused mask
+    if (out.width() != img.width || out.height() != img.height) out = BinaryMask(img.width, img.height);
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) binarizeRow(img.row(r), img.width, threshold, out.row(r));
+    });
+}
+
+void binarizeToMask(const PlanarImage& img, int threshold, BinaryMask& out) {
+    TRACE_SPAN("imgproc: binarize planar");
+    if (out.width() != img.width() || out.height() != img.height()) out = BinaryMask(img.width(), img.height());
+    const int minSum = 3 * (threshold + 1);
+    const uint64_t last = out.lastWordMask();
+    const int words = out.wordsPerRow();
+#if ACV_X86
+    const bool simd = cpu::hasSSSE3();
+    const __m128i belowSum = _mm_set1_epi16(static_cast<short>(std::min(std::max(minSum - 1, -1), 765)));
+#endif
+    parallel::parallelRows(img.height(), parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) {
+            const uint8_t* b = img.row(0, r);
+            const uint8_t* g = img.row(1, r);
+            const uint8_t* rr = img.row(2, r);
+            uint64_t* bits = out.row(r);
+            for (int w = 0; w < words; ++w) {
+                const int c0 = w * 64;
+                uint64_t word = 0;
+#if ACV_X86
+                if (simd) {
+                    word = binarizeWordSSSE3(b + c0, g + c0, rr + c0, belowSum);
+                } else
+#endif
+                {
+                    const int n = std::min(64, img.width() - c0);
+                    for (int i = 0; i < n; ++i) {
+                        word |= static_cast<uint64_t>(b[c0 + i] + g[c0 + i] + rr[c0 + i] >= minSum) << i;
+                    }
+                }
+                bits[w] = w == words - 1 ? word & last : word;
+            }
+        }
+    });
+}
+
+void packMaskRow(const uint64_t* bits, int width, uint8_t* out) {
+    // mask bit b of a word is pixel b, BMP bit 7 of a byte is the first pixel: reverse every byte
+    static const struct ReversedBytes {
+        uint8_t table[256];
+        ReversedBytes() {
+            for (int b = 0; b < 256; ++b) {
+                int r = 0;
+                for (int i = 0; i < 8; ++i) r |= ((b >> i) & 1) << (7 - i);
+                table[b] = static_cast<uint8_t>(r);
+            }
+        }
+    } reversed;
+
+    const int bytes = (width + 7) / 8;
+    for (int i = 0; i < bytes; ++i) {
+        out[i] = reversed.table[(bits[i >> 3] >> (8 * (i & 7))) & 0xFF]; // bits past the width are 0
+    }
+}
+
+void writeMaskBMP(const char* filename, const BinaryMask& mask) {
+    TRACE_SPAN("bmp: write mask");
+    const uint32_t palette[2] = {0x000000u, 0xFFFFFFu};
+    bmp::StripWriter writer(filename, mask.width(), mask.height(), 1, palette, 2);
+    // a strip of packed rows per write, the padding bytes stay 0
+    const int rowSize = bmp::rowSizeBytes(mask.width(), 1);
+    const int rowsPerWrite = std::max(1, (64 << 10) / rowSize);
+    std::vector<uint8_t> rows(static_cast<size_t>(rowSize) * std::min(rowsPerWrite, mask.height()), 0);
+    for (int r0 = 0; r0 < mask.height(); r0 += rowsPerWrite) {
+        const int count = std::min(rowsPerWrite, mask.height() - r0);
+        for (int i = 0; i < count; ++i) packMaskRow(mask.row(r0 + i), mask.width(), &rows[static_cast<size_t>(i) * rowSize]);
+        writer.write(rows.data(), count);
+    }
+    writer.close();
+}
+
+BinaryMask maskFromBMP(const bmp::BMPImageView& img, bool white) {
+    TRACE_SPAN("imgproc: mask from BMP");
+    using namespace ops;
+    const int value = white ? 255 : 0;
+    BinaryMask mask;
+    run(img, pipe(equals(Bgr{value, value, value}), toMask), mask);
+    return mask;
+}
+
+void maskToBMP(const BinaryMask& mask, bmp::BMPImage& out) {
+    TRACE_SPAN("imgproc: mask to BMP");
+    out.width = mask.width();
+    out.height = mask.height();
+    const int rowSize = bmp::rowSizeBytes(out.width);
+    out.data.assign(static_cast<size_t>(rowSize) * out.height, 0);
+    parallel::parallelRows(out.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) {
+            const uint64_t* bits = mask.row(r);
+            uint8_t* px = &out.data[static_cast<size_t>(r) * rowSize];
+            for (int c = 0; c < out.width; ++c, px += 3) {
+                const uint8_t v = static_cast<uint8_t>(0 - ((bits[c >> 6] >> (c & 63)) & 1u)); // 1 => 255
+                px[0] = v; // B
+                px[1] = v; // G
+                px[2] = v; // R
+            }
+        }
+    });
+}
+
+MaskLabels labelMask(const BinaryMask& mask) {
+    return labelMask(RunMask(mask), 4);
+}
+
+int removeSmallComponents(BinaryMask& mask, int minArea) {
+    RunLabelScratch scratch;
+    return removeSmallComponents(mask, minArea, 4, scratch);
+}
+
+} // namespace imgproc
@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImage, bmp::BMPImageView
+#include "planar.hpp" // imgproc::PlanarImage, imgproc::Layout
+
+namespace imgproc {
+
+// Binary image with 1 bit per pixel, packed into 64-bit words
+/*
+    Rows are stored in the same order as BMPImage::data (row 0 = bottom row),
+    every row starts on a new word:
+    pixel (r, c) = bit (c % 64) of word (c / 64) of row r
+
+    bits past the width in the last word of a row are always 0, so whole words
+    can be counted, compared and combined without masking
+*/
+class BinaryMask {
+public:
+    BinaryMask() {}
+    BinaryMask(int width, int height); // all pixels 0
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int wordsPerRow() const { return words_; }
+
+    uint64_t* row(int r) { return &bits_[static_cast<size_t>(r) * words_]; }
+    const uint64_t* row(int r) const { return &bits_[static_cast<size_t>(r) * words_]; }
+
+    bool get(int r, int c) const { return (row(r)[c >> 6] >> (c & 63)) & 1u; }
+    void set(int r, int c, bool value) {
+        const uint64_t bit = uint64_t(1) << (c & 63);
+        if (value) row(r)[c >> 6] |= bit;
+        else row(r)[c >> 6] &= ~bit;
+    }
+
+    // First 1 pixel of row r at or after column c, width() if there is none
+    int nextSet(int r, int c) const;
+    // First 0 pixel of row r at or after column c, width() if the row is 1 up to the end
+    int nextClear(int r, int c) const;
+
+    // Clear pixels [begin, end) of row r, a word at a time
+    void clearRange(int r, int begin, int end);
+
+    // 1 <=> 0 for every pixel (the bits past the width stay 0)
+    void invert();
+
+    // Number of 1 pixels
+    long long count() const;
+
+    // Mask of the valid bits in the last word of a row
+    uint64_t lastWordMask() const;
+
+    bool operator==(const BinaryMask& other) const {
+        return width_ == other.width_ && height_ == other.height_ && bits_ == other.bits_;
+    }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int words_ = 0;
+    std::vector<uint64_t> bits_;
+};
+
+// 1 where the pixel's average intensity (B + G + R) / 3 is > threshold, as HW2 task1
+// (16 pixels per step, see grayRow in color.hpp for other intensities)
+// out keeps its buffer when it already has the size of img
+void binarizeToMask(const bmp::BMPImageView& img, int threshold, BinaryMask& out);
+
+inline BinaryMask binarizeToMask(const bmp::BMPImageView& img, int threshold) {
+    BinaryMask mask;
+    binarizeToMask(img, threshold, mask);
+    return mask;
+}
+
+// The same for one row of width BGR pixels into one mask row
+void binarizeRow(const uint8_t* px, int width, int threshold, uint64_t* out);
+
+// The same on planes: 16 pixels per compare with SSSE3, no shuffles, whole words
+// (the plane rows are padded to 64 pixels)
+void binarizeToMask(const PlanarImage& img, int threshold, BinaryMask& out);
+
+// binarizeToMask for LazyImage::run, on planes
+struct BinarizeKernel {
+    static const Layout layout = Layout::Planar;
+    int threshold;
+    void operator()(const PlanarImage& img, BinaryMask& out) const { binarizeToMask(img, threshold, out); }
+};
+
+// 1 where the pixel is exactly white (255, 255, 255), or exactly black (0, 0, 0) when white is false
+BinaryMask maskFromBMP(const bmp::BMPImageView& img, bool white = true);
+
+// 1 => white, 0 => black, 24-bit BGR
+void maskToBMP(const BinaryMask& mask, bmp::BMPImage& out);
+
+// One mask row as a row of a 1-bit BMP: the leftmost pixel in the most significant bit,
+// (width + 7) / 8 bytes (the BMP row padding is not written)
+void packMaskRow(const uint64_t* bits, int width, uint8_t* out);
+
+// Write mask as a 1-bit BMP with the palette black, white (1 => white), 1/24 of the size of
+// maskToBMP + writeBMP; readBMP / mapBMP read it back as 24-bit black and white
+void writeMaskBMP(const char* filename, const BinaryMask& mask);
+
+// A horizontal run of 1 pixels [begin, end) in row `row`
+struct MaskRun {
+    int row;
+    int begin;
+    int end;
+    int component; // index into MaskLabels::components
+};
+
+// Statistics of one 4-connected component
+struct MaskComponent {
+    int area = 0;
+    int minR = 0, minC = 0, maxR = 0, maxC = 0; // bounding box, inclusive
+    long long sumR = 0, sumC = 0;              // centroid = sum / area
+};
+
+struct MaskLabels {
+    std::vector<MaskRun> runs;             // in raster order (row, then column)
+    std::vector<MaskComponent> components; // ordered by their first pixel in raster order
+};
+
+// 4-connected components of the 1 pixels
+/*
+    Works on runs instead of pixels (labelMask of run_mask.hpp on RunMask(mask)): the runs
+    of a row are found a word at a time (count-trailing-zeros on the word and its
+    complement), a run is merged (union-find) with every run of the row below whose
+    columns overlap it.
+    Components come out in the same order as a raster scan that starts a BFS at every
+    unvisited pixel, so region numbering matches the old HW2 loops
+*/
+MaskLabels labelMask(const BinaryMask& mask);
+
+// Clear every component smaller than minArea pixels, returns how many were removed
+int removeSmallComponents(BinaryMask& mask, int minArea);
+
+} // namespace imgproc
@@ -1,27 +1,165 @@
 #include "bmp.hpp" //define BMPImage, readBMP, writeBMP
+#include "trace.hpp" // TRACE_SPAN
 #include <iostream>
 #include <cmath>
+#include <climits> // INT_MIN
+#include <cstring> // for std::memcpy
+#include <algorithm> // for std::copy, std::fill, std::sort
+#include <string> // for std::to_string
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, munmap, madvise
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+#endif
 
 // readBMP, writeBMP
 namespace bmp {
 
-BMPImage readBMP(const char* filename) {
-    
-    // open file
-    FILE* input_file = fopen(filename, "rb");
-    if (!input_file) {
+MappedFile::MappedFile(const char* filename) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open file: " + std::string(filename));
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map empty file: " + std::string(filename));
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map file: " + std::string(filename));
+    }
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map file: " + std::string(filename));
+    }
+    file_ = file;
+    mapping_ = mapping;
+    data_ = static_cast<const uint8_t*>(view);
+    size_ = static_cast<size_t>(fileSize.QuadPart);
+#else
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         throw std::runtime_error("Cannot open file: " + std::string(filename));
     }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        throw std::runtime_error("Cannot map empty file: " + std::string(filename));
+    }
+    void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid after the descriptor is closed
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Cannot map file: " + std::string(filename));
+    }
+    // pixels are read front to back (or back to front for top-down files), never randomly
+    madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8_t*>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+    CloseHandle(static_cast<HANDLE>(mapping_));
+    CloseHandle(static_cast<HANDLE>(file_));
+#else
+    munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+}
+
+// biCompression values
+static const uint32_t kCompressionRGB = 0;       // BI_RGB, uncompressed
+static const uint32_t kCompressionRLE8 = 1;      // BI_RLE8, 8-bit run-length encoding
+static const uint32_t kCompressionBitfields = 3; // BI_BITFIELDS, channel masks after the header
+
+namespace {
+
+// One channel of a BI_BITFIELDS pixel, scaled to 0..255
+struct ChannelMask {
+    uint32_t mask = 0;
+    int shift = 0;
+    int bits = 0;
+
+    explicit ChannelMask(uint32_t m = 0) : mask(m) {
+        if (!mask) return;
+        while (!((mask >> shift) & 1u)) ++shift;
+        while (shift + bits < 32 && ((mask >> (shift + bits)) & 1u)) ++bits;
+    }
+
+    uint8_t operator()(uint32_t px) const {
+        if (!mask) return 0;
+        const uint32_t v = (px & mask) >> shift;
+        if (bits >= 8) return static_cast<uint8_t>(v >> (bits - 8)); // keep the top 8 bits
+        const uint32_t max = (1u << bits) - 1;
+        return static_cast<uint8_t>((v * 255 + max / 2) / max); // e.g. 5 bits: 31 -> 255
+    }
+};
+
+// What the headers of a mapped BMP say about its pixels
+struct Layout {
+    int width = 0;
+    int height = 0;                  // rows, positive also for top-down files
+    bool topDown = false;
+    int bitCount = 0;
+    uint32_t compression = 0;
+    const uint8_t* pixels = nullptr; // first byte of the pixel data
+    size_t pixelBytes = 0;           // bytes from pixels to the end of the file
+    uint32_t palette[256];           // 0xRRGGBB, entries the file does not have are black
+    uint32_t masks[3];               // red, green, blue of 32-bit pixels
+
+    // 24-bit BI_RGB, the pixels can be used in place
+    bool isPlain24() const { return bitCount == 24 && compression == kCompressionRGB; }
+};
+
+} // namespace
+
+// Parse and check the headers of a mapped BMP
+// (the file name is only turned into a string when there is an error to report)
+// The size limits of both readers: 4 bytes per pixel must fit an int row size, and the
+// height must have an absolute value (std::abs(INT_MIN) is undefined)
+static bool validDimensions(int width, int height) {
+    return width > 0 && width <= 0x1FFFFFFF / 4 && height != 0 && height != INT_MIN;
+}
+
+static void parseLayout(const MappedFile& file, const char* filename, Layout& layout) {
 
     BMPHeader header{}; //{} to initialize all members to zero BMPHeader
     BMPInfoHeader info{}; //BMPInfoHeader
 
-    fread(&header, sizeof(header), 1, input_file);
-    fread(&info, sizeof(info), 1, input_file);
+    if (file.size() < sizeof(header) + sizeof(info)) {
+        throw std::runtime_error("Truncated BMP header: " + std::string(filename));
+    }
+    // memcpy instead of casting the mapped bytes, the headers are not aligned
+    std::memcpy(&header, file.data(), sizeof(header));
+    std::memcpy(&info, file.data() + sizeof(header), sizeof(info));
+
+    if (header.bfType != 0x4D42) {
+        throw std::runtime_error("Not a BMP file: " + std::string(filename));
+    }
+    // biSize 40 = BITMAPINFOHEADER; 52 / 56 / 108 / 124 (V2 - V5) only add fields after it
+    const bool palettized = info.biBitCount == 1 || info.biBitCount == 4 || info.biBitCount == 8;
+    const bool supported = info.biSize >= sizeof(info) &&
+        ((palettized && info.biCompression == kCompressionRGB) ||
+         (info.biBitCount == 8 && info.biCompression == kCompressionRLE8) ||
+         (info.biBitCount == 24 && info.biCompression == kCompressionRGB) ||
+         (info.biBitCount == 32 && (info.biCompression == kCompressionRGB || info.biCompression == kCompressionBitfields)));
+    if (!supported) {
+        throw std::runtime_error("Only 1, 4, 8 (also RLE8), 24 and 32-bit BMP are supported: " + std::string(filename));
+    }
 
     const int width = info.biWidth;
     // biHeight < 0 means top-down bitmap
-    int height = info.biHeight;
+    const int height = info.biHeight;
     // height could be negative when the bitmap is top-down(BGR data stored from top to bottom)
     /*
         top-down: bottom-up:
@@ -31,90 +169,635 @@ BMPImage readBMP(const char* filename) {
 
         it just the difference of the order of rows, the result are the same
     */
+    // RLE8 files are always bottom-up
+    if (!validDimensions(width, height) || (height < 0 && info.biCompression == kCompressionRLE8)) {
+        throw std::runtime_error("Invalid BMP dimensions: " + std::string(filename));
+    }
     const int absHeight = std::abs(height);
-    const int rowSize = rowSizeBytes(width); //define in bmp.hpp, rowSizeBytes is for calculating the row size with padding(has to be multiple of 4 bytes)
-    const int dataSize = rowSize * absHeight;
-
-    std::vector<uint8_t> data(dataSize);
-
-    fseek(input_file, header.bfOffBits, SEEK_SET); // BfOffBits is the offset to the pixel data (First byte of pixel data)
-    fread(data.data(), 1, dataSize, input_file); // SEEK_SET means from the beginning of the file
-    fclose(input_file);                          // SEEK_SET:reference point, header.bfOffBits:offset, SEEK_SET:from the beginning of the file
-
-    // if height is negative, means the data is stored in top-down order, we need to flip it to bottom-up order
-    if (height < 0) {
-        // new buffer to store flipped data
-        std::vector<uint8_t> flipped(dataSize);
-
-        for (int y = 0; y < absHeight; ++y) {
-
-            // pointer variables src, *src point to the beginning of each row
-            const uint8_t* src = &data[y * rowSize];
-            // absHeight - 1 - y: flip the row order
-            // EX:total 3 rows, y=0
-            // original row0 -> flipped row(absHeight - 1 - 0) = row(absHeight - 1) = row2
-            // dst point to the beginning of each row
-            uint8_t* dst = &flipped[(absHeight - 1 - y) * rowSize];
-            std::copy(src, src + rowSize, dst); 
-            // data is the original data, flipped is the new buffer to store flipped data
-            // src+rowSize: copy the whole row
-            //std::copy will copy the data from src to dst
+
+    layout.width = width;
+    layout.height = absHeight;
+    layout.topDown = height < 0;
+    layout.bitCount = info.biBitCount;
+    layout.compression = info.biCompression;
+
+    // reading past the end of a mapping is a crash (SIGBUS), not a short read like fread
+    if (header.bfOffBits > file.size()) {
+        throw std::runtime_error("Truncated BMP pixel data: " + std::string(filename));
+    }
+    // BfOffBits is the offset to the pixel data (First byte of pixel data)
+    layout.pixels = file.data() + header.bfOffBits;
+    layout.pixelBytes = file.size() - header.bfOffBits;
+    if (info.biCompression != kCompressionRLE8 &&
+        layout.pixelBytes < static_cast<size_t>(rowSizeBytes(width, info.biBitCount)) * absHeight) {
+        throw std::runtime_error("Truncated BMP pixel data: " + std::string(filename));
+    }
+
+    // the palette follows the info header, 4 bytes (B, G, R, 0) per color
+    std::fill(layout.palette, layout.palette + 256, 0u);
+    if (palettized) {
+        const size_t offset = sizeof(header) + info.biSize;
+        size_t colors = info.biClrUsed ? info.biClrUsed : (1u << info.biBitCount);
+        colors = std::min<size_t>(colors, 1u << info.biBitCount);
+        if (offset > file.size() || (file.size() - offset) / 4 < colors) {
+            throw std::runtime_error("Truncated BMP palette: " + std::string(filename));
+        }
+        for (size_t i = 0; i < colors; ++i) {
+            const uint8_t* entry = file.data() + offset + 4 * i;
+            layout.palette[i] = entry[0] | (entry[1] << 8) | (static_cast<uint32_t>(entry[2]) << 16);
+        }
+    }
+
+    // the red, green and blue masks come right after the 40-byte header, as part of
+    // a V2+ header or as an extra 12 bytes of a plain BITMAPINFOHEADER
+    layout.masks[0] = 0x00FF0000u;
+    layout.masks[1] = 0x0000FF00u;
+    layout.masks[2] = 0x000000FFu;
+    if (info.biCompression == kCompressionBitfields) {
+        const size_t offset = sizeof(header) + sizeof(info);
+        if (file.size() < offset + 12) {
+            throw std::runtime_error("Truncated BMP header: " + std::string(filename));
+        }
+        std::memcpy(layout.masks, file.data() + offset, 12);
+    }
+}
+
+// Zero-copy view of 24-bit BI_RGB pixels
+static BMPImageView viewOfLayout(const Layout& layout) {
+    const int rowSize = rowSizeBytes(layout.width);
+    BMPImageView view;
+    view.width = layout.width;
+    view.height = layout.height;
+    if (layout.topDown) {
+        // top-down: row 0 (bottom) is the last row in the file, walk backwards
+        view.origin = layout.pixels + static_cast<size_t>(layout.height - 1) * rowSize;
+        view.stride = -static_cast<std::ptrdiff_t>(rowSize);
+    } else {
+        view.origin = layout.pixels;
+        view.stride = rowSize;
+    }
+    return view;
+}
+
+// BGR of a 0xRRGGBB color
+static inline void putColor(uint8_t* px, uint32_t color) {
+    px[0] = static_cast<uint8_t>(color);
+    px[1] = static_cast<uint8_t>(color >> 8);
+    px[2] = static_cast<uint8_t>(color >> 16);
+}
+
+// RLE8: (count, index) pairs, or 0 followed by 0 = end of row, 1 = end of image,
+// 2 = skip (dx, dy), n >= 3 = n literal indices padded to an even length;
+// pixels the stream skips get palette color 0
+static void decodeRLE8(const Layout& layout, BMPImage& out, const char* filename) {
+    const int rowSize = rowSizeBytes(layout.width);
+    for (int y = 0; y < layout.height; ++y) {
+        uint8_t* px = &out.data[static_cast<size_t>(y) * rowSize];
+        for (int x = 0; x < layout.width; ++x, px += 3) putColor(px, layout.palette[0]);
+    }
+
+    const uint8_t* p = layout.pixels;
+    const uint8_t* const end = p + layout.pixelBytes;
+    int x = 0, y = 0; // RLE rows are always bottom-up, like BMPImage
+    auto put = [&](int index) {
+        if (x < layout.width && y < layout.height)
+            putColor(&out.data[static_cast<size_t>(y) * rowSize + x * 3], layout.palette[index]);
+        ++x;
+    };
+    while (end - p >= 2 && y < layout.height) {
+        const int count = p[0], value = p[1];
+        p += 2;
+        if (count > 0) {
+            for (int i = 0; i < count; ++i) put(value);
+        } else if (value == 0) {
+            x = 0;
+            ++y;
+        } else if (value == 1) {
+            break;
+        } else if (value == 2) {
+            if (end - p < 2) throw std::runtime_error("Truncated BMP pixel data: " + std::string(filename));
+            x += p[0];
+            y += p[1];
+            p += 2;
+        } else {
+            if (end - p < value) throw std::runtime_error("Truncated BMP pixel data: " + std::string(filename));
+            for (int i = 0; i < value; ++i) put(p[i]);
+            p += value;
+            if ((value & 1) && p < end) ++p; // runs are padded to 16 bits
         }
-        data.swap(flipped); // tmp = data; data = flipped; flipped = tmp;
-        height = absHeight; // Convert to positive value
     }
+}
+
+// Convert any supported layout to 24-bit bottom-up BGR; out keeps its buffer when it is large enough
+static void decode(const Layout& layout, BMPImage& out, const char* filename) {
+    if (layout.isPlain24()) {
+        viewOfLayout(layout).materialize(out);
+        return;
+    }
+
+    const int rowSize = rowSizeBytes(layout.width);
+    out.width = layout.width;
+    out.height = layout.height;
+    out.data.resize(static_cast<size_t>(rowSize) * layout.height);
+
+    if (layout.compression == kCompressionRLE8) {
+        decodeRLE8(layout, out, filename);
+        return;
+    }
+
+    const int srcRowSize = rowSizeBytes(layout.width, layout.bitCount);
+    const ChannelMask red(layout.masks[0]), green(layout.masks[1]), blue(layout.masks[2]);
+    for (int y = 0; y < layout.height; ++y) {
+        const int fileRow = layout.topDown ? layout.height - 1 - y : y;
+        const uint8_t* src = layout.pixels + static_cast<size_t>(fileRow) * srcRowSize;
+        uint8_t* px = &out.data[static_cast<size_t>(y) * rowSize];
 
+        if (layout.bitCount == 32) {
+            for (int x = 0; x < layout.width; ++x, src += 4, px += 3) {
+                const uint32_t v = src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+                px[0] = blue(v);
+                px[1] = green(v);
+                px[2] = red(v);
+            }
+        } else {
+            // 1, 4 or 8 bits per index, the leftmost pixel in the most significant bits
+            const int bits = layout.bitCount;
+            const int perByte = 8 / bits;
+            const unsigned indexMask = (1u << bits) - 1;
+            for (int x = 0; x < layout.width; ++x, px += 3) {
+                const int shift = 8 - bits * (x % perByte + 1);
+                putColor(px, layout.palette[(src[x / perByte] >> shift) & indexMask]);
+            }
+        }
+    }
+}
+
+BMPImageView mapBMP(const char* filename) {
+    TRACE_SPAN("bmp: map");
+    std::shared_ptr<const MappedFile> file = std::make_shared<MappedFile>(filename);
+    Layout layout;
+    parseLayout(*file, filename, layout);
+    if (!layout.isPlain24()) {
+        // nothing to view in place, the view owns a decoded copy instead of the mapping
+        std::shared_ptr<BMPImage> image = std::make_shared<BMPImage>();
+        decode(layout, *image, filename);
+        BMPImageView view = viewOf(*image);
+        view.decoded = std::move(image);
+        return view;
+    }
+    BMPImageView view = viewOfLayout(layout);
+    view.mapping = std::move(file);
+    return view;
+}
+
+BMPImage BMPImageView::materialize() const {
     BMPImage out;
+    materialize(out);
+    return out;
+}
+
+void BMPImageView::materialize(BMPImage& out) const {
+    TRACE_SPAN("bmp: materialize");
+    const int rowSize = rowSizeBytes(width);
     out.width = width;
     out.height = height;
-    out.data = std::move(data); // std::move(data)(move to the new BMPImage object)
 
+    if (stride == rowSize) {
+        // bottom-up and tightly packed: the whole pixel array is one block
+        out.data.assign(origin, origin + static_cast<size_t>(rowSize) * height);
+        return;
+    }
+
+    // top-down (negative stride): copy row by row straight into bottom-up order
+    out.data.resize(static_cast<size_t>(rowSize) * height);
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* src = row(y);
+        std::copy(src, src + rowSize, &out.data[static_cast<size_t>(y) * rowSize]);
+    }
+}
+
+BMPImage readBMP(const char* filename) {
+    TRACE_SPAN("bmp: read");
+    // the only copy is the one that gives the caller ownership (or the decoding)
+    const MappedFile file(filename);
+    Layout layout;
+    parseLayout(file, filename, layout);
+    BMPImage out;
+    decode(layout, out, filename);
     return out;
 }
 
+void readBMP(const char* filename, BMPImage& out, BufferPool& pool) {
+    TRACE_SPAN("bmp: read");
+    // the mapping only lives for this call, so it stays on the stack
+    const MappedFile file(filename);
+    Layout layout;
+    parseLayout(file, filename, layout);
+    const size_t bytes = static_cast<size_t>(rowSizeBytes(layout.width)) * layout.height;
+    if (out.data.capacity() < bytes) {
+        pool.release(out);
+        out.data = pool.acquire(bytes);
+    }
+    decode(layout, out, filename);
+}
+
+// Smallest k with 2^k >= bytes
+static int ceilClass(size_t bytes) {
+    int k = 0;
+    while (k + 1 < 8 * static_cast<int>(sizeof(size_t)) && (static_cast<size_t>(1) << k) < bytes) ++k;
+    return k;
+}
+
+// Largest k with 2^k <= capacity (capacity > 0)
+static int floorClass(size_t capacity) {
+    int k = 0;
+    while (capacity >>= 1) ++k;
+    return k;
+}
+
+std::vector<uint8_t> BufferPool::acquire(size_t bytes) {
+    if (bytes == 0) return std::vector<uint8_t>(); // nothing to reuse, nothing to allocate
+    const int k = ceilClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_[k].empty()) {
+            std::vector<uint8_t> buffer = std::move(free_[k].back());
+            free_[k].pop_back();
+            return buffer;
+        }
+        ++misses_;
+    }
+    // allocate outside the lock, a large buffer takes a while to map
+    std::vector<uint8_t> buffer;
+    buffer.reserve(static_cast<size_t>(1) << k);
+    return buffer;
+}
+
+void BufferPool::release(std::vector<uint8_t>& buffer) {
+    if (buffer.capacity() == 0) return;
+    buffer.clear();
+    const int k = floorClass(buffer.capacity());
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_[k].push_back(std::move(buffer));
+    buffer = std::vector<uint8_t>(); // a moved-from vector is only "valid but unspecified"
+}
+
+size_t BufferPool::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
 void writeBMP(const char* filename, const BMPImage &img) {
-    const int rowSize = rowSizeBytes(img.width);
-    const int expectedSize = rowSize * img.height;
-    
+    writeBMP(filename, viewOf(img));
+}
+
+// Write the headers of a bottom-up BMP: 54 bytes, then the palette (0xRRGGBB entries) if any
+static void writeHeader(FILE* output_file, int width, int height, int bitCount,
+                        const uint32_t* palette = nullptr, int colors = 0) {
+    const int rowSize = rowSizeBytes(width, bitCount);
+    const uint64_t expectedSize = static_cast<uint64_t>(rowSize) * height;
+    // bfSize/biSizeImage are 32-bit, images over 4 GB store 0 (allowed for uncompressed BMP)
+    const uint32_t sizeField = expectedSize + 54 + 4 * colors <= 0xFFFFFFFFu ? static_cast<uint32_t>(expectedSize) : 0;
+
     BMPHeader header{};
     BMPInfoHeader info{};
 
     header.bfType = 0x4D42; //BMP 'BM' Ascii 'B' = 0x42, 'M' = 0x4D
-    header.bfOffBits = sizeof(BMPHeader) + sizeof(BMPInfoHeader);//14+40=54
-    header.bfSize = header.bfOffBits + expectedSize;
+    header.bfOffBits = sizeof(BMPHeader) + sizeof(BMPInfoHeader) + 4 * colors;//14+40=54, + palette
+    header.bfSize = sizeField ? header.bfOffBits + sizeField : 0;
     header.bfReserved1 = 0;
     header.bfReserved2 = 0;
 
     info.biSize = sizeof(BMPInfoHeader);
-    info.biWidth = img.width;
-    info.biHeight = img.height; 
+    info.biWidth = width;
+    info.biHeight = height; 
     info.biPlanes = 1;
-    info.biBitCount = 24; // 24 bits per pixel (3 bytes: BGR)
-    info.biCompression = 0;
-    info.biSizeImage = expectedSize;
+    info.biBitCount = static_cast<uint16_t>(bitCount); // 24 = 3 bytes: BGR
+    info.biCompression = kCompressionRGB;
+    info.biSizeImage = sizeField;
     info.biXPelsPerMeter = 2835;
     info.biYPelsPerMeter = 2835;
-    info.biClrUsed = 0;
+    info.biClrUsed = colors;
     info.biClrImportant = 0;
 
-    // std::ofstream file(filename, std::ios::binary);
-    // if (!file)
-    //     throw std::runtime_error("Cannot open for write: " + filename);
+    fwrite(&header, sizeof(header), 1, output_file);
+    fwrite(&info, sizeof(info), 1, output_file);
+    for (int i = 0; i < colors; ++i) {
+        const uint8_t entry[4] = {static_cast<uint8_t>(palette[i]), static_cast<uint8_t>(palette[i] >> 8),
+                                  static_cast<uint8_t>(palette[i] >> 16), 0};
+        fwrite(entry, 1, 4, output_file);
+    }
+}
+
+void writeBMP(const char* filename, const BMPImageView& img) {
+    TRACE_SPAN("bmp: write");
+    const int rowSize = rowSizeBytes(img.width);
+    const size_t expectedSize = static_cast<size_t>(rowSize) * img.height;
 
-    // file.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    // file.write(reinterpret_cast<const char*>(&info), sizeof(info));
-    // file.write(reinterpret_cast<const char*>(img.data.data()), expectedSize);
+    FILE* output_file = fopen(filename, "wb");
+    if (!output_file) {
+        throw std::runtime_error("Cannot open for write: " + std::string(filename));
+    }
 
-    // if (!file)
-    //     throw std::runtime_error("Failed to write BMP file: " + filename);
+    writeHeader(output_file, img.width, img.height, 24);
+    if (img.stride == rowSize) {
+        // contiguous bottom-up rows, one write
+        fwrite(img.origin, 1, expectedSize, output_file);
+    } else {
+        // always written bottom-up, so a top-down view is un-flipped here
+        for (int y = 0; y < img.height; ++y) {
+            fwrite(img.row(y), 1, rowSize, output_file);
+        }
+    }
+    fclose(output_file);
+}
+
+namespace {
+
+const uint32_t kNoColor = 0xFFFFFFFFu; // not a 0xRRGGBB value
+
+inline uint32_t colorAt(const uint8_t* px) {
+    return px[0] | (px[1] << 8) | (static_cast<uint32_t>(px[2]) << 16); // 0xRRGGBB
+}
+
+// Up to 256 colors -> palette index, open addressing in a fixed table (no allocation)
+class ColorTable {
+public:
+    ColorTable() {
+        for (int i = 0; i < kSlots; ++i) keys_[i] = kNoColor; // kNoColor marks an empty slot
+    }
+
+    // Index of color, added as the next index if it is new; -1 when maxColors are taken
+    int insert(uint32_t color, int maxColors) {
+        int slot = home(color);
+        while (keys_[slot] != kNoColor && keys_[slot] != color) slot = (slot + 1) & (kSlots - 1);
+        if (keys_[slot] == kNoColor) {
+            if (size_ == maxColors) return -1;
+            keys_[slot] = color;
+            index_[slot] = static_cast<uint8_t>(size_++);
+        }
+        return index_[slot];
+    }
+
+    // Index of a color that is in the table
+    int find(uint32_t color) const {
+        int slot = home(color);
+        while (keys_[slot] != color) slot = (slot + 1) & (kSlots - 1);
+        return index_[slot];
+    }
+
+private:
+    static const int kSlots = 512; // at most half full
+
+    static int home(uint32_t color) { return static_cast<int>((color * 2654435761u) >> 23); }
+
+    uint32_t keys_[kSlots];
+    uint8_t index_[kSlots];
+    int size_ = 0;
+};
+
+// The distinct colors of img in ascending order, -1 when there are more than maxColors
+int collectPalette(const BMPImageView& img, int maxColors, uint32_t* palette) {
+    TRACE_SPAN("bmp: palette");
+    ColorTable table;
+    int colors = 0;
+    for (int y = 0; y < img.height; ++y) {
+        const uint8_t* px = img.row(y);
+        uint32_t last = kNoColor;
+        for (int x = 0; x < img.width; ++x, px += 3) {
+            const uint32_t color = colorAt(px);
+            if (color == last) continue; // masks are long runs of one color
+            last = color;
+            const int index = table.insert(color, maxColors);
+            if (index < 0) return -1;
+            if (index == colors) palette[colors++] = color;
+        }
+    }
+    std::sort(palette, palette + colors);
+    return colors;
+}
+
+// Bytes to a FILE through a small buffer
+class ByteWriter {
+public:
+    explicit ByteWriter(FILE* file) : file_(file) {}
+    ~ByteWriter() { flush(); }
+
+    void put(uint8_t b) {
+        buffer_[size_++] = b;
+        if (size_ == sizeof(buffer_)) flush();
+    }
+    void flush() {
+        fwrite(buffer_, 1, size_, file_);
+        size_ = 0;
+    }
+
+private:
+    FILE* file_;
+    uint8_t buffer_[16384];
+    size_t size_ = 0;
+};
+
+} // namespace
+
+int compactBitCount(const BMPImageView& img) {
+    uint32_t palette[256];
+    const int colors = collectPalette(img, 256, palette);
+    return colors < 0 ? 24 : colors <= 2 ? 1 : 8;
+}
+
+void writeBMP(const char* filename, const BMPImageView& img, int bitCount) {
+    uint32_t palette[256];
+    int colors = 0;
+    if (bitCount == 0) {
+        colors = collectPalette(img, 256, palette);
+        bitCount = colors < 0 ? 24 : colors <= 2 ? 1 : 8;
+    } else if (bitCount == 1 || bitCount == 8) {
+        colors = collectPalette(img, 1 << bitCount, palette);
+        if (colors < 0) {
+            throw std::invalid_argument("writeBMP: more than " + std::to_string(1 << bitCount) +
+                                        " colors for a " + std::to_string(bitCount) + "-bit BMP");
+        }
+    } else if (bitCount != 24 && bitCount != 32) {
+        throw std::invalid_argument("writeBMP: bitCount must be 0, 1, 8, 24 or 32");
+    }
+    if (bitCount == 24) {
+        writeBMP(filename, img);
+        return;
+    }
+    TRACE_SPAN("bmp: write");
+    if (bitCount == 1 && colors < 2) palette[colors++] = 0; // a 1-bit palette has both entries
 
-    // file.close();
     FILE* output_file = fopen(filename, "wb");
+    if (!output_file) {
+        throw std::runtime_error("Cannot open for write: " + std::string(filename));
+    }
+    writeHeader(output_file, img.width, img.height, bitCount, palette, bitCount == 32 ? 0 : colors);
 
-    fwrite(&header, sizeof(header), 1, output_file);
-    fwrite(&info, sizeof(info), 1, output_file);
-    fwrite(img.data.data(), 1, expectedSize, output_file);
+    {
+        ByteWriter out(output_file);
+        const int used = static_cast<int>((static_cast<long long>(img.width) * bitCount + 7) / 8);
+        const int padding = rowSizeBytes(img.width, bitCount) - used;
+        ColorTable table;
+        for (int i = 0; i < (bitCount == 32 ? 0 : colors); ++i) table.insert(palette[i], colors);
+
+        for (int y = 0; y < img.height; ++y) {
+            const uint8_t* px = img.row(y);
+            if (bitCount == 32) {
+                for (int x = 0; x < img.width; ++x, px += 3) {
+                    out.put(px[0]);
+                    out.put(px[1]);
+                    out.put(px[2]);
+                    out.put(0);
+                }
+            } else {
+                // indices packed from the most significant bit, the last byte filled up with 0
+                uint32_t last = kNoColor;
+                int index = 0;
+                unsigned byte = 0;
+                int filled = 0;
+                for (int x = 0; x < img.width; ++x, px += 3) {
+                    const uint32_t color = colorAt(px);
+                    if (color != last) {
+                        last = color;
+                        index = table.find(color);
+                    }
+                    byte = (byte << bitCount) | index;
+                    filled += bitCount;
+                    if (filled == 8) {
+                        out.put(static_cast<uint8_t>(byte));
+                        byte = 0;
+                        filled = 0;
+                    }
+                }
+                if (filled) out.put(static_cast<uint8_t>(byte << (8 - filled)));
+            }
+            for (int i = 0; i < padding; ++i) out.put(0);
+        }
+    }
     fclose(output_file);
 }
 
+StripReader::StripReader(const char* filename, size_t maxBytes) {
+    file_ = fopen(filename, "rb");
+    if (!file_) {
+        throw std::runtime_error("Cannot open file: " + std::string(filename));
+    }
+    // the destructor does not run when the constructor throws
+    auto fail = [&](const std::string& message) {
+        fclose(file_);
+        file_ = nullptr;
+        throw std::runtime_error(message + ": " + std::string(filename));
+    };
+
+    BMPHeader header{};
+    BMPInfoHeader info{};
+    if (fread(&header, sizeof(header), 1, file_) != 1 || fread(&info, sizeof(info), 1, file_) != 1 ||
+        header.bfType != 0x4D42) {
+        fail("Not a BMP file");
+    }
+    if (info.biBitCount != 24 || info.biCompression != 0) {
+        fail("Only uncompressed 24-bit BMP is supported");
+    }
+    if (!validDimensions(info.biWidth, info.biHeight)) {
+        fail("Invalid BMP dimensions");
+    }
+
+    width_ = info.biWidth;
+    height_ = std::abs(info.biHeight);
+    topDown_ = info.biHeight < 0;
+    offBits_ = header.bfOffBits;
+
+    // every row must be in the file before the first strip is streamed, as parseLayout checks
+#ifdef _WIN32
+    const long long fileSize = _fseeki64(file_, 0, SEEK_END) == 0 ? _ftelli64(file_) : -1;
+#else
+    const long long fileSize = fseeko(file_, 0, SEEK_END) == 0 ? static_cast<long long>(ftello(file_)) : -1;
+#endif
+    const size_t rowSize = rowSizeBytes(width_);
+    if (fileSize < 0 || static_cast<unsigned long long>(fileSize) < offBits_ ||
+        (static_cast<unsigned long long>(fileSize) - offBits_) / rowSize < static_cast<unsigned long long>(height_)) {
+        fail("Truncated BMP pixel data");
+    }
+
+    // as many rows as fit in the budget, but always at least one
+    rowsPerStrip_ = static_cast<int>(std::max<size_t>(1, std::min<size_t>(maxBytes / rowSize, height_)));
+}
+
+StripReader::~StripReader() {
+    if (file_) fclose(file_);
+}
+
+bool StripReader::next(Strip& strip) {
+    if (nextRow_ >= height_) return false;
+    TRACE_SPAN("bmp: read strip");
+
+    const int rowSize = rowSizeBytes(width_);
+    const int rows = std::min(rowsPerStrip_, height_ - nextRow_);
+
+    strip.width = width_;
+    strip.firstRow = nextRow_;
+    strip.rows = rows;
+    strip.data.resize(static_cast<size_t>(rowsPerStrip_) * rowSize); // no-op after the first strip
+
+    // bottom-up row r is stored at file row r, top-down row r at file row (height - 1 - r)
+    // so a top-down band is one contiguous block too, just in reverse order
+    const int fileRow = topDown_ ? height_ - nextRow_ - rows : nextRow_;
+    const long long offset = static_cast<long long>(offBits_) + static_cast<long long>(fileRow) * rowSize;
+#ifdef _WIN32
+    _fseeki64(file_, offset, SEEK_SET);
+#else
+    fseeko(file_, static_cast<off_t>(offset), SEEK_SET);
+#endif
+    if (fread(strip.data.data(), rowSize, rows, file_) != static_cast<size_t>(rows)) {
+        throw std::runtime_error("Truncated BMP pixel data");
+    }
+
+    if (topDown_) {
+        // reverse the rows of this band in place
+        for (int lo = 0, hi = rows - 1; lo < hi; ++lo, --hi) {
+            std::swap_ranges(strip.row(lo), strip.row(lo) + rowSize, strip.row(hi));
+        }
+    }
+
+    nextRow_ += rows;
+    return true;
+}
+
+StripWriter::StripWriter(const char* filename, int width, int height, int bitCount,
+                         const uint32_t* palette, int colors)
+    : width_(width), height_(height), bitCount_(bitCount) {
+    if (bitCount != 1 && bitCount != 8 && bitCount != 24 && bitCount != 32) {
+        throw std::invalid_argument("StripWriter: bitCount must be 1, 8, 24 or 32");
+    }
+    file_ = fopen(filename, "wb");
+    if (!file_) {
+        throw std::runtime_error("Cannot open for write: " + std::string(filename));
+    }
+    writeHeader(file_, width, height, bitCount, palette, bitCount <= 8 ? colors : 0);
+}
+
+StripWriter::~StripWriter() {
+    // destructors must not throw, call close() explicitly to get the row count check
+    if (file_) fclose(file_);
+}
+
+void StripWriter::write(const uint8_t* rows, int count) {
+    TRACE_SPAN("bmp: write strip");
+    if (rowsWritten_ + count > height_) {
+        throw std::runtime_error("StripWriter: more rows than the image height");
+    }
+    fwrite(rows, rowSizeBytes(width_, bitCount_), count, file_);
+    rowsWritten_ += count;
+}
+
+void StripWriter::close() {
+    if (!file_) return;
+    fclose(file_);
+    file_ = nullptr;
+    if (rowsWritten_ != height_) {
+        throw std::runtime_error("StripWriter: image closed before all rows were written");
+    }
+}
+
 } // namespace bmp
@@ -1,9 +1,13 @@
 #pragma once
 #include <cstdint> // for uint16_t, uint32_t
+#include <cstddef> // for std::ptrdiff_t, size_t
+#include <memory>  // for std::shared_ptr
+#include <mutex>   // for BufferPool
 #include <string>
 #include <vector>
 #include <stdexcept>
 #include <fstream>
+#include <cstdio>  // for FILE
 
 namespace bmp {
 
@@ -74,12 +78,31 @@ struct BMPImage {
     std::vector<uint8_t> data;      // BGR pixel data (with row padding)
 };
 
-// readBMP will be defined in bmp.cpp
+// readBMP will be defined in bmp.cpp (mapBMP + materialize)
+// Every format is converted to 24-bit BGR on reading:
+/*
+    1, 4, 8 bits   palettized (BI_RGB), 8 bits also run-length encoded (BI_RLE8)
+    24 bits        BI_RGB, the only format that mapBMP can view without a copy
+    32 bits        BI_RGB (BGRX) or BI_BITFIELDS (any channel masks), alpha is dropped
+    anything else throws std::runtime_error
+*/
 BMPImage readBMP(const char* filename);
 
-// writeBMP will be defined in bmp.cpp
+class BufferPool;
+
+// Read into out, whose buffer is reused when it is large enough and otherwise swapped
+// for one of pool (the old one goes back to the pool); no shared mapping is created,
+// so reading image after image this way does not touch the heap in the steady state
+void readBMP(const char* filename, BMPImage& out, BufferPool& pool);
+
+// writeBMP will be defined in bmp.cpp (always 24-bit, see the overload with bitCount)
 void writeBMP(const char* filename, const BMPImage& img);
 
+// Bytes per stored row at bitCount bits per pixel, padded to 4 bytes
+inline int rowSizeBytes(int width, int bitCount) {
+    return static_cast<int>((static_cast<long long>(width) * bitCount + 31) / 32 * 4);
+}
+
 inline int rowSizeBytes(int width) {
     int rowSize = width * 3;
     int padding = (4 - (rowSize % 4)) % 4; 
@@ -91,4 +114,201 @@ inline int rowSizeBytes(int width) {
     (4 - (rowSize % 4)) % 4 => if rowSize is already multiple of 4, then padding should be 0, not 4
 */
 
+// Read-only mapping of a whole file (mmap on POSIX, MapViewOfFile on Windows)
+// The pages are only touched when the pixels are actually read, and the mapping
+// is released when the last BMPImageView that references it goes away
+class MappedFile {
+public:
+    explicit MappedFile(const char* filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;    // HANDLE from CreateFile
+    void* mapping_ = nullptr; // HANDLE from CreateFileMapping
+#endif
+};
+
+// Zero-copy view of 24-bit pixel rows
+// Rows are addressed bottom-up like BMPImage::data (row 0 is the bottom row),
+// top-down files are expressed with a negative stride instead of flipping them
+/*
+    bottom-up file:           top-down file:
+    origin -> row0 (offset 0)     row2 (offset 0)
+              row1                row1
+              row2                origin -> row0 (offset 2 * rowSize)
+    stride = +rowSize         stride = -rowSize
+*/
+struct BMPImageView {
+    int width = 0;
+    int height = 0;
+    const uint8_t* origin = nullptr; // first byte of row 0
+    std::ptrdiff_t stride = 0;       // bytes from row r to row r+1 (may be negative)
+    std::shared_ptr<const MappedFile> mapping; // keeps the file mapped, empty for views of a BMPImage
+    std::shared_ptr<const BMPImage> decoded;   // owns the pixels of a file that was not 24-bit
+
+    const uint8_t* row(int r) const { return origin + r * stride; }
+
+    // Copy the rows into an owned, bottom-up BMPImage (one copy, no extra flip buffer)
+    BMPImage materialize() const;
+    // The same into out, which keeps its buffer when the capacity is large enough
+    void materialize(BMPImage& out) const;
+};
+
+// mapBMP will be defined in bmp.cpp, only parses the headers and maps the file
+// (files that are not 24-bit are decoded right away, the view then owns the 24-bit copy)
+BMPImageView mapBMP(const char* filename);
+
+// Non-owning view of an image that is already in memory
+inline BMPImageView viewOf(const BMPImage& img) {
+    BMPImageView view;
+    view.width = img.width;
+    view.height = img.height;
+    view.origin = img.data.data();
+    view.stride = rowSizeBytes(img.width);
+    return view;
+}
+
+// writeBMP from any view (e.g. write a mapped file back without materializing it)
+void writeBMP(const char* filename, const BMPImageView& view);
+
+// writeBMP with bitCount bits per pixel
+/*
+    1, 8   palettized, the palette holds the colors of the image in ascending 0xRRGGBB order
+           (black before white); throws std::invalid_argument when there are more than 2 / 256
+    24     BGR, the same as writeBMP without bitCount
+    32     BGRX (BI_RGB, the fourth byte is 0)
+    0      the smallest of 1, 8 and 24 that keeps every pixel: masks become 1-bit (1/24 of the
+           size), masks with a few colored drawings 8-bit; the scan for the colors stops at the
+           257th color, so photos cost little extra
+*/
+void writeBMP(const char* filename, const BMPImageView& view, int bitCount);
+
+inline void writeBMP(const char* filename, const BMPImage& img, int bitCount) {
+    writeBMP(filename, viewOf(img), bitCount);
+}
+
+// Bits per pixel that writeBMP(..., 0) would choose for img: 1, 8 or 24
+int compactBitCount(const BMPImageView& img);
+
+// Size-classed free lists of pixel buffers, for images that are made and dropped
+// over and over (batch mode)
+/*
+    class k holds buffers with a capacity of at least 2^k bytes. acquire(bytes) takes a
+    buffer of the class of bytes rounded up to a power of two and only allocates when
+    that class is empty; release() files a buffer under the class of its capacity, so
+    buffers that grew elsewhere come back too. A buffer is at most twice the size asked
+    for. Thread-safe: the reader, the workers and the writer of a batch share one pool.
+*/
+class BufferPool {
+public:
+    BufferPool() {}
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Empty buffer (size 0) with a capacity of at least bytes
+    std::vector<uint8_t> acquire(size_t bytes);
+
+    // Hand a buffer back, buffer / img are left empty
+    void release(std::vector<uint8_t>& buffer);
+    void release(BMPImage& img) { release(img.data); }
+
+    // Number of acquire() calls that had to allocate
+    size_t misses() const;
+
+private:
+    static const int kClasses = 8 * sizeof(size_t);
+
+    mutable std::mutex mutex_;
+    std::vector<std::vector<uint8_t>> free_[kClasses]; // free_[k]: capacity >= 2^k
+    size_t misses_ = 0;
+};
+
+// A band of consecutive rows, stored bottom-up with row padding like BMPImage::data
+struct Strip {
+    int width = 0;
+    int firstRow = 0;               // index of the strip's row 0 in the whole image
+    int rows = 0;                   // number of valid rows (the last strip can be shorter)
+    std::vector<uint8_t> data;      // BGR pixel data (with row padding)
+
+    uint8_t* row(int r) { return &data[static_cast<size_t>(r) * rowSizeBytes(width)]; }
+    const uint8_t* row(int r) const { return &data[static_cast<size_t>(r) * rowSizeBytes(width)]; }
+};
+
+// Reads a 24-bit BMP as a sequence of strips (bottom row first) so that
+// only maxBytes of pixel data are resident at a time
+/*
+    Usage:
+    bmp::StripReader reader("big.bmp");
+    bmp::Strip strip;
+    while (reader.next(strip)) {
+        ... strip.row(0) is image row strip.firstRow ...
+    }
+*/
+class StripReader {
+public:
+    explicit StripReader(const char* filename, size_t maxBytes = 8u << 20);
+    ~StripReader();
+
+    StripReader(const StripReader&) = delete;
+    StripReader& operator=(const StripReader&) = delete;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int rowsPerStrip() const { return rowsPerStrip_; }
+
+    // Fill strip with the next band, return false when all rows have been read
+    // (the strip's buffer is reused, so no allocation after the first call)
+    bool next(Strip& strip);
+
+private:
+    FILE* file_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    bool topDown_ = false;
+    uint32_t offBits_ = 0;
+    int rowsPerStrip_ = 1;
+    int nextRow_ = 0;
+};
+
+// Writes a BMP strip by strip (bottom row first); the header is
+// written up front, so the whole image never has to exist in memory
+// (24-bit by default; for 1 or 8 bits pass the palette, 0xRRGGBB entries,
+// and write rows that are already packed: rowSizeBytes(width, bitCount) each)
+class StripWriter {
+public:
+    StripWriter(const char* filename, int width, int height, int bitCount = 24,
+                const uint32_t* palette = nullptr, int colors = 0);
+    ~StripWriter();
+
+    StripWriter(const StripWriter&) = delete;
+    StripWriter& operator=(const StripWriter&) = delete;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int rowsWritten() const { return rowsWritten_; }
+
+    // Append count padded rows (rowSizeBytes(width, bitCount) each) starting at rows
+    void write(const uint8_t* rows, int count);
+    void write(const Strip& strip) { write(strip.data.data(), strip.rows); } // 24-bit only
+
+    // Flush and close, throws if fewer than height rows were written
+    void close();
+
+private:
+    FILE* file_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    int bitCount_ = 24;
+    int rowsWritten_ = 0;
+};
+
 } // namespace bmp
@@ -0,0 +1,185 @@
+#include "color.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <algorithm> // for std::min, std::max
+#include <cmath> // for std::lround
+#include <stdexcept>
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+namespace imgproc {
+
+namespace {
+
+#if ACV_X86
+
+// pshufb controls that gather channel ch of 16 pixels (48 bytes in 3 vectors) from vector v
+struct SplitMasks {
+    alignas(16) int8_t bytes[3][3][16]; // [ch][v][lane]
+    SplitMasks() {
+        for (int ch = 0; ch < 3; ++ch) {
+            for (int v = 0; v < 3; ++v) {
+                for (int i = 0; i < 16; ++i) {
+                    const int src = 3 * i + ch;
+                    bytes[ch][v][i] = src / 16 == v ? static_cast<int8_t>(src % 16) : static_cast<int8_t>(-128);
+                }
+            }
+        }
+    }
+};
+
+// One channel of 16 pixels as bytes
+ACV_TARGET("ssse3")
+inline __m128i gatherChannel(__m128i v0, __m128i v1, __m128i v2, const int8_t (*mask)[16]) {
+    const __m128i* m = reinterpret_cast<const __m128i*>(mask);
+    return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, _mm_load_si128(m)),
+                                     _mm_shuffle_epi8(v1, _mm_load_si128(m + 1))),
+                        _mm_shuffle_epi8(v2, _mm_load_si128(m + 2)));
+}
+
+// (wB * B + wG * G + wR * R + rounding) >> kShift of 8 pixels (16-bit lanes), saturated to 16 bits:
+// (B, G) and (R, 1) pairs through the signed 16-bit multiply-add, 32-bit sums
+ACV_TARGET("ssse3")
+inline __m128i weightedSum(__m128i b, __m128i g, __m128i r, __m128i one, __m128i weightsBG, __m128i weightsR1) {
+    const __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b, g), weightsBG),
+                                     _mm_madd_epi16(_mm_unpacklo_epi16(r, one), weightsR1));
+    const __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b, g), weightsBG),
+                                     _mm_madd_epi16(_mm_unpackhi_epi16(r, one), weightsR1));
+    return _mm_packs_epi32(_mm_srai_epi32(lo, Grayscale::kShift), _mm_srai_epi32(hi, Grayscale::kShift));
+}
+
+// 16 pixels per step, returns the first column not converted; the mask bits of an unfinished
+// word are left in word
+ACV_TARGET("ssse3")
+int grayRowSSSE3(const uint8_t* px, int width, const Grayscale& gray, int threshold, uint64_t* bits,
+                 uint8_t* intensity, uint64_t& word) {
+    static const SplitMasks split;
+    const bool average = gray.kind == Grayscale::Average;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i third = _mm_set1_epi16(static_cast<short>(0xAAAB));
+    const __m128i weightsBG = _mm_set1_epi32(static_cast<int>((static_cast<uint32_t>(gray.weights[1]) << 16) |
+                                                              (static_cast<uint32_t>(gray.weights[0]) & 0xFFFFu)));
+    const __m128i weightsR1 = _mm_set1_epi32(static_cast<int>((uint32_t(1) << (Grayscale::kShift - 1) << 16) |
+                                                              (static_cast<uint32_t>(gray.weights[2]) & 0xFFFFu)));
+    // intensities are 0..255: any threshold outside [-1, 255] gives the same mask as its end
+    const __m128i limit = _mm_set1_epi16(static_cast<short>(std::min(std::max(threshold, -1), 255)));
+
+    int c = 0;
+    for (; c + 16 <= width; c += 16) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(px + c * 3);
+        const __m128i v0 = _mm_loadu_si128(p);
+        const __m128i v1 = _mm_loadu_si128(p + 1);
+        const __m128i v2 = _mm_loadu_si128(p + 2);
+        const __m128i b = gatherChannel(v0, v1, v2, split.bytes[0]);
+        const __m128i g = gatherChannel(v0, v1, v2, split.bytes[1]);
+        const __m128i r = gatherChannel(v0, v1, v2, split.bytes[2]);
+        const __m128i bLo = _mm_unpacklo_epi8(b, zero), bHi = _mm_unpackhi_epi8(b, zero);
+        const __m128i gLo = _mm_unpacklo_epi8(g, zero), gHi = _mm_unpackhi_epi8(g, zero);
+        const __m128i rLo = _mm_unpacklo_epi8(r, zero), rHi = _mm_unpackhi_epi8(r, zero);
+
+        __m128i lo, hi; // intensities of pixels 0-7 and 8-15, 16 bits each
+        if (average) {
+            // B + G + R <= 765 in 16 bits, then (s * 0xAAAB) >> 17 as mulhi + shift
+            lo = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(bLo, gLo), rLo), third), 1);
+            hi = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(bHi, gHi), rHi), third), 1);
+        } else {
+            lo = _mm_min_epi16(_mm_max_epi16(weightedSum(bLo, gLo, rLo, one, weightsBG, weightsR1), zero), max);
+            hi = _mm_min_epi16(_mm_max_epi16(weightedSum(bHi, gHi, rHi, one, weightsBG, weightsR1), zero), max);
+        }
+
+        if (intensity) _mm_storeu_si128(reinterpret_cast<__m128i*>(intensity + c), _mm_packus_epi16(lo, hi));
+        const __m128i white = _mm_packs_epi16(_mm_cmpgt_epi16(lo, limit), _mm_cmpgt_epi16(hi, limit));
+        word |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(white))) << (c & 63);
+        if ((c & 63) == 48) {
+            if (bits) bits[c >> 6] = word;
+            word = 0;
+        }
+    }
+    return c;
+}
+
+#endif
+
+} // namespace
+
+Grayscale Grayscale::bt601() {
+    Grayscale gray;
+    gray.kind = Weighted;
+    gray.weights[0] = 1868; // 0.114
+    gray.weights[1] = 9617; // 0.587
+    gray.weights[2] = 4899; // 0.299
+    return gray;
+}
+
+Grayscale Grayscale::weighted(double b, double g, double r) {
+    const double w[3] = {b, g, r};
+    Grayscale gray;
+    gray.kind = Weighted;
+    for (int i = 0; i < 3; ++i) {
+        if (!(w[i] >= -2.0 && w[i] < 2.0)) {
+            throw std::invalid_argument("Grayscale: weights must be in [-2, 2)");
+        }
+        // the multiply-add takes signed 16-bit weights
+        gray.weights[i] = std::min(32767, static_cast<int>(std::lround(w[i] * (1 << kShift))));
+    }
+    return gray;
+}
+
+void grayRow(const uint8_t* px, int width, const Grayscale& gray, int threshold, uint64_t* bits,
+             uint8_t* intensity) {
+    int c = 0;
+    uint64_t word = 0;
+#if ACV_X86
+    if (cpu::hasSSSE3()) c = grayRowSSSE3(px, width, gray, threshold, bits, intensity, word);
+#endif
+    for (px += c * 3; c < width; ++c, px += 3) {
+        const int v = gray(px[0], px[1], px[2]);
+        if (intensity) intensity[c] = static_cast<uint8_t>(v);
+        word |= static_cast<uint64_t>(v > threshold) << (c & 63);
+        if ((c & 63) == 63) {
+            if (bits) bits[c >> 6] = word;
+            word = 0;
+        }
+    }
+    if (bits && (width & 63)) bits[width >> 6] = word; // the bits past the width stay 0
+}
+
+void toGray(const bmp::BMPImageView& img, const Grayscale& gray, GrayImage& out) {
+    TRACE_SPAN("imgproc: gray");
+    out.width = img.width;
+    out.height = img.height;
+    out.data.resize(static_cast<size_t>(img.width) * img.height);
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) grayRow(img.row(r), img.width, gray, 0, nullptr, out.row(r));
+    });
+}
+
+void binarizeToMask(const bmp::BMPImageView& img, const Grayscale& gray, int threshold, BinaryMask& out) {
+    TRACE_SPAN("imgproc: binarize gray");
+    // every word of every row is overwritten below, no need to clear a reused mask
+    if (out.width() != img.width || out.height() != img.height) out = BinaryMask(img.width, img.height);
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) grayRow(img.row(r), img.width, gray, threshold, out.row(r), nullptr);
+    });
+}
+
+void binarizeToMask(const bmp::BMPImageView& img, const Grayscale& gray, int threshold, BinaryMask& out,
+                    GrayImage& intensity) {
+    TRACE_SPAN("imgproc: binarize + gray");
+    if (out.width() != img.width || out.height() != img.height) out = BinaryMask(img.width, img.height);
+    intensity.width = img.width;
+    intensity.height = img.height;
+    intensity.data.resize(static_cast<size_t>(img.width) * img.height);
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) {
+            grayRow(img.row(r), img.width, gray, threshold, out.row(r), intensity.row(r));
+        }
+    });
+}
+
+} // namespace imgproc
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImageView
+#include "binary_mask.hpp" // imgproc::BinaryMask
+
+/********************************************************
+* Filename    : color.hpp
+* Note        : BGR -> intensity (average, BT.601 luma or any weighted sum) in
+*               16-bit fixed point, alone or fused with a threshold into a mask
+*********************************************************/
+
+namespace imgproc {
+
+// How the three channels of a pixel become one 8-bit intensity
+/*
+    Average    (B + G + R) / 3 rounded down, the intensity of the HW2 tasks; the divide is
+               (s * 0xAAAB) >> 17, exact for every s <= 765
+    Weighted   (wB * B + wG * G + wR * R + 8192) >> 14, clamped to [0, 255]: the weights
+               are fixed point with 14 fraction bits (16384 = 1.0), so every product and the
+               rounding term fit the 16-bit multiply-add of the SIMD kernels
+*/
+struct Grayscale {
+    enum Kind { Average, Weighted };
+
+    static const int kShift = 14;
+
+    Kind kind = Average;
+    int weights[3] = {0, 0, 0}; // B, G, R in units of 1 / 2^kShift, Weighted only
+
+    static Grayscale average() { return Grayscale(); }
+    // 0.114 B + 0.587 G + 0.299 R with the fixed-point weights of cv::cvtColor(COLOR_BGR2GRAY),
+    // so the result is the same as OpenCV's
+    static Grayscale bt601();
+    // Any weights in [-2, 2) (throws std::invalid_argument otherwise), rounded to 1 / 16384
+    static Grayscale weighted(double b, double g, double r);
+
+    int operator()(int b, int g, int r) const {
+        if (kind == Average) return static_cast<int>((static_cast<unsigned>(b + g + r) * 0xAAABu) >> 17);
+        const int v = (weights[0] * b + weights[1] * g + weights[2] * r + (1 << (kShift - 1))) >> kShift;
+        return v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+};
+
+// 8-bit single channel image, rows bottom-up like BMPImage::data, no row padding
+struct GrayImage {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> data;
+
+    uint8_t* row(int r) { return &data[static_cast<size_t>(r) * width]; }
+    const uint8_t* row(int r) const { return &data[static_cast<size_t>(r) * width]; }
+};
+
+// One row of width BGR pixels: the intensity of every pixel into intensity and / or
+// intensity > threshold into the mask row bits (either may be null)
+/*
+    16 pixels per step with SSSE3 (when the CPU has it): byte shuffles split B, G and R,
+    the intensities come out of 16-bit multiplies (mulhi for the average, multiply-add
+    pairs for the weights), one compare and a movemask give 16 mask bits, so the pixels
+    are read once for both outputs. The last width % 16 pixels go one at a time
+*/
+void grayRow(const uint8_t* px, int width, const Grayscale& gray, int threshold, uint64_t* bits,
+             uint8_t* intensity);
+
+// The intensity of every pixel of img; out keeps its buffer when the capacity is large enough
+void toGray(const bmp::BMPImageView& img, const Grayscale& gray, GrayImage& out);
+
+inline GrayImage toGray(const bmp::BMPImageView& img, const Grayscale& gray) {
+    GrayImage out;
+    toGray(img, gray, out);
+    return out;
+}
+
+// 1 where the intensity of the pixel is > threshold; out keeps its buffer when it already
+// has the size of img (binarizeToMask(img, threshold, out) is this with Grayscale::average())
+void binarizeToMask(const bmp::BMPImageView& img, const Grayscale& gray, int threshold, BinaryMask& out);
+
+// The same, and the intensities into intensity, in one pass over img
+void binarizeToMask(const bmp::BMPImageView& img, const Grayscale& gray, int threshold, BinaryMask& out,
+                    GrayImage& intensity);
+
+} // namespace imgproc
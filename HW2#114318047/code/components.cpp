@@ -0,0 +1,350 @@
+#include "components.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "thread_pool.hpp"
+#include <algorithm> // for std::min, std::max, std::fill, std::swap
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+namespace imgproc {
+
+namespace {
+
+// Every component crossing a stripe border gets a label in both stripes, and all labels go
+// through the serial numbering pass, so short stripes add serial work
+const int kMinRowsPerStripe = 64;
+
+typedef ComponentLabels::Run LabeledRun;
+
+// Rows [begin, end) labelled on their own: provisional labels 1 .. parent.size() - 1,
+// global label = offset + local label
+struct Stripe {
+    int begin = 0;
+    int end = 0;
+    std::vector<int32_t> parent;        // local union-find, parent[0] = background
+    std::vector<MaskComponent> partial; // statistics of every provisional label
+    std::vector<LabeledRun> prev, cur;  // runs of the previous and of the current row
+    int32_t offset = 0;
+    long long micros = 0;               // time spent on this stripe
+};
+
+int32_t find(std::vector<int32_t>& parent, int32_t i) {
+    int32_t root = i;
+    while (parent[root] != root) root = parent[root];
+    while (parent[i] != root) { // path compression
+        const int32_t next = parent[i];
+        parent[i] = root;
+        i = next;
+    }
+    return root;
+}
+
+// the smaller label becomes the root, so a root is always the first label of its component
+int32_t unite(std::vector<int32_t>& parent, int32_t a, int32_t b) {
+    a = find(parent, a);
+    b = find(parent, b);
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+    return std::min(a, b);
+}
+
+// Lock-free versions for the labels shared by all stripes: a link only ever goes from a
+// root to a smaller label (compare-exchange on the root), so parent[i] <= i always holds,
+// every thread sees a valid ancestor and the roots end up the same as in the serial version
+int32_t findShared(std::atomic<int32_t>* parent, int32_t i) {
+    int32_t p = parent[i].load();
+    while (p != i) {
+        const int32_t gp = parent[p].load();
+        if (gp != p) parent[i].compare_exchange_weak(p, gp); // path halving, losing the race is fine
+        i = p;
+        p = parent[i].load();
+    }
+    return i;
+}
+
+void uniteShared(std::atomic<int32_t>* parent, int32_t a, int32_t b) {
+    while (true) {
+        a = findShared(parent, a);
+        b = findShared(parent, b);
+        if (a == b) return;
+        if (a > b) std::swap(a, b);
+        int32_t expected = b;
+        if (parent[b].compare_exchange_strong(expected, a)) return; // b was still a root
+    }
+}
+
+void addRun(MaskComponent& comp, int r, int begin, int end) {
+    const long long len = end - begin;
+    comp.area += static_cast<int>(len);
+    comp.minR = std::min(comp.minR, r);
+    comp.maxR = std::max(comp.maxR, r);
+    comp.minC = std::min(comp.minC, begin);
+    comp.maxC = std::max(comp.maxC, end - 1);
+    comp.sumR += len * r;
+    comp.sumC += (static_cast<long long>(begin) + end - 1) * len / 2; // begin + ... + end-1
+}
+
+void merge(MaskComponent& into, const MaskComponent& from) {
+    into.area += from.area;
+    into.minR = std::min(into.minR, from.minR);
+    into.maxR = std::max(into.maxR, from.maxR);
+    into.minC = std::min(into.minC, from.minC);
+    into.maxC = std::max(into.maxC, from.maxC);
+    into.sumR += from.sumR;
+    into.sumC += from.sumC;
+}
+
+// Pass 1 over the rows of one stripe, the label image gets local provisional labels;
+// afterwards parent[l] is the local root of l
+void scanStripe(const BinaryMask& mask, std::vector<int32_t>& image, Stripe& stripe, int reach) {
+    const int width = mask.width();
+    std::vector<int32_t>& parent = stripe.parent;
+    std::vector<MaskComponent>& partial = stripe.partial;
+    parent.assign(1, 0);
+    partial.assign(1, MaskComponent());
+    std::vector<LabeledRun>& prev = stripe.prev;
+    std::vector<LabeledRun>& cur = stripe.cur;
+    prev.clear();
+
+    for (int r = stripe.begin; r < stripe.end; ++r) {
+        int32_t* labels = &image[static_cast<size_t>(r) * width];
+        cur.clear();
+        size_t first = 0; // first run of the previous row that can still touch a run of this row
+        for (int c = mask.nextSet(r, 0); c < width; ) {
+            const int end = mask.nextClear(r, c);
+            const int lo = c - reach, hi = end + reach;
+
+            while (first < prev.size() && prev[first].end <= lo) ++first;
+            int32_t label = 0;
+            for (size_t j = first; j < prev.size() && prev[j].begin < hi; ++j) {
+                label = label ? unite(parent, label, prev[j].label) : prev[j].label;
+            }
+            if (label == 0) {
+                label = static_cast<int32_t>(parent.size());
+                parent.push_back(label);
+                MaskComponent comp;
+                comp.minR = comp.maxR = r;
+                comp.minC = c;
+                comp.maxC = end - 1;
+                partial.push_back(comp);
+            }
+
+            addRun(partial[label], r, c, end);
+            std::fill(labels + c, labels + end, label);
+            LabeledRun run;
+            run.begin = c;
+            run.end = end;
+            run.label = label;
+            cur.push_back(run);
+            c = mask.nextSet(r, end);
+        }
+        prev.swap(cur);
+    }
+    for (size_t l = 1; l < parent.size(); ++l) find(parent, static_cast<int32_t>(l));
+}
+
+// Unite the runs of row r (first row of a stripe) with the runs of row r - 1
+// (last row of the previous stripe) that touch them
+void mergeBorder(const BinaryMask& mask, const std::vector<int32_t>& image, int r, int reach,
+                 int32_t prevOffset, int32_t offset, std::atomic<int32_t>* parent) {
+    const int width = mask.width();
+    const int32_t* prevLabels = &image[static_cast<size_t>(r - 1) * width];
+    const int32_t* labels = &image[static_cast<size_t>(r) * width];
+
+    int a = mask.nextSet(r - 1, 0), b = mask.nextSet(r, 0);
+    while (a < width && b < width) {
+        const int aEnd = mask.nextClear(r - 1, a);
+        const int bEnd = mask.nextClear(r, b);
+        if (a < bEnd + reach && b < aEnd + reach) {
+            uniteShared(parent, prevOffset + prevLabels[a], offset + labels[b]);
+        }
+        // the run that ends first cannot touch anything further right
+        if (aEnd < bEnd) a = mask.nextSet(r - 1, aEnd);
+        else b = mask.nextSet(r, bEnd);
+    }
+}
+
+// fn(stripe index) for every stripe, the stripes are the bands of the shared thread pool
+template <typename F>
+void forEachStripe(int height, F fn) {
+    parallel::parallelBands(height, kMinRowsPerStripe, [&](int s, int, int) { fn(s); });
+}
+
+long long microsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int connectivityReach(int connectivity) {
+    if (connectivity != 4 && connectivity != 8) {
+        throw std::invalid_argument("labelComponents: connectivity must be 4 or 8");
+    }
+    return connectivity == 8 ? 1 : 0; // a run [b, e) touches columns [b - reach, e + reach)
+}
+
+} // namespace
+
+void labelComponents(const BinaryMask& mask, ComponentLabels& out, int connectivity) {
+    TRACE_SPAN("imgproc: label");
+    const int reach = connectivityReach(connectivity);
+    const int width = mask.width();
+    const int height = mask.height();
+
+    out.width = width;
+    out.height = height;
+    out.labels.assign(static_cast<size_t>(width) * height, 0);
+    out.stats.clear();
+
+    // Pass 1, on the buffers of the last call
+    ComponentLabels::Scratch& scratch = out.scratch;
+    Stripe all;
+    all.end = height;
+    all.parent.swap(scratch.parent);
+    all.partial.swap(scratch.partial);
+    all.prev.swap(scratch.prev);
+    all.cur.swap(scratch.cur);
+    scanStripe(mask, out.labels, all, reach);
+
+    // Pass 2: roots come before the other labels of their component, so numbering the
+    // roots in label order numbers the components in raster order of their first pixel
+    std::vector<int32_t>& finalLabel = scratch.finalLabel;
+    finalLabel.assign(all.parent.size(), 0);
+    for (size_t l = 1; l < all.parent.size(); ++l) {
+        const int32_t root = all.parent[l];
+        if (root == static_cast<int32_t>(l)) {
+            out.stats.push_back(all.partial[l]);
+            finalLabel[l] = static_cast<int32_t>(out.stats.size());
+        } else {
+            finalLabel[l] = finalLabel[root]; // root < l, already numbered
+            merge(out.stats[finalLabel[l] - 1], all.partial[l]);
+        }
+    }
+
+    // every pixel of a run has the same provisional label
+    for (int r = 0; r < height; ++r) {
+        int32_t* labels = &out.labels[static_cast<size_t>(r) * width];
+        for (int c = mask.nextSet(r, 0); c < width; ) {
+            const int end = mask.nextClear(r, c);
+            std::fill(labels + c, labels + end, finalLabel[labels[c]]);
+            c = mask.nextSet(r, end);
+        }
+    }
+
+    all.parent.swap(scratch.parent);
+    all.partial.swap(scratch.partial);
+    all.prev.swap(scratch.prev);
+    all.cur.swap(scratch.cur);
+}
+
+void labelComponentsParallel(const BinaryMask& mask, ComponentLabels& out, int connectivity,
+                             std::vector<StripeTiming>* timing) {
+    TRACE_SPAN("imgproc: label parallel");
+    const int reach = connectivityReach(connectivity);
+    const int width = mask.width();
+    const int height = mask.height();
+    const int stripes = parallel::pool().bands(height, kMinRowsPerStripe);
+
+    out.width = width;
+    out.height = height;
+    out.labels.assign(static_cast<size_t>(width) * height, 0);
+    out.stats.clear();
+
+    std::vector<Stripe> stripe(stripes);
+    for (int s = 0; s < stripes; ++s) {
+        stripe[s].begin = parallel::ThreadPool::bandBegin(height, stripes, s);
+        stripe[s].end = parallel::ThreadPool::bandBegin(height, stripes, s + 1);
+    }
+
+    // Pass 1: every stripe on its own
+    forEachStripe(height, [&](int s) {
+        const auto start = std::chrono::steady_clock::now();
+        scanStripe(mask, out.labels, stripe[s], reach);
+        stripe[s].micros += microsSince(start);
+    });
+
+    // the stripes are in raster order and so are the labels inside a stripe, so the
+    // global labels are in raster order as well, like the provisional labels of the serial scan
+    int32_t total = 0;
+    for (Stripe& st : stripe) {
+        st.offset = total;
+        total += static_cast<int32_t>(st.parent.size()) - 1;
+    }
+    std::vector<std::atomic<int32_t>> parent(static_cast<size_t>(total) + 1);
+    parent[0].store(0);
+    for (const Stripe& st : stripe) {
+        for (size_t l = 1; l < st.parent.size(); ++l) parent[st.offset + l].store(st.offset + st.parent[l]);
+    }
+
+    // Equivalences across the stripe borders, every border on its own thread
+    forEachStripe(height, [&](int s) {
+        if (s == 0) return;
+        const auto start = std::chrono::steady_clock::now();
+        mergeBorder(mask, out.labels, stripe[s].begin, reach, stripe[s - 1].offset, stripe[s].offset, parent.data());
+        stripe[s].micros += microsSince(start);
+    });
+
+    // Pass 2: number the roots in order (O(labels)), merge the statistics
+    std::vector<int32_t> finalLabel(static_cast<size_t>(total) + 1, 0);
+    for (const Stripe& st : stripe) {
+        for (size_t l = 1; l < st.parent.size(); ++l) {
+            const int32_t g = st.offset + static_cast<int32_t>(l);
+            const int32_t root = findShared(parent.data(), g);
+            if (root == g) {
+                out.stats.push_back(st.partial[l]);
+                finalLabel[g] = static_cast<int32_t>(out.stats.size());
+            } else {
+                finalLabel[g] = finalLabel[root];
+                merge(out.stats[finalLabel[g] - 1], st.partial[l]);
+            }
+        }
+    }
+
+    // rewrite the label image, stripe by stripe
+    forEachStripe(height, [&](int s) {
+        const auto start = std::chrono::steady_clock::now();
+        const int32_t* toFinal = &finalLabel[stripe[s].offset];
+        for (int r = stripe[s].begin; r < stripe[s].end; ++r) {
+            int32_t* labels = &out.labels[static_cast<size_t>(r) * width];
+            for (int c = mask.nextSet(r, 0); c < width; ) {
+                const int end = mask.nextClear(r, c);
+                std::fill(labels + c, labels + end, toFinal[labels[c]]);
+                c = mask.nextSet(r, end);
+            }
+        }
+        stripe[s].micros += microsSince(start);
+    });
+
+    if (timing) {
+        timing->clear();
+        for (const Stripe& st : stripe) {
+            StripeTiming t;
+            t.begin = st.begin;
+            t.end = st.end;
+            t.micros = st.micros;
+            timing->push_back(t);
+        }
+    }
+}
+
+int removeSmallComponents(BinaryMask& mask, const ComponentLabels& labels, int minArea) {
+    TRACE_SPAN("imgproc: remove small");
+    if (labels.width != mask.width() || labels.height != mask.height()) {
+        throw std::invalid_argument("removeSmallComponents: labels and mask size mismatch");
+    }
+    int removed = 0;
+    for (const MaskComponent& comp : labels.stats) {
+        if (comp.area < minArea) ++removed;
+    }
+    if (removed == 0) return 0;
+
+    for (int r = 0; r < mask.height(); ++r) {
+        const int32_t* row = labels.row(r);
+        for (int c = mask.nextSet(r, 0); c < mask.width(); ) {
+            const int end = mask.nextClear(r, c);
+            if (row[c] > 0 && labels.stats[row[c] - 1].area < minArea) mask.clearRange(r, c, end);
+            c = mask.nextSet(r, end);
+        }
+    }
+    return removed;
+}
+
+} // namespace imgproc
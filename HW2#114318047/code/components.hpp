@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "binary_mask.hpp" // imgproc::BinaryMask, imgproc::MaskComponent
+
+namespace imgproc {
+
+// Label image of the 1 pixels of a mask plus the statistics of every component
+/*
+    labels has the same layout as the mask (row 0 = bottom row), one int32 per pixel:
+    0 = background, i + 1 = the pixel belongs to stats[i]
+
+    components are numbered in raster order of their first pixel, the same order as
+    labelMask() and the old BFS loops of HW2
+*/
+struct ComponentLabels {
+    int width = 0;
+    int height = 0;
+    std::vector<int32_t> labels;
+    std::vector<MaskComponent> stats; // area, bounding box and first moments (sumR, sumC)
+
+    const int32_t* row(int r) const { return &labels[static_cast<size_t>(r) * width]; }
+    int32_t at(int r, int c) const { return row(r)[c]; }
+
+    // A run of 1 pixels [begin, end) and its provisional label
+    struct Run {
+        int begin;
+        int end;
+        int32_t label;
+    };
+
+    // Working memory of labelComponents, kept with the result so that labelling
+    // into the same object again does not allocate once the buffers are big enough
+    struct Scratch {
+        std::vector<int32_t> parent;        // union-find of the provisional labels
+        std::vector<MaskComponent> partial; // statistics of every provisional label
+        std::vector<int32_t> finalLabel;    // provisional -> final label
+        std::vector<Run> prev, cur;         // runs of the previous and of the current row
+    };
+    Scratch scratch;
+};
+
+// Two-pass connected-component labelling with a path-compressed union-find
+/*
+    pass 1: raster scan, run by run (the runs of a row are found a word at a time);
+            a run takes the provisional label of the runs of the row below that touch it
+            (shared column for 4-connectivity, shared column or corner for 8) and records
+            the equivalences when it touches several, or opens a new label when it
+            touches none; area, bounding box and sums are added to its provisional label
+    pass 2: every provisional label is resolved to its root, the roots are numbered in
+            order, the statistics of a label are merged into its final component
+            (O(labels), no pixel lists), and the label image is rewritten run by run
+
+    connectivity is 4 or 8, anything else throws std::invalid_argument
+    out keeps its buffers (labels, stats and scratch) when it is reused, so labelling
+    image after image into the same object does not allocate in the steady state
+*/
+void labelComponents(const BinaryMask& mask, ComponentLabels& out, int connectivity = 4);
+
+inline ComponentLabels labelComponents(const BinaryMask& mask, int connectivity = 4) {
+    ComponentLabels out;
+    labelComponents(mask, out, connectivity);
+    return out;
+}
+
+// Rows and busy time of one stripe of labelComponentsParallel
+struct StripeTiming {
+    int begin;        // rows [begin, end)
+    int end;
+    long long micros; // labelling + border merge + relabelling, in us
+};
+
+// Same labels and statistics as labelComponents, bit for bit, with the rows cut into
+// horizontal stripes labelled on the shared thread pool (parallel::pool())
+/*
+    1. every stripe runs pass 1 on its own, with its own provisional labels
+    2. the provisional labels get a global number: stripe offset + local label, which
+       keeps them in raster order; every stripe border is merged on its own thread with
+       a lock-free union-find (compare-exchange links, always towards the smaller label)
+    3. the roots are numbered in label order, as in the serial pass 2, so the final
+       labels do not depend on the number of threads or on the order the threads ran
+    4. every stripe rewrites its part of the label image
+
+    timing (optional) receives one entry per stripe, stripes have at least 64 rows
+*/
+void labelComponentsParallel(const BinaryMask& mask, ComponentLabels& out, int connectivity = 4,
+                             std::vector<StripeTiming>* timing = nullptr);
+
+// Clear every pixel of mask whose component (from labelComponents on the same mask)
+// is smaller than minArea pixels, returns how many components were removed
+int removeSmallComponents(BinaryMask& mask, const ComponentLabels& labels, int minArea);
+
+} // namespace imgproc
@@ -0,0 +1,116 @@
+#include "geometry.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include <algorithm> // for std::sort, std::unique, std::swap
+#include <cmath> // for std::hypot
+
+namespace imgproc {
+
+namespace {
+
+// > 0 when o -> a -> b turns counter-clockwise
+long long cross(const GridPoint& o, const GridPoint& a, const GridPoint& b) {
+    return static_cast<long long>(a.first - o.first) * (b.second - o.second) -
+           static_cast<long long>(a.second - o.second) * (b.first - o.first);
+}
+
+long long squaredDistance(const GridPoint& a, const GridPoint& b) {
+    const long long dr = a.first - b.first;
+    const long long dc = a.second - b.second;
+    return dr * dr + dc * dc;
+}
+
+// Keep the longer pair, or the one first in raster order when they are equally long
+void consider(const GridPoint& a, const GridPoint& b, long long& best, GridPoint& p1, GridPoint& p2) {
+    GridPoint lo = a, hi = b;
+    if (hi < lo) std::swap(lo, hi);
+    const long long d = squaredDistance(lo, hi);
+    if (d > best || (d == best && std::make_pair(lo, hi) < std::make_pair(p1, p2))) {
+        best = d;
+        p1 = lo;
+        p2 = hi;
+    }
+}
+
+} // namespace
+
+std::vector<GridPoint> convexHull(std::vector<GridPoint> points) {
+    std::sort(points.begin(), points.end());
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    const size_t n = points.size();
+    if (n < 3) return points;
+
+    // lower chain left to right, then upper chain right to left
+    std::vector<GridPoint> hull(2 * n);
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0) --k;
+        hull[k++] = points[i];
+    }
+    for (size_t i = n - 1, lower = k + 1; i-- > 0; ) {
+        while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0) --k;
+        hull[k++] = points[i];
+    }
+    hull.resize(k - 1); // the last point is the first one again
+    return hull;
+}
+
+Diameter hullDiameter(const std::vector<GridPoint>& hull) {
+    Diameter result;
+    const size_t h = hull.size();
+    if (h == 0) return result;
+    if (h == 1) {
+        result.p1 = result.p2 = hull[0];
+        return result;
+    }
+
+    long long best = -1;
+    GridPoint p1 = hull[0], p2 = hull[0];
+    if (h == 2) {
+        consider(hull[0], hull[1], best, p1, p2);
+    } else {
+        size_t j = 1;
+        for (size_t i = 0; i < h; ++i) {
+            const size_t i1 = (i + 1) % h;
+            // twice the area of the triangle (edge i, vertex j) grows until j is antipodal to the edge
+            while (cross(hull[i], hull[i1], hull[(j + 1) % h]) > cross(hull[i], hull[i1], hull[j])) j = (j + 1) % h;
+            consider(hull[i], hull[j], best, p1, p2);
+            consider(hull[i1], hull[j], best, p1, p2);
+            // edge parallel to the caliper: the next vertex is antipodal as well
+            if (cross(hull[i], hull[i1], hull[(j + 1) % h]) == cross(hull[i], hull[i1], hull[j])) {
+                consider(hull[i], hull[(j + 1) % h], best, p1, p2);
+                consider(hull[i1], hull[(j + 1) % h], best, p1, p2);
+            }
+        }
+    }
+
+    result.p1 = p1;
+    result.p2 = p2;
+    result.length = std::hypot(p2.first - p1.first, p2.second - p1.second);
+    return result;
+}
+
+std::vector<Diameter> componentDiameters(const BinaryMask& mask, const ComponentLabels& labels) {
+    TRACE_SPAN("imgproc: diameters");
+    std::vector<std::vector<GridPoint>> ends(labels.stats.size());
+    for (int r = 0; r < mask.height(); ++r) {
+        const int32_t* row = labels.row(r);
+        for (int c = mask.nextSet(r, 0); c < mask.width(); ) {
+            const int end = mask.nextClear(r, c);
+            if (row[c] > 0) {
+                std::vector<GridPoint>& points = ends[row[c] - 1];
+                points.emplace_back(r, c);
+                if (end - 1 > c) points.emplace_back(r, end - 1);
+            }
+            c = mask.nextSet(r, end);
+        }
+    }
+
+    std::vector<Diameter> diameters;
+    diameters.reserve(ends.size());
+    for (std::vector<GridPoint>& points : ends) {
+        diameters.push_back(pointSetDiameter(std::move(points)));
+    }
+    return diameters;
+}
+
+} // namespace imgproc
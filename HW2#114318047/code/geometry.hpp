@@ -0,0 +1,50 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include "binary_mask.hpp" // imgproc::BinaryMask
+#include "components.hpp" // imgproc::ComponentLabels
+
+namespace imgproc {
+
+// Points are (row, column) pairs, as everywhere else in HW2
+typedef std::pair<int, int> GridPoint;
+
+// Convex hull with Andrew's monotone chain, O(n log n)
+/*
+    vertices in counter-clockwise order (in (row, column) coordinates), starting at the
+    smallest point, without duplicates and without points in the middle of an edge;
+    1 or 2 points for degenerate inputs, empty for an empty input
+*/
+std::vector<GridPoint> convexHull(std::vector<GridPoint> points);
+
+// The two points furthest apart
+struct Diameter {
+    double length = 0.0; // Euclidean distance between p1 and p2
+    GridPoint p1;        // p1 < p2 in raster order (row, then column)
+    GridPoint p2;
+};
+
+// Diameter of a convex polygon from convexHull with rotating calipers, O(h)
+/*
+    for every hull edge, the caliper on the other side advances while the triangle
+    (edge, vertex) grows; the vertex pairs met on the way (the antipodal pairs, both
+    of them when an edge is parallel to the caliper) contain every farthest pair
+
+    among equally long pairs the one that is first in raster order wins, which is the
+    pair the old double loop over raster-ordered points returned
+*/
+Diameter hullDiameter(const std::vector<GridPoint>& hull);
+
+inline Diameter pointSetDiameter(std::vector<GridPoint> points) {
+    return hullDiameter(convexHull(std::move(points)));
+}
+
+// Longest axis of every component of labels (index i => labels.stats[i])
+/*
+    mask is the mask that was labelled, or the same mask after removeSmallComponents
+    (removed components get length 0); only the two ends of every run can be hull
+    vertices, so the points come from the runs, not from every pixel
+*/
+std::vector<Diameter> componentDiameters(const BinaryMask& mask, const ComponentLabels& labels);
+
+} // namespace imgproc
@@ -0,0 +1,238 @@
+#include "histogram.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <mutex>
+#include <stdexcept>
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+namespace imgproc {
+
+namespace {
+
+typedef uint64_t SubHistograms[4][256];
+
+// (B + G + R) / 3 without a divide: s * 0xAAAB >> 17 == s / 3 for every s <= 765
+inline int averageIntensity(const uint8_t* px) {
+    return static_cast<int>(((px[0] + px[1] + px[2]) * 0xAAABu) >> 17);
+}
+
+// Pixels [c, width) of one row, one at a time
+void countTail(const uint8_t* px, int c, int width, SubHistograms& sub) {
+    for (px += c * 3; c < width; ++c, px += 3) ++sub[c & 3][averageIntensity(px)];
+}
+
+#if ACV_X86
+
+// pshufb controls that gather channel ch of 16 pixels (48 bytes in 3 vectors) from vector v
+struct SplitMasks {
+    alignas(16) int8_t bytes[3][3][16]; // [ch][v][lane]
+    SplitMasks() {
+        for (int ch = 0; ch < 3; ++ch) {
+            for (int v = 0; v < 3; ++v) {
+                for (int i = 0; i < 16; ++i) {
+                    const int src = 3 * i + ch;
+                    bytes[ch][v][i] = src / 16 == v ? static_cast<int8_t>(src % 16) : static_cast<int8_t>(-128);
+                }
+            }
+        }
+    }
+};
+
+// One channel of 16 pixels as bytes
+ACV_TARGET("ssse3")
+inline __m128i gatherChannel(__m128i v0, __m128i v1, __m128i v2, const int8_t (*mask)[16]) {
+    const __m128i* m = reinterpret_cast<const __m128i*>(mask);
+    return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, _mm_load_si128(m)),
+                                     _mm_shuffle_epi8(v1, _mm_load_si128(m + 1))),
+                        _mm_shuffle_epi8(v2, _mm_load_si128(m + 2)));
+}
+
+// Count the average intensities of 16 pixels, one channel per vector
+ACV_TARGET("ssse3")
+inline void countAverages(__m128i b, __m128i g, __m128i r, SubHistograms& sub) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i third = _mm_set1_epi16(static_cast<short>(0xAAAB));
+    alignas(16) uint8_t avg[16];
+
+    // B + G + R in 16 bits, then (s * 0xAAAB) >> 17 as mulhi + shift
+    const __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero)),
+                                     _mm_unpacklo_epi8(r, zero));
+    const __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero)),
+                                     _mm_unpackhi_epi8(r, zero));
+    const __m128i avgLo = _mm_srli_epi16(_mm_mulhi_epu16(lo, third), 1);
+    const __m128i avgHi = _mm_srli_epi16(_mm_mulhi_epu16(hi, third), 1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(avg), _mm_packus_epi16(avgLo, avgHi));
+
+    for (int i = 0; i < 16; i += 4) {
+        ++sub[0][avg[i]];
+        ++sub[1][avg[i + 1]];
+        ++sub[2][avg[i + 2]];
+        ++sub[3][avg[i + 3]];
+    }
+}
+
+// 16 pixels per step, returns the first column not counted
+ACV_TARGET("ssse3")
+int countRowSSSE3(const uint8_t* row, int width, SubHistograms& sub) {
+    static const SplitMasks split;
+    int c = 0;
+    for (; c + 16 <= width; c += 16) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(row + c * 3);
+        const __m128i v0 = _mm_loadu_si128(p);
+        const __m128i v1 = _mm_loadu_si128(p + 1);
+        const __m128i v2 = _mm_loadu_si128(p + 2);
+        countAverages(gatherChannel(v0, v1, v2, split.bytes[0]), gatherChannel(v0, v1, v2, split.bytes[1]),
+                      gatherChannel(v0, v1, v2, split.bytes[2]), sub);
+    }
+    return c;
+}
+
+// The same on planes: plain loads, no shuffles
+ACV_TARGET("ssse3")
+int countPlanarRowSSSE3(const uint8_t* b, const uint8_t* g, const uint8_t* r, int width, SubHistograms& sub) {
+    int c = 0;
+    for (; c + 16 <= width; c += 16) {
+        countAverages(_mm_load_si128(reinterpret_cast<const __m128i*>(b + c)),
+                      _mm_load_si128(reinterpret_cast<const __m128i*>(g + c)),
+                      _mm_load_si128(reinterpret_cast<const __m128i*>(r + c)), sub);
+    }
+    return c;
+}
+
+#endif
+
+// Prefix sums of the histogram, for the class sums of the Otsu methods
+struct ClassSums {
+    double count[257]; // pixels in bins [0, i)
+    double sum[257];   // sum of their intensities
+
+    explicit ClassSums(const IntensityHistogram& h) {
+        count[0] = sum[0] = 0;
+        for (int i = 0; i < 256; ++i) {
+            count[i + 1] = count[i] + static_cast<double>(h.counts[i]);
+            sum[i + 1] = sum[i] + static_cast<double>(h.counts[i]) * i;
+        }
+    }
+
+    // S^2 / W of the class of bins [a, b), 0 when it is empty
+    double score(int a, int b) const {
+        const double w = count[b] - count[a];
+        const double s = sum[b] - sum[a];
+        return w > 0 ? s * s / w : 0.0;
+    }
+};
+
+} // namespace
+
+uint64_t IntensityHistogram::total() const {
+    uint64_t n = 0;
+    for (uint64_t c : counts) n += c;
+    return n;
+}
+
+void intensityHistogram(const bmp::BMPImageView& img, IntensityHistogram& out) {
+    out.counts.fill(0);
+    accumulateHistogram(img, out);
+}
+
+void accumulateHistogram(const bmp::BMPImageView& img, IntensityHistogram& out) {
+    TRACE_SPAN("imgproc: histogram");
+#if ACV_X86
+    const bool simd = cpu::hasSSSE3();
+#endif
+    std::mutex merge;
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        SubHistograms sub = {};
+        for (int r = begin; r < end; ++r) {
+            const uint8_t* row = img.row(r);
+            int c = 0;
+#if ACV_X86
+            if (simd) c = countRowSSSE3(row, img.width, sub);
+#endif
+            countTail(row, c, img.width, sub);
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        for (int i = 0; i < 256; ++i) out.counts[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+    });
+}
+
+void intensityHistogram(const PlanarImage& img, IntensityHistogram& out) {
+    out.counts.fill(0);
+    accumulateHistogram(img, out);
+}
+
+void accumulateHistogram(const PlanarImage& img, IntensityHistogram& out) {
+    TRACE_SPAN("imgproc: histogram planar");
+#if ACV_X86
+    const bool simd = cpu::hasSSSE3();
+#endif
+    std::mutex merge;
+    parallel::parallelRows(img.height(), parallel::kMinRowsPerBand, [&](int begin, int end) {
+        SubHistograms sub = {};
+        for (int r = begin; r < end; ++r) {
+            const uint8_t* b = img.row(0, r);
+            const uint8_t* g = img.row(1, r);
+            const uint8_t* rr = img.row(2, r);
+            int c = 0;
+#if ACV_X86
+            if (simd) c = countPlanarRowSSSE3(b, g, rr, img.width(), sub);
+#endif
+            for (; c < img.width(); ++c) ++sub[c & 3][((b[c] + g[c] + rr[c]) * 0xAAABu) >> 17];
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        for (int i = 0; i < 256; ++i) out.counts[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+    });
+}
+
+int otsuThreshold(const IntensityHistogram& h) {
+    // the same scores and tie-breaking (first maximum) as multiOtsuThresholds(h, 2)
+    const ClassSums sums(h);
+    int best = 1;
+    double bestScore = -1;
+    for (int j = 1; j < 256; ++j) {
+        const double score = sums.score(0, j) + sums.score(j, 256);
+        if (score > bestScore) {
+            bestScore = score;
+            best = j;
+        }
+    }
+    return best - 1;
+}
+
+std::vector<int> multiOtsuThresholds(const IntensityHistogram& h, int classes) {
+    if (classes < 2 || classes > 256) {
+        throw std::invalid_argument("multiOtsuThresholds: classes must be in [2, 256]");
+    }
+    const ClassSums sums(h);
+
+    // best[k][b]: largest score of bins [0, b) cut into k + 1 classes,
+    // from[k][b]: where its last class starts
+    std::vector<std::vector<double>> best(classes, std::vector<double>(257, -1));
+    std::vector<std::vector<int>> from(classes, std::vector<int>(257, 0));
+    for (int b = 1; b <= 256; ++b) best[0][b] = sums.score(0, b);
+    for (int k = 1; k < classes; ++k) {
+        for (int b = k + 1; b <= 256; ++b) {
+            for (int j = k; j < b; ++j) {
+                const double score = best[k - 1][j] + sums.score(j, b);
+                if (score > best[k][b]) {
+                    best[k][b] = score;
+                    from[k][b] = j;
+                }
+            }
+        }
+    }
+
+    std::vector<int> thresholds(classes - 1);
+    int b = 256;
+    for (int k = classes - 1; k >= 1; --k) {
+        b = from[k][b];
+        thresholds[k - 1] = b - 1; // the class before ends at bin b - 1
+    }
+    return thresholds;
+}
+
+} // namespace imgproc
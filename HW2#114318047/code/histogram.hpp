@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImageView
+#include "planar.hpp" // imgproc::PlanarImage, imgproc::Layout
+
+namespace imgproc {
+
+// Pixel count of every average intensity (B + G + R) / 3, rounded down: the value
+// binarizeToMask compares with its threshold
+struct IntensityHistogram {
+    std::array<uint64_t, 256> counts{};
+
+    uint64_t total() const;
+};
+
+// Histogram of img into out
+/*
+    The rows are cut into bands on the thread pool, every band counts into its own
+    histograms and adds them to out at the end, so the threads never write the same bin.
+    Inside a band, pixel i of a row goes to sub-histogram i % 4: runs of equal pixels
+    (the usual case) do not wait for the store of the previous increment of the same bin.
+    The intensities are computed 16 pixels at a time with SSSE3 when the CPU has it
+    (BGR split with byte shuffles, the divide by 3 as a 16-bit multiply)
+*/
+void intensityHistogram(const bmp::BMPImageView& img, IntensityHistogram& out);
+
+// The same, added to the counts already in out (e.g. strip after strip)
+void accumulateHistogram(const bmp::BMPImageView& img, IntensityHistogram& out);
+
+inline IntensityHistogram intensityHistogram(const bmp::BMPImageView& img) {
+    IntensityHistogram h;
+    intensityHistogram(img, h);
+    return h;
+}
+
+// The same on planes (B, G and R are plain 16-byte loads, no shuffles)
+void intensityHistogram(const PlanarImage& img, IntensityHistogram& out);
+void accumulateHistogram(const PlanarImage& img, IntensityHistogram& out);
+
+// intensityHistogram for LazyImage::run, on planes
+struct HistogramKernel {
+    static const Layout layout = Layout::Planar;
+    void operator()(const PlanarImage& img, IntensityHistogram& out) const { intensityHistogram(img, out); }
+};
+
+// Otsu's threshold: t with the largest between-class variance of the classes [0, t] and
+// [t + 1, 255], so binarizeToMask(img, t) makes the brighter class white
+int otsuThreshold(const IntensityHistogram& h);
+
+// Multi-level Otsu: classes - 1 increasing thresholds t1 < t2 < ..., class i is
+// [t(i-1) + 1, t(i)], the last one ends at 255; throws std::invalid_argument unless
+// 2 <= classes <= 256
+/*
+    Maximizes the between-class variance, i.e. the sum of S(c)^2 / W(c) over the classes
+    (S = sum of the intensities, W = pixel count), by dynamic programming over the bins:
+    O(classes * 256^2) whatever the image size, instead of trying all 256^(classes - 1)
+    combinations. classes = 2 gives otsuThreshold.
+*/
+std::vector<int> multiOtsuThresholds(const IntensityHistogram& h, int classes);
+
+} // namespace imgproc
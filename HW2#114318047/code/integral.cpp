@@ -0,0 +1,145 @@
+#include "integral.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "thread_pool.hpp"
+#include <algorithm> // for std::min, std::max
+#include <cmath> // for std::sqrt
+#include <stdexcept>
+
+namespace imgproc {
+
+void IntegralImage::build(const bmp::BMPImageView& img, bool squares) {
+    TRACE_SPAN("imgproc: integral");
+    if (img.width <= 0 || img.height <= 0) {
+        throw std::invalid_argument("IntegralImage: image size must be positive");
+    }
+    width_ = img.width;
+    height_ = img.height;
+    squares_ = squares;
+    const size_t stride = static_cast<size_t>(width_) + 1;
+    const size_t values = stride * (height_ + 1);
+    // row 0 stays 0, every other value is overwritten below
+    if (sum_.size() != values) sum_.assign(values, 0);
+    if (squares_ && squareSum_.size() != values) squareSum_.assign(values, 0);
+
+    const int bands = parallel::pool().bands(height_, parallel::kMinRowsPerBand);
+    bandTotals_.resize(stride * 2 * bands);
+
+    // 1. rows along, then down the rows of the band (the band above the first is not read,
+    //    another thread may still be writing it)
+    parallel::parallelBands(height_, parallel::kMinRowsPerBand, [&](int band, int begin, int end) {
+        for (int r = begin; r < end; ++r) {
+            const uint8_t* px = img.row(r);
+            uint64_t* s = &sum_[(r + 1) * stride];
+            const uint64_t* above = r > begin ? s - stride : nullptr;
+            s[0] = 0;
+            uint64_t run = 0;
+            for (int c = 0; c < width_; ++c, px += 3) {
+                run += px[0] + px[1] + px[2];
+                s[c + 1] = above ? run + above[c + 1] : run;
+            }
+            if (!squares_) continue;
+
+            px = img.row(r);
+            uint64_t* q = &squareSum_[(r + 1) * stride];
+            const uint64_t* qAbove = r > begin ? q - stride : nullptr;
+            q[0] = 0;
+            uint64_t runSquares = 0;
+            for (int c = 0; c < width_; ++c, px += 3) {
+                const uint64_t v = px[0] + px[1] + px[2];
+                runSquares += v * v;
+                q[c + 1] = qAbove ? runSquares + qAbove[c + 1] : runSquares;
+            }
+        }
+        std::copy(&sum_[end * stride], &sum_[end * stride] + stride, &bandTotals_[2 * band * stride]);
+        if (squares_) {
+            std::copy(&squareSum_[end * stride], &squareSum_[end * stride] + stride,
+                      &bandTotals_[(2 * band + 1) * stride]);
+        }
+    });
+    if (bands <= 1) return;
+
+    // 2. total of every band and the bands before it
+    for (int b = 1; b < bands; ++b) {
+        for (int t = 0; t < (squares_ ? 2 : 1); ++t) {
+            uint64_t* total = &bandTotals_[(2 * b + t) * stride];
+            const uint64_t* before = total - 2 * stride;
+            for (size_t c = 0; c < stride; ++c) total[c] += before[c];
+        }
+    }
+
+    // 3. the bands before it, added to every row of a band
+    parallel::parallelBands(height_, parallel::kMinRowsPerBand, [&](int band, int begin, int end) {
+        if (band == 0) return;
+        for (int t = 0; t < (squares_ ? 2 : 1); ++t) {
+            std::vector<uint64_t>& table = t == 0 ? sum_ : squareSum_;
+            const uint64_t* offset = &bandTotals_[(2 * (band - 1) + t) * stride];
+            for (int r = begin; r < end; ++r) {
+                uint64_t* row = &table[(r + 1) * stride];
+                for (size_t c = 0; c < stride; ++c) row[c] += offset[c];
+            }
+        }
+    });
+}
+
+void adaptiveBinarizeToMask(const bmp::BMPImageView& img, const AdaptiveThreshold& threshold,
+                            IntegralImage& integral, BinaryMask& out) {
+    TRACE_SPAN("imgproc: adaptive threshold");
+    if (threshold.window < 1 || threshold.window % 2 == 0) {
+        throw std::invalid_argument("adaptiveBinarizeToMask: window must be odd and positive");
+    }
+    const bool sauvola = threshold.method == AdaptiveThreshold::Sauvola;
+    if (sauvola && threshold.range <= 0) {
+        throw std::invalid_argument("adaptiveBinarizeToMask: Sauvola range must be positive");
+    }
+
+    integral.build(img, sauvola);
+    // every word of every row is overwritten below, no need to clear a reused mask
+    if (out.width() != img.width || out.height() != img.height) out = BinaryMask(img.width, img.height);
+
+    const int width = img.width;
+    const int height = img.height;
+    const int half = threshold.window / 2;
+    // in units of v = 3 * intensity: Bradley  v * n > S * (1 - t),
+    // Sauvola  v > S / n * (1 + k * (sd(v) / (3 * range) - 1))
+    const double bradleyScale = 1.0 - threshold.k;
+    const double sauvolaRange = 3.0 * threshold.range;
+
+    parallel::parallelRows(height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) {
+            const int r0 = std::max(0, r - half);
+            const int r1 = std::min(height, r + half + 1);
+            const uint64_t* s0 = integral.sumRow(r0);
+            const uint64_t* s1 = integral.sumRow(r1);
+            const uint64_t* q0 = sauvola ? integral.squareSumRow(r0) : nullptr;
+            const uint64_t* q1 = sauvola ? integral.squareSumRow(r1) : nullptr;
+            const uint8_t* px = img.row(r);
+            uint64_t* bits = out.row(r);
+
+            for (int c0 = 0; c0 < width; c0 += 64) {
+                const int n = std::min(64, width - c0);
+                uint64_t word = 0;
+                for (int b = 0; b < n; ++b, px += 3) {
+                    const int c = c0 + b;
+                    const int left = std::max(0, c - half);
+                    const int right = std::min(width, c + half + 1);
+                    const double count = static_cast<double>(r1 - r0) * (right - left);
+                    const double sum = static_cast<double>(s1[right] - s0[right] - s1[left] + s0[left]);
+                    const double v = px[0] + px[1] + px[2];
+                    bool white;
+                    if (sauvola) {
+                        const double squares = static_cast<double>(q1[right] - q0[right] - q1[left] + q0[left]);
+                        const double mean = sum / count;
+                        const double sd = std::sqrt(std::max(0.0, squares / count - mean * mean));
+                        white = v > mean * (1.0 + threshold.k * (sd / sauvolaRange - 1.0));
+                    } else {
+                        white = v * count > sum * bradleyScale;
+                    }
+                    word |= static_cast<uint64_t>(white) << b;
+                }
+                bits[c0 >> 6] = word;
+            }
+        }
+    });
+}
+
+} // namespace imgproc
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImageView
+#include "binary_mask.hpp" // imgproc::BinaryMask
+
+namespace imgproc {
+
+// Summed-area tables of the pixel intensity v = B + G + R (3 x the average intensity of
+// binarizeToMask) and of v * v
+/*
+    S(r, c) = sum of v over rows [0, r) and columns [0, c), stored as (height + 1) x (width + 1)
+    values with row 0 and column 0 all 0, so the sum over any rectangle is
+        S(r1, c1) - S(r0, c1) - S(r1, c0) + S(r0, c0)
+    four lookups whatever its size; Q is the same table for v * v. Both are 64-bit
+    (v * v < 2^20, no image that fits in memory can overflow them). Rows are in the
+    order of BMPImage::data (row 0 = bottom row).
+
+    Built as a blocked prefix scan over the bands of the thread pool:
+      1. every band: running sum along each row, then down the rows of the band only
+      2. the last rows of the bands are summed up band after band (bands x width)
+      3. every band but the first: adds the total of the bands before it to its rows
+    Memory: 8 bytes per pixel for S, 8 more for Q; build() keeps the buffers when the
+    size does not change
+*/
+class IntegralImage {
+public:
+    IntegralImage() {}
+    explicit IntegralImage(const bmp::BMPImageView& img, bool squares = true) { build(img, squares); }
+
+    // squares: also build Q (only needed for the variance)
+    void build(const bmp::BMPImageView& img, bool squares = true);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    bool hasSquares() const { return squares_; }
+
+    // Sum of v over rows [r0, r1) and columns [c0, c1)
+    uint64_t sum(int r0, int c0, int r1, int c1) const { return rect(sum_, r0, c0, r1, c1); }
+
+    // Sum of v * v over rows [r0, r1) and columns [c0, c1), needs hasSquares()
+    uint64_t sumSquares(int r0, int c0, int r1, int c1) const { return rect(squareSum_, r0, c0, r1, c1); }
+
+    // Table row r (width + 1 values), r in [0, height]
+    const uint64_t* sumRow(int r) const { return &sum_[static_cast<size_t>(r) * (width_ + 1)]; }
+    const uint64_t* squareSumRow(int r) const { return &squareSum_[static_cast<size_t>(r) * (width_ + 1)]; }
+
+private:
+    uint64_t rect(const std::vector<uint64_t>& t, int r0, int c0, int r1, int c1) const {
+        const size_t stride = width_ + 1;
+        return t[r1 * stride + c1] - t[r0 * stride + c1] - t[r1 * stride + c0] + t[r0 * stride + c0];
+    }
+
+    int width_ = 0;
+    int height_ = 0;
+    bool squares_ = false;
+    std::vector<uint64_t> sum_, squareSum_;
+    std::vector<uint64_t> bandTotals_; // last row of every band, for step 2
+};
+
+// Local threshold over a window x window square centered on the pixel
+/*
+    The window is clipped at the image border (n = pixels inside it), m and s are the
+    mean and standard deviation of the average intensity in it, I the pixel's own:
+        Bradley:  white when I > m * (1 - t)                    (t = 0.15: 15% darker than the
+                                                                 surroundings is black)
+        Sauvola:  white when I > m * (1 + k * (s / range - 1))  (range = 128, the largest s
+                                                                 of 8-bit values)
+    Both follow the lighting of the scene, where one global threshold (binarizeToMask)
+    turns a shaded area all black and a bright one all white
+*/
+struct AdaptiveThreshold {
+    enum Method { Bradley, Sauvola };
+    Method method;
+    int window;   // side of the square, odd
+    double k;     // Bradley: t, Sauvola: k
+    double range; // Sauvola only
+
+    static AdaptiveThreshold bradley(int window, double t = 0.15) {
+        return AdaptiveThreshold{Bradley, window, t, 0};
+    }
+    static AdaptiveThreshold sauvola(int window, double k = 0.2, double range = 128) {
+        return AdaptiveThreshold{Sauvola, window, k, range};
+    }
+};
+
+// 1 where the pixel is brighter than its local threshold; O(1) per pixel whatever the
+// window: integral is built from img first (Q only for Sauvola), mean and variance of
+// every window come from its tables. integral and out keep their buffers when reused
+void adaptiveBinarizeToMask(const bmp::BMPImageView& img, const AdaptiveThreshold& threshold,
+                            IntegralImage& integral, BinaryMask& out);
+
+inline BinaryMask adaptiveBinarizeToMask(const bmp::BMPImageView& img, const AdaptiveThreshold& threshold) {
+    IntegralImage integral;
+    BinaryMask mask;
+    adaptiveBinarizeToMask(img, threshold, integral, mask);
+    return mask;
+}
+
+} // namespace imgproc
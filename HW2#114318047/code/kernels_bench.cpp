@@ -0,0 +1,313 @@
+#include <algorithm> // for std::max
+#include <cmath> // for std::fabs
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "bench.hpp" // bench::Options, bench::Report, bench::measure
+#include "bmp.hpp"
+#include "binary_mask.hpp" // imgproc::binarizeToMask
+#include "color.hpp" // imgproc::Grayscale, imgproc::toGray
+#include "point_ops.hpp" // imgproc::ops::pipe, imgproc::ops::run
+#include "morphology.hpp" // imgproc::Morphology
+#include "pipeline.hpp" // imgproc::MaskPipeline
+#include "integral.hpp" // imgproc::IntegralImage, imgproc::adaptiveBinarizeToMask
+#include "histogram.hpp" // imgproc::intensityHistogram, imgproc::otsuThreshold
+#include "planar.hpp" // imgproc::PlanarImage, imgproc::LazyImage
+#include "components.hpp" // imgproc::labelComponentsParallel
+#include "run_mask.hpp" // imgproc::RunMask
+#include "geometry.hpp" // imgproc::pointSetDiameter
+#include "thread_pool.hpp" // parallel::setThreads
+
+/********************************************************
+* Filename    : kernels_bench.cpp
+* Note        : Every HW2 kernel against the equivalent OpenCV call, on synthetic
+*               square images, with the parameters of task3: threshold, BT.601
+*               gray (alone and fused with the threshold), the threshold as a
+*               point-op pipeline, 3x3 erosion,
+*               7x7 dilation, the fused threshold + open + dilate pipeline,
+*               summed-area tables, Bradley adaptive threshold (window n / 8),
+*               intensity histogram, Otsu threshold + binarization,
+*               4-connected labelling, the longest axis of the mask and the
+*               conversions between interleaved and planar pixels
+* Usage       : ./HW2_kernels_bench [--sizes 256,1024] [--reps N] [--warmup N]
+*               [--only ccl,...] [--csv file] [--json file] [--label text] [--threads N]
+*********************************************************/
+
+// The OpenCV side of longest_axis, as in HW2_opencv: hull, then every pair of hull points
+static double cvLongestAxis(const std::vector<cv::Point>& points, std::vector<cv::Point>& hull)
+{
+    hull.clear();
+    if (!points.empty())
+        cv::convexHull(points, hull);
+    double maxDist = 0;
+    for (size_t i = 0; i < hull.size(); ++i)
+        for (size_t j = i + 1; j < hull.size(); ++j)
+            maxDist = std::max(maxDist, cv::norm(hull[i] - hull[j]));
+    return maxDist;
+}
+
+int main(int argc, char** argv)
+{
+    bench::Options opt;
+    try {
+        opt = bench::parseOptions(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\nUsage: " << argv[0]
+                  << " [--sizes 256,1024] [--reps N] [--warmup N] [--only kernel,...]"
+                     " [--csv file] [--json file] [--label text] [--threads N]\n"
+                  << "Kernels: threshold erode dilate mask_pipeline integral adaptive histogram otsu ccl longest_axis\n"
+                  << "         deinterleave interleave gray gray_threshold pipe_threshold rle_label rle_dilate\n";
+        return 1;
+    }
+    parallel::setThreads(opt.threads);
+    if (opt.threads > 0) cv::setNumThreads(opt.threads); // 0 would make OpenCV single-threaded
+    opt.threads = parallel::pool().size(); // recorded in the CSV / JSON
+
+    // task3: white when the average intensity is at least 110, 3x3 open, 7x7 dilation
+    const int threshold = 110;
+    const int small = 3;
+    const int large = small + 4;
+
+    try {
+        bench::Report report(opt, "HW2_kernels_bench");
+        imgproc::Morphology morph;
+        imgproc::MaskPipeline pipeline(threshold - 1, {
+            imgproc::MorphStep::erode(small, small),
+            imgproc::MorphStep::dilate(small, small),
+            imgproc::MorphStep::dilate(large, large),
+        });
+        const cv::Mat smallKernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(small, small));
+        const cv::Mat largeKernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(large, large));
+
+        for (int n : opt.sizes) {
+            const bmp::BMPImage img = bench::syntheticImage(n);
+            const bmp::BMPImageView view = bmp::viewOf(img);
+            const int reps = opt.repsFor(n);
+
+            // OpenCV thresholds the BT.601 gray value instead of the plain average,
+            // the work per pixel is the same
+            cv::Mat cvSrc(n, n, CV_8UC3, const_cast<uint8_t*>(img.data.data()), bmp::rowSizeBytes(n));
+            cv::Mat gray, cvMask, cvOut;
+            cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+            cv::threshold(gray, cvMask, threshold - 1, 255, cv::THRESH_BINARY);
+
+            imgproc::BinaryMask mask = imgproc::binarizeToMask(view, threshold - 1);
+            imgproc::BinaryMask out;
+
+            if (opt.wants("threshold")) {
+                report.add("threshold", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                    imgproc::binarizeToMask(view, threshold - 1, mask);
+                }));
+                report.add("threshold", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                    cv::threshold(gray, cvMask, threshold - 1, 255, cv::THRESH_BINARY);
+                }));
+            }
+
+            if (opt.wants("gray") || opt.wants("gray_threshold")) {
+                // the same fixed-point BT.601 weights as cvtColor, the same gray values
+                const imgproc::Grayscale bt601 = imgproc::Grayscale::bt601();
+                imgproc::GrayImage intensity;
+                if (opt.wants("gray")) {
+                    report.add("gray", "imgproc", n,
+                               bench::measure(opt.warmup, reps, [&] { imgproc::toGray(view, bt601, intensity); }));
+                    report.add("gray", "opencv", n,
+                               bench::measure(opt.warmup, reps, [&] { cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY); }));
+                }
+                if (opt.wants("gray_threshold")) {
+                    // gray image and mask out of one pass against cvtColor + threshold
+                    report.add("gray_threshold", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                        imgproc::binarizeToMask(view, bt601, threshold - 1, out, intensity);
+                    }));
+                    report.add("gray_threshold", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                        cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                        cv::threshold(gray, cvOut, threshold - 1, 255, cv::THRESH_BINARY);
+                    }));
+                }
+            }
+
+            if (opt.wants("pipe_threshold")) {
+                // the threshold kernel written as pipe(intensityAvg, threshold<109>(), toMask)
+                namespace ops = imgproc::ops;
+                report.add("pipe_threshold", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                    ops::run(view, ops::pipe(ops::intensityAvg, ops::threshold<threshold - 1>(), ops::toMask), out);
+                }));
+                report.add("pipe_threshold", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                    cv::threshold(gray, cvMask, threshold - 1, 255, cv::THRESH_BINARY);
+                }));
+            }
+
+            if (opt.wants("erode")) {
+                report.add("erode", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { morph.erode(mask, out, small, small); }));
+                report.add("erode", "opencv", n,
+                           bench::measure(opt.warmup, reps, [&] { cv::erode(cvMask, cvOut, smallKernel); }));
+            }
+
+            if (opt.wants("dilate")) {
+                report.add("dilate", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { morph.dilate(mask, out, large, large); }));
+                report.add("dilate", "opencv", n,
+                           bench::measure(opt.warmup, reps, [&] { cv::dilate(cvMask, cvOut, largeKernel); }));
+            }
+
+            if (opt.wants("mask_pipeline")) {
+                report.add("mask_pipeline", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { pipeline.run(view, out); }));
+                report.add("mask_pipeline", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                    cv::threshold(gray, cvMask, threshold - 1, 255, cv::THRESH_BINARY);
+                    cv::morphologyEx(cvMask, cvOut, cv::MORPH_OPEN, smallKernel);
+                    cv::dilate(cvOut, cvOut, largeKernel);
+                }));
+            }
+
+            if (opt.wants("integral")) {
+                // sums and sums of squares, 64-bit on both sides
+                imgproc::IntegralImage integral;
+                cv::Mat sum, squares;
+                report.add("integral", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { integral.build(view); }));
+                report.add("integral", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                    cv::integral(gray, sum, squares, CV_64F, CV_64F);
+                }));
+            }
+
+            if (opt.wants("adaptive")) {
+                // Bradley against OpenCV's box mean threshold (offset 0 instead of 15%)
+                const int window = std::max(3, n / 8) | 1;
+                imgproc::IntegralImage integral;
+                report.add("adaptive", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                    imgproc::adaptiveBinarizeToMask(view, imgproc::AdaptiveThreshold::bradley(window), integral, out);
+                }));
+                report.add("adaptive", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                    cv::adaptiveThreshold(gray, cvOut, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, window, 0);
+                }));
+            }
+
+            if (opt.wants("histogram")) {
+                imgproc::IntensityHistogram histogram;
+                cv::Mat cvHistogram;
+                const int channel = 0, bins = 256;
+                const float range[] = {0, 256};
+                const float* ranges[] = {range};
+                report.add("histogram", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { imgproc::intensityHistogram(view, histogram); }));
+                report.add("histogram", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                    cv::calcHist(&gray, 1, &channel, cv::Mat(), cvHistogram, 1, &bins, ranges);
+                }));
+            }
+
+            if (opt.wants("otsu")) {
+                // --threshold auto as HW2 runs it: one deinterleave, histogram and threshold on the planes
+                imgproc::LazyImage image;
+                imgproc::IntensityHistogram histogram;
+                imgproc::BinarizeKernel binarizer;
+                report.add("otsu", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                    image.assign(view);
+                    image.run(imgproc::HistogramKernel(), histogram);
+                    binarizer.threshold = imgproc::otsuThreshold(histogram);
+                    image.run(binarizer, out);
+                }));
+                report.add("otsu", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::cvtColor(cvSrc, gray, cv::COLOR_BGR2GRAY);
+                    cv::threshold(gray, cvOut, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+                }));
+            }
+
+            if (opt.wants("deinterleave") || opt.wants("interleave")) {
+                imgproc::PlanarImage planes = imgproc::deinterleave(view);
+                bmp::BMPImage back;
+                cv::Mat cvPlanes[3], cvBack;
+                cv::split(cvSrc, cvPlanes);
+                if (opt.wants("deinterleave")) {
+                    report.add("deinterleave", "imgproc", n,
+                               bench::measure(opt.warmup, reps, [&] { imgproc::deinterleave(view, planes); }));
+                    report.add("deinterleave", "opencv", n,
+                               bench::measure(opt.warmup, reps, [&] { cv::split(cvSrc, cvPlanes); }));
+                }
+                if (opt.wants("interleave")) {
+                    report.add("interleave", "imgproc", n,
+                               bench::measure(opt.warmup, reps, [&] { imgproc::interleave(planes, back); }));
+                    report.add("interleave", "opencv", n,
+                               bench::measure(opt.warmup, reps, [&] { cv::merge(cvPlanes, 3, cvBack); }));
+                }
+            }
+
+            // labelling and the axis run on the mask of the pipeline, as in task3
+            pipeline.run(view, mask);
+            cv::morphologyEx(cvMask, cvOut, cv::MORPH_OPEN, smallKernel);
+            cv::dilate(cvOut, cvMask, largeKernel);
+
+            if (opt.wants("ccl")) {
+                imgproc::ComponentLabels labels;
+                cv::Mat cvLabels, stats, centroids;
+                report.add("ccl", "imgproc", n, bench::measure(opt.warmup, reps, [&] {
+                    imgproc::labelComponentsParallel(mask, labels, 4);
+                }));
+                report.add("ccl", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                    cv::connectedComponentsWithStats(cvMask, cvLabels, stats, centroids, 4, CV_32S);
+                }));
+            }
+
+            if (opt.wants("rle_label") || opt.wants("rle_dilate")) {
+                // the same mask as runs, converted once outside the timing
+                const imgproc::RunMask runs(mask);
+                imgproc::RunMask runsOut;
+                imgproc::MaskLabels labels;
+                cv::Mat cvLabels, stats, centroids;
+                if (opt.wants("rle_label")) {
+                    report.add("rle_label", "imgproc", n,
+                               bench::measure(opt.warmup, reps, [&] { imgproc::labelMask(runs, labels, 4); }));
+                    report.add("rle_label", "opencv", n, bench::measure(opt.warmup, reps, [&] {
+                        cv::connectedComponentsWithStats(cvMask, cvLabels, stats, centroids, 4, CV_32S);
+                    }));
+                }
+                if (opt.wants("rle_dilate")) {
+                    report.add("rle_dilate", "imgproc", n,
+                               bench::measure(opt.warmup, reps, [&] { imgproc::dilate(runs, runsOut, large, large); }));
+                    report.add("rle_dilate", "opencv", n,
+                               bench::measure(opt.warmup, reps, [&] { cv::dilate(cvMask, cvOut, largeKernel); }));
+                }
+            }
+
+            if (opt.wants("longest_axis")) {
+                // both get the ends of every run of white pixels (only those can be on the hull)
+                std::vector<imgproc::GridPoint> points;
+                std::vector<cv::Point> cvPoints, hull;
+                for (int r = 0; r < mask.height(); ++r) {
+                    for (int c = mask.nextSet(r, 0); c < mask.width(); ) {
+                        const int end = mask.nextClear(r, c);
+                        points.emplace_back(r, c);
+                        cvPoints.emplace_back(c, r);
+                        if (end - 1 > c) {
+                            points.emplace_back(r, end - 1);
+                            cvPoints.emplace_back(end - 1, r);
+                        }
+                        c = mask.nextSet(r, end);
+                    }
+                }
+                imgproc::Diameter axis;
+                double cvAxis = 0;
+                report.add("longest_axis", "imgproc", n,
+                           bench::measure(opt.warmup, reps, [&] { axis = imgproc::pointSetDiameter(points); }));
+                report.add("longest_axis", "opencv", n,
+                           bench::measure(opt.warmup, reps, [&] { cvAxis = cvLongestAxis(cvPoints, hull); }));
+                if (std::fabs(axis.length - cvAxis) > 1e-9)
+                    std::cout << "warning: longest axis " << axis.length << " differs from OpenCV's "
+                              << cvAxis << " at size " << n << "\n";
+            }
+        }
+        report.write();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,267 @@
+#include "morphology.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "thread_pool.hpp"
+#include <algorithm> // for std::min, std::fill
+#include <cstring> // for std::memcpy
+#include <stdexcept>
+
+namespace imgproc {
+
+namespace {
+
+// Resize only when the shape changes, so scratch images are allocated once
+void ensureShape(BinaryMask& mask, int width, int height) {
+    if (mask.width() != width || mask.height() != height) mask = BinaryMask(width, height);
+}
+
+// 64 bits of `in` starting at bit q (q may be negative or past the end, those bits are 0)
+inline uint64_t fetch64(const uint64_t* in, int inWords, long long q) {
+    const long long lo = q >= 0 ? q / 64 : -((-q + 63) / 64); // floor(q / 64)
+    const int bit = static_cast<int>(q - lo * 64);
+    const uint64_t a = (lo >= 0 && lo < inWords) ? in[lo] : 0;
+    if (bit == 0) return a;
+    const uint64_t b = (lo + 1 >= 0 && lo + 1 < inWords) ? in[lo + 1] : 0;
+    return (a >> bit) | (b << (64 - bit));
+}
+
+// out = in shifted by s columns (s > 0: towards higher columns), 0 shifted in
+void shiftInto(uint64_t* out, int outWords, const uint64_t* in, int inWords, int s) {
+    for (int w = 0; w < outWords; ++w) {
+        out[w] = fetch64(in, inWords, 64LL * w - s);
+    }
+}
+
+} // namespace
+
+/*
+    Segmented scan masks for a row of `bits` bits cut into blocks of k (block b = [bk, bk + k)):
+    prefix step j (d = 2^j): bit c may take bit c - d  <=>  c % k >= d
+    suffix step j:          bit c may take bit c + d  <=>  c % k + d <= k - 1
+    preCarry[w]: bits of word w in a block that started in an earlier word
+    sufCarry[w]: bits of word w in a block that goes on into word w + 1
+*/
+void Morphology::prepareRowMasks(int bits, int k) {
+    if (bits == maskBits_ && k == maskK_) return;
+    const int words = (bits + 63) / 64;
+    const int steps = [k] { int n = 0; while ((1 << n) < std::min(k, 64)) ++n; return n; }();
+
+    preStep_.assign(static_cast<size_t>(steps) * words, 0);
+    sufStep_.assign(static_cast<size_t>(steps) * words, 0);
+    preCarry_.assign(words, 0);
+    sufCarry_.assign(words, 0);
+
+    for (int w = 0; w < words; ++w) {
+        for (int p = 0; p < 64; ++p) {
+            const long long c = 64LL * w + p;
+            const int phase = static_cast<int>(c % k);
+            const uint64_t bit = uint64_t(1) << p;
+            for (int j = 0; j < steps; ++j) {
+                const int d = 1 << j;
+                if (phase >= d) preStep_[static_cast<size_t>(j) * words + w] |= bit;
+                if (phase + d <= k - 1) sufStep_[static_cast<size_t>(j) * words + w] |= bit;
+            }
+            // same block as the last bit of the previous word / the first bit of the next word
+            if (w > 0 && c - phase < 64LL * w) preCarry_[w] |= bit;
+            if (w + 1 < words && c - phase + k > 64LL * (w + 1)) sufCarry_[w] |= bit;
+        }
+    }
+    maskBits_ = bits;
+    maskK_ = k;
+}
+
+Morphology::Scratch& Morphology::scratch(int band) {
+    if (static_cast<int>(scratch_.size()) <= band) scratch_.resize(band + 1);
+    return scratch_[band];
+}
+
+void Morphology::dilateRow(const uint64_t* in, uint64_t* out, int width, int k) {
+    dilateRow(in, out, width, k, scratch(0));
+}
+
+void Morphology::dilateRow(const uint64_t* in, uint64_t* out, int width, int k, Scratch& scratch) {
+    const int words = (width + 63) / 64;
+    if (k == 1) {
+        if (out != in) std::memcpy(out, in, words * sizeof(uint64_t));
+        return;
+    }
+
+    // padded row: ext bit t = in bit t - k/2, so the window of output c is ext [c, c + k - 1]
+    const int bits = width + k - 1;
+    const int extWords = (bits + 63) / 64;
+    prepareRowMasks(bits, k);
+    const int steps = static_cast<int>(preStep_.size() / extWords);
+    std::vector<uint64_t>& ext = scratch.ext;
+    std::vector<uint64_t>& pre = scratch.pre;
+    std::vector<uint64_t>& suf = scratch.suf;
+    ext.resize(extWords);
+    pre.resize(extWords);
+    suf.resize(extWords);
+    shiftInto(ext.data(), extWords, in, words, k / 2);
+
+    // block prefix OR: in-word segmented scan, then carry from the previous word
+    for (int w = 0; w < extWords; ++w) {
+        uint64_t x = ext[w];
+        for (int j = 0; j < steps; ++j) x |= (x << (1 << j)) & preStep_[static_cast<size_t>(j) * extWords + w];
+        if (w > 0 && (pre[w - 1] >> 63)) x |= preCarry_[w];
+        pre[w] = x;
+    }
+    // block suffix OR: same thing towards lower columns, carry from the next word
+    for (int w = extWords - 1; w >= 0; --w) {
+        uint64_t x = ext[w];
+        for (int j = 0; j < steps; ++j) x |= (x >> (1 << j)) & sufStep_[static_cast<size_t>(j) * extWords + w];
+        if (w + 1 < extWords && (suf[w + 1] & 1)) x |= sufCarry_[w];
+        suf[w] = x;
+    }
+
+    // out[c] = suf[c] | pre[c + k - 1]
+    shiftInto(out, words, pre.data(), extWords, -(k - 1));
+    for (int w = 0; w < words; ++w) out[w] |= suf[w];
+    const int used = width & 63;
+    if (used) out[words - 1] &= (uint64_t(1) << used) - 1;
+}
+
+void Morphology::erodeRow(const uint64_t* in, uint64_t* out, int width, int k) {
+    const int words = (width + 63) / 64;
+    const int used = width & 63;
+    const uint64_t last = used ? (uint64_t(1) << used) - 1 : ~uint64_t(0);
+    std::vector<uint64_t>& inverse = scratch(0).inverseRow;
+    inverse.resize(words);
+    for (int w = 0; w < words; ++w) inverse[w] = ~in[w];
+    inverse[words - 1] &= last;
+    dilateRow(inverse.data(), out, width, k);
+    for (int w = 0; w < words; ++w) out[w] = ~out[w];
+    out[words - 1] &= last;
+}
+
+void Morphology::rowPass(const BinaryMask& src, BinaryMask& dst, int k) {
+    ensureShape(dst, src.width(), src.height());
+    if (k > 1) prepareRowMasks(src.width() + k - 1, k); // shared by the bands, read only from here on
+    const int bands = parallel::pool().bands(src.height(), parallel::kMinRowsPerBand);
+    for (int b = 0; b < bands; ++b) scratch(b);
+    parallel::parallelBands(src.height(), parallel::kMinRowsPerBand, [&](int band, int begin, int end) {
+        for (int r = begin; r < end; ++r) dilateRow(src.row(r), dst.row(r), src.width(), k, scratch_[band]);
+    });
+}
+
+void Morphology::columnPass(const BinaryMask& src, BinaryMask& dst, int k) {
+    const int height = src.height();
+    const int words = src.wordsPerRow();
+    ensureShape(dst, src.width(), height);
+    if (k == 1) {
+        for (int r = 0; r < height; ++r) std::memcpy(dst.row(r), src.row(r), words * sizeof(uint64_t));
+        return;
+    }
+
+    // bands much shorter than k would mostly recompute the blocks of their neighbours
+    const int grain = std::max(parallel::kMinRowsPerBand, k);
+    const int bands = parallel::pool().bands(height, grain);
+    for (int b = 0; b < bands; ++b) scratch(b);
+    // a window reaches k / 2 rows up and k - 1 - k / 2 <= k / 2 rows down
+    parallel::parallelBandsHalo(height, grain, k / 2, [&](int band, int begin, int end, int lo, int hi) {
+        columnBand(src, dst, k, begin, end, lo, hi, scratch_[band]);
+    });
+}
+
+// Output rows [begin, end) of the column pass
+/*
+    padded rows: ext row t = src row t - k/2 (0 outside), the window of output r is
+    ext [r, r + k - 1], blocks of k padded rows start at multiples of k
+    g (prefix OR) is needed at t = begin + k - 1 .. end + k - 2: from the start of the block of begin + k - 1
+    h (suffix OR) is needed at t = begin .. end - 1: up to the end of the block of end - 1
+    so a band gives the same g and h as a pass over the whole image; the src rows this
+    touches are [begin - k/2, end + k - 1 - k/2), all inside the halo [lo, hi)
+*/
+void Morphology::columnBand(const BinaryMask& src, BinaryMask& dst, int k, int begin, int end, int lo, int hi,
+                            Scratch& scratch) {
+    const int height = src.height();
+    const int words = src.wordsPerRow();
+    const int rows = height + k - 1;
+    const int top = k / 2;
+    auto extRow = [&](int t) -> const uint64_t* {
+        const int r = t - top;
+        return (r >= lo && r < hi) ? src.row(r) : nullptr; // lo, hi are clipped to the image
+    };
+
+    const int gBegin = (begin + k - 1) / k * k;
+    const int gEnd = end + k - 1;
+    const int hBegin = begin;
+    const int hEnd = std::min(rows, ((end - 1) / k + 1) * k);
+    std::vector<uint64_t>& colPre = scratch.colPre;
+    std::vector<uint64_t>& colSuf = scratch.colSuf;
+    colPre.resize(static_cast<size_t>(gEnd - gBegin) * words);
+    colSuf.resize(static_cast<size_t>(hEnd - hBegin) * words);
+
+    for (int t = gBegin; t < gEnd; ++t) {
+        const uint64_t* in = extRow(t);
+        uint64_t* g = &colPre[static_cast<size_t>(t - gBegin) * words];
+        if (t % k == 0) {
+            // first row of a block
+            if (in) std::memcpy(g, in, words * sizeof(uint64_t));
+            else std::fill(g, g + words, 0);
+        } else {
+            const uint64_t* prev = g - words;
+            if (in) for (int w = 0; w < words; ++w) g[w] = prev[w] | in[w];
+            else std::memcpy(g, prev, words * sizeof(uint64_t));
+        }
+    }
+    for (int t = hEnd - 1; t >= hBegin; --t) {
+        const uint64_t* in = extRow(t);
+        uint64_t* h = &colSuf[static_cast<size_t>(t - hBegin) * words];
+        if (t == rows - 1 || (t + 1) % k == 0) {
+            // last row of a block
+            if (in) std::memcpy(h, in, words * sizeof(uint64_t));
+            else std::fill(h, h + words, 0);
+        } else {
+            const uint64_t* next = h + words;
+            if (in) for (int w = 0; w < words; ++w) h[w] = next[w] | in[w];
+            else std::memcpy(h, next, words * sizeof(uint64_t));
+        }
+    }
+
+    for (int r = begin; r < end; ++r) {
+        const uint64_t* h = &colSuf[static_cast<size_t>(r - hBegin) * words];
+        const uint64_t* g = &colPre[static_cast<size_t>(r + k - 1 - gBegin) * words];
+        uint64_t* out = dst.row(r);
+        for (int w = 0; w < words; ++w) out[w] = h[w] | g[w];
+    }
+}
+
+void Morphology::dilate(const BinaryMask& src, BinaryMask& dst, int kw, int kh) {
+    TRACE_SPAN("imgproc: dilate");
+    if (kw < 1 || kh < 1) {
+        throw std::invalid_argument("Morphology: kernel size must be at least 1");
+    }
+    rowPass(src, rows_, kw);
+    columnPass(rows_, dst, kh);
+}
+
+void Morphology::erode(const BinaryMask& src, BinaryMask& dst, int kw, int kh) {
+    TRACE_SPAN("imgproc: erode");
+    // erosion of the 1s = dilation of the 0s; outside pixels stay 0 in the complement
+    inverse_ = src; // reuses inverse_'s buffer when the size is unchanged
+    inverse_.invert();
+    dilate(inverse_, dst, kw, kh);
+    dst.invert();
+}
+
+void Morphology::open(const BinaryMask& src, BinaryMask& dst, int kw, int kh) {
+    erode(src, first_, kw, kh);
+    dilate(first_, dst, kw, kh);
+}
+
+void Morphology::close(const BinaryMask& src, BinaryMask& dst, int kw, int kh) {
+    dilate(src, first_, kw, kh);
+    erode(first_, dst, kw, kh);
+}
+
+void Morphology::gradient(const BinaryMask& src, BinaryMask& dst, int kw, int kh) {
+    dilate(src, first_, kw, kh);
+    erode(src, dst, kw, kh);
+    for (int r = 0; r < dst.height(); ++r) {
+        const uint64_t* d = first_.row(r);
+        uint64_t* e = dst.row(r);
+        for (int w = 0; w < dst.wordsPerRow(); ++w) e[w] = d[w] & ~e[w];
+    }
+}
+
+} // namespace imgproc
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "binary_mask.hpp" // imgproc::BinaryMask
+
+namespace imgproc {
+
+// Binary morphology with rectangular kw x kh structuring elements
+/*
+    The rectangle is split into a row pass (1 x kw) and a column pass (kh x 1), and each
+    pass is a running OR computed with the van Herk / Gil-Werman scheme:
+
+    cut the line into blocks of K, keep the prefix OR g and the suffix OR h of every block,
+    then any window of K pixels covers the end of one block and the start of the next:
+        window [t, t + K - 1]  =  h[t] | g[t + K - 1]
+    3 operations per position whatever K is
+
+    column pass: t runs over rows, and g, h are whole rows of words (64 pixels per OR)
+    row pass:    t runs over the bits of a row; the block prefix/suffix inside a word is a
+                 segmented scan of at most 6 shift steps (1, 2, 4 .. 32) plus a carry
+                 between words, so this is also independent of K
+
+    The anchor is the center (K / 2), pixels outside the image never turn a pixel on
+    (dilation) and never turn one off (erosion = dilation of the complement)
+
+    Both passes run in bands of rows on the thread pool (the column pass reads the k - 1
+    rows around its band), every band has its own scratch rows
+
+    The object keeps its scratch buffers, so running the same Morphology on images of
+    the same size does not allocate; dst may be the same object as src
+*/
+class Morphology {
+public:
+    void dilate(const BinaryMask& src, BinaryMask& dst, int kw, int kh);
+    void erode(const BinaryMask& src, BinaryMask& dst, int kw, int kh);
+
+    void open(const BinaryMask& src, BinaryMask& dst, int kw, int kh);     // erode, then dilate
+    void close(const BinaryMask& src, BinaryMask& dst, int kw, int kh);    // dilate, then erode
+    void gradient(const BinaryMask& src, BinaryMask& dst, int kw, int kh); // dilate AND NOT erode
+
+    // 1 x k dilation/erosion of a single row of `width` bits (BinaryMask row layout),
+    // in and out may be the same row
+    void dilateRow(const uint64_t* in, uint64_t* out, int width, int k);
+    void erodeRow(const uint64_t* in, uint64_t* out, int width, int k);
+
+private:
+    // Scratch rows of one band of the thread pool
+    struct Scratch {
+        std::vector<uint64_t> ext, pre, suf; // one padded row for the row pass
+        std::vector<uint64_t> inverseRow;    // complement of the row for erodeRow
+        std::vector<uint64_t> colPre, colSuf; // padded rows for the column pass
+    };
+
+    void rowPass(const BinaryMask& src, BinaryMask& dst, int k);
+    void columnPass(const BinaryMask& src, BinaryMask& dst, int k);
+    void columnBand(const BinaryMask& src, BinaryMask& dst, int k, int begin, int end, int lo, int hi,
+                    Scratch& scratch);
+    void prepareRowMasks(int bits, int k);
+    void dilateRow(const uint64_t* in, uint64_t* out, int width, int k, Scratch& scratch);
+    Scratch& scratch(int band);
+
+    BinaryMask rows_, inverse_, first_; // intermediate images
+    std::vector<Scratch> scratch_;      // one per band
+
+    // per-word masks of the row pass segmented scan, valid for (maskBits_, maskK_)
+    int maskBits_ = -1, maskK_ = -1;
+    std::vector<uint64_t> preStep_, sufStep_; // [step * words + w]
+    std::vector<uint64_t> preCarry_, sufCarry_; // [w]
+};
+
+// Square k x k dilation/erosion (k odd) with a throwaway Morphology
+inline void dilateMask(const BinaryMask& src, BinaryMask& dst, int kernelSize) {
+    Morphology().dilate(src, dst, kernelSize, kernelSize);
+}
+
+inline void erodeMask(const BinaryMask& src, BinaryMask& dst, int kernelSize) {
+    Morphology().erode(src, dst, kernelSize, kernelSize);
+}
+
+} // namespace imgproc
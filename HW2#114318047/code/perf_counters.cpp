@@ -0,0 +1,214 @@
+#include "perf_counters.hpp"
+#include <chrono>
+#include <cstring> // for std::strcmp, std::memset, std::strerror
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perf {
+
+namespace {
+
+// Bytes per LLC miss: one cache line comes from memory
+const int kCacheLine = 64;
+
+const char* const kCounterNames[kCounters] = {"cycles", "instructions", "L1D misses", "LLC misses",
+                                              "branch misses", "task clock"};
+
+struct StageTotals {
+    const char* name;
+    uint64_t calls = 0;
+    uint64_t pixels = 0;
+    double values[kCounters] = {};
+    bool open[kCounters] = {};
+    double wallNs = 0;
+};
+
+bool isEnabled = false;
+int fds[kCounters] = {-1, -1, -1, -1, -1, -1};
+std::string openStatus = "counters not enabled";
+
+std::mutex reportMutex;
+std::vector<StageTotals> stages; // in order of first use
+
+int64_t wallNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef __linux__
+
+// type and config of a Counter
+void describe(Counter c, perf_event_attr& attr) {
+    switch (c) {
+        case Cycles: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case Instructions: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case L1DMisses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case LLCMisses: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+        case BranchMisses: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        default: attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_TASK_CLOCK; break;
+    }
+}
+
+// fd of one counter, -1 and the reason in error when the kernel refuses it
+int openCounter(Counter c, std::string& error) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    describe(c, attr);
+    attr.exclude_kernel = 1; // allowed up to perf_event_paranoid = 2
+    attr.exclude_hv = 1;
+    attr.inherit = 1; // threads started later count too (not with PERF_FORMAT_GROUP, so no group)
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) error = std::strerror(errno);
+    return static_cast<int>(fd);
+}
+
+#endif
+
+} // namespace
+
+bool enable() {
+    isEnabled = true;
+    int opened = 0;
+#ifdef __linux__
+    std::string open;
+    std::map<std::string, std::string> closed; // counters the kernel refused, per reason
+    for (int c = 0; c < kCounters; ++c) {
+        if (fds[c] < 0) {
+            std::string error;
+            fds[c] = openCounter(static_cast<Counter>(c), error);
+            if (fds[c] < 0) closed[error] += std::string(closed[error].empty() ? "" : ", ") + kCounterNames[c];
+        }
+        if (fds[c] >= 0) {
+            open += std::string(open.empty() ? "" : ", ") + kCounterNames[c];
+            ++opened;
+        }
+    }
+    openStatus = "counters: " + (open.empty() ? "none, wall time only" : open);
+    for (const auto& reason : closed) openStatus += "; not available (" + reason.first + "): " + reason.second;
+    if (!closed.empty()) openStatus += " (no PMU, or see /proc/sys/kernel/perf_event_paranoid)";
+#else
+    openStatus = "counters: none (perf_event_open is Linux only), wall time only";
+#endif
+    return opened > 0;
+}
+
+bool enabled() { return isEnabled; }
+
+std::string status() { return openStatus; }
+
+Reading read() {
+    Reading r;
+    for (int c = 0; c < kCounters; ++c) {
+        r.values[c] = -1;
+#ifdef __linux__
+        uint64_t data[3]; // value, time enabled, time running
+        if (fds[c] < 0 || ::read(fds[c], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) continue;
+        // multiplexed: the counter only ran part of the time, extrapolate
+        r.values[c] = data[2] > 0 && data[2] < data[1]
+            ? static_cast<int64_t>(static_cast<double>(data[0]) * data[1] / data[2])
+            : static_cast<int64_t>(data[0]);
+#endif
+    }
+    r.wallNs = wallNow();
+    return r;
+}
+
+Stage::Stage(const char* name, uint64_t pixels) : name_(name), pixels_(pixels), running_(isEnabled) {
+    if (running_) start_ = read();
+}
+
+void Stage::end() {
+    if (!running_) return;
+    running_ = false;
+    const Reading stop = read();
+
+    std::lock_guard<std::mutex> lock(reportMutex);
+    StageTotals* totals = nullptr;
+    for (StageTotals& s : stages) {
+        if (std::strcmp(s.name, name_) == 0) totals = &s;
+    }
+    if (!totals) {
+        stages.emplace_back();
+        totals = &stages.back();
+        totals->name = name_;
+        for (int c = 0; c < kCounters; ++c) totals->open[c] = true;
+    }
+    ++totals->calls;
+    totals->pixels += pixels_;
+    totals->wallNs += static_cast<double>(stop.wallNs - start_.wallNs);
+    for (int c = 0; c < kCounters; ++c) {
+        if (start_.values[c] < 0 || stop.values[c] < 0) totals->open[c] = false;
+        else totals->values[c] += static_cast<double>(stop.values[c] - start_.values[c]);
+    }
+}
+
+void printReport(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(reportMutex);
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+
+    out << "Performance counters (user space, all threads; " << openStatus << ")\n"
+        << std::left << std::setw(44) << " stage" << std::right << std::setw(6) << "calls" << std::setw(10)
+        << "wall ms" << std::setw(10) << "CPU ms" << std::setw(10) << "cyc/px" << std::setw(10) << "ins/px"
+        << std::setw(7) << "IPC" << std::setw(10) << "L1D/px" << std::setw(10) << "LLC/px" << std::setw(11)
+        << "DRAM B/px" << std::setw(10) << "brmis/px" << "\n";
+
+    for (const StageTotals& s : stages) {
+        const double pixels = s.pixels > 0 ? static_cast<double>(s.pixels) : 1.0;
+        // one column: value / divisor, or "-" when a counter it needs is not open
+        auto column = [&](int width, int digits, bool open, double value) {
+            out << std::setw(width);
+            if (open) out << std::setprecision(digits) << value;
+            else out << "-";
+        };
+        out << std::left << std::setw(44) << " " + std::string(s.name) << std::right << std::setw(6) << s.calls
+            << std::fixed;
+        column(10, 3, true, s.wallNs / 1e6);
+        column(10, 3, s.open[TaskClock], s.values[TaskClock] / 1e6);
+        column(10, 2, s.open[Cycles], s.values[Cycles] / pixels);
+        column(10, 2, s.open[Instructions], s.values[Instructions] / pixels);
+        column(7, 2, s.open[Cycles] && s.open[Instructions] && s.values[Cycles] > 0,
+               s.values[Instructions] / (s.values[Cycles] > 0 ? s.values[Cycles] : 1));
+        column(10, 4, s.open[L1DMisses], s.values[L1DMisses] / pixels);
+        column(10, 4, s.open[LLCMisses], s.values[LLCMisses] / pixels);
+        column(11, 2, s.open[LLCMisses], s.values[LLCMisses] * kCacheLine / pixels);
+        column(10, 4, s.open[BranchMisses], s.values[BranchMisses] / pixels);
+        out << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void clearReport() {
+    std::lock_guard<std::mutex> lock(reportMutex);
+    stages.clear();
+}
+
+void takeCountersOption(int& argc, char** argv) {
+    int kept = 1;
+    bool requested = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--counters") == 0) requested = true;
+        else argv[kept++] = argv[i];
+    }
+    argc = kept;
+    argv[argc] = nullptr;
+    if (requested) enable();
+}
+
+} // namespace perf
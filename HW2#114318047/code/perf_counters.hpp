@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/********************************************************
+* Filename    : perf_counters.hpp
+* Note        : Hardware performance counters (Linux perf_event_open) around
+*               named stages, reported per pixel; wall time only where the
+*               counters cannot be opened
+*********************************************************/
+
+namespace perf {
+
+// The counters of a stage, in the order of the report
+enum Counter { Cycles, Instructions, L1DMisses, LLCMisses, BranchMisses, TaskClock, kCounters };
+
+// Counter totals of the process at one moment; a value < 0: that counter is not open
+struct Reading {
+    int64_t values[kCounters];
+    int64_t wallNs;
+};
+
+// Open the counters of this process: user-space events of the calling thread and of every
+// thread it starts afterwards (the thread pool starts on first use, so call it before any
+// kernel runs). Counters the kernel refuses (no PMU, perf_event_paranoid, not Linux) stay
+// closed; the stages still measure wall time. Returns false when no counter could be opened
+bool enable();
+
+// True after enable(), whether any counter is open or not
+bool enabled();
+
+// Which counters are open, and why the others are not
+std::string status();
+
+// The current totals (scaled up when the kernel multiplexed a counter)
+Reading read();
+
+// Counter deltas of a named stage, added to the report under its name
+/*
+    perf::Stage stage("Stage 3 (labelling)", pixels); ... stage.end();
+    The counters are per process, not per stage: a stage counts everything every thread
+    does between construction and end(), so the stages of a report must not overlap.
+    Does nothing until enable().
+*/
+class Stage {
+public:
+    Stage(const char* name, uint64_t pixels);
+    ~Stage() { end(); }
+
+    Stage(const Stage&) = delete;
+    Stage& operator=(const Stage&) = delete;
+
+    void end();
+
+private:
+    const char* name_; // a string literal, as for trace spans
+    uint64_t pixels_;
+    Reading start_;
+    bool running_;
+};
+
+// The stages since the last clearReport(), in order of first use: calls, wall and CPU time,
+// cycles, instructions, IPC, L1D / LLC / branch misses per pixel and the DRAM traffic in bytes
+// per pixel (LLC misses * 64 byte lines); "-" for a counter that is not open
+void printReport(std::ostream& out);
+void clearReport();
+
+// Take "--counters" out of the command line and enable()
+void takeCountersOption(int& argc, char** argv);
+
+} // namespace perf
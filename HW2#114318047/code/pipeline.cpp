@@ -0,0 +1,116 @@
+#include "pipeline.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "thread_pool.hpp"
+#include <algorithm> // for std::min, std::max
+#include <cstring> // for std::memcpy
+#include <stdexcept>
+#include <utility> // for std::move
+
+namespace imgproc {
+
+namespace {
+
+// Every band keeps a ring of rows per morphology step and also computes the halo rows of
+// its neighbours, so a band needs more rows than the default grain to pay for that
+const int kMinRowsPerPipelineBand = 32;
+
+} // namespace
+
+MaskPipeline::MaskPipeline(int threshold, std::vector<MorphStep> steps)
+    : threshold_(threshold), steps_(std::move(steps)) {
+    for (const MorphStep& step : steps_) {
+        if (step.kw < 1 || step.kh < 1) {
+            throw std::invalid_argument("MaskPipeline: kernel size must be at least 1");
+        }
+        halo_ += step.kh / 2;
+    }
+}
+
+void MaskPipeline::run(const bmp::BMPImageView& img, BinaryMask& out) {
+    TRACE_SPAN("imgproc: mask pipeline");
+    if (out.width() != img.width || out.height() != img.height) out = BinaryMask(img.width, img.height);
+    out_ = &out;
+    width_ = img.width;
+    words_ = out.wordsPerRow();
+
+    // the halo rows are streamed by two bands, keep them a small part of a band
+    const int grain = std::max(kMinRowsPerPipelineBand, 4 * halo_);
+    parallel::ThreadPool& threads = parallel::pool();
+    const int n = threads.bands(img.height, grain);
+    if (static_cast<int>(bands_.size()) < n) bands_.resize(n);
+    for (int b = 0; b < n; ++b) {
+        Band& band = bands_[b];
+        band.input.resize(words_);
+        band.stages.resize(steps_.size());
+        for (size_t s = 0; s < steps_.size(); ++s) {
+            Stage& st = band.stages[s];
+            st.step = steps_[s];
+            st.ring.resize(static_cast<size_t>(st.step.kh) * words_);
+            st.line.resize(words_);
+        }
+    }
+
+    threads.parallelBandsHalo(img.height, grain, halo_, [&](int b, int begin, int end, int lo, int hi) {
+        Band& band = bands_[b];
+        band.begin = begin;
+        band.end = end;
+        band.lo = lo;
+        band.hi = hi;
+        runBand(img, band);
+    });
+    out_ = nullptr;
+}
+
+void MaskPipeline::runBand(const bmp::BMPImageView& img, Band& band) {
+    if (band.stages.empty()) {
+        for (int r = band.begin; r < band.end; ++r) binarizeRow(img.row(r), width_, threshold_, out_->row(r));
+        return;
+    }
+    for (Stage& st : band.stages) st.next = band.lo;
+    for (int r = band.lo; r < band.hi; ++r) {
+        binarizeRow(img.row(r), width_, threshold_, band.input.data());
+        push(band, 0, r, band.input.data());
+    }
+}
+
+// Row r arrives at stage s
+void MaskPipeline::push(Band& band, size_t s, int r, const uint64_t* row) {
+    Stage& st = band.stages[s];
+    const int kh = st.step.kh;
+    uint64_t* slot = &st.ring[static_cast<size_t>(r % kh) * words_];
+    if (st.step.op == MorphStep::Dilate) st.rows.dilateRow(row, slot, width_, st.step.kw);
+    else st.rows.erodeRow(row, slot, width_, st.step.kw);
+
+    // every output row whose window ends at r (or at the last row) is complete; the slot
+    // just overwritten held row r - kh, which only windows ending before r needed
+    while (st.next < band.hi && std::min(st.next - kh / 2 + kh - 1, band.hi - 1) <= r) {
+        emit(band, s, st.next++);
+    }
+}
+
+// Output row r of stage s: OR / AND of its window, then on to the next stage
+/*
+    rows of the window outside [lo, hi) are left out as if they were outside the image;
+    that is only wrong when lo, hi are band edges and not image edges, and the error
+    moves at most kh/2 rows inwards per step, so it stays in the halo
+*/
+void MaskPipeline::emit(Band& band, size_t s, int r) {
+    Stage& st = band.stages[s];
+    const int kh = st.step.kh;
+    const bool last = s + 1 == band.stages.size();
+    if (last && (r < band.begin || r >= band.end)) return; // halo row, written by another band
+
+    const int lo = std::max(band.lo, r - kh / 2);
+    const int hi = std::min(band.hi - 1, r - kh / 2 + kh - 1);
+    uint64_t* dst = last ? out_->row(r) : st.line.data();
+
+    std::memcpy(dst, &st.ring[static_cast<size_t>(lo % kh) * words_], words_ * sizeof(uint64_t));
+    for (int t = lo + 1; t <= hi; ++t) {
+        const uint64_t* in = &st.ring[static_cast<size_t>(t % kh) * words_];
+        if (st.step.op == MorphStep::Dilate) for (int w = 0; w < words_; ++w) dst[w] |= in[w];
+        else for (int w = 0; w < words_; ++w) dst[w] &= in[w];
+    }
+    if (!last) push(band, s + 1, r, dst);
+}
+
+} // namespace imgproc
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImageView
+#include "binary_mask.hpp" // imgproc::BinaryMask
+#include "morphology.hpp" // imgproc::Morphology
+
+namespace imgproc {
+
+// One morphological step of a MaskPipeline, kw x kh rectangle centered on the pixel
+struct MorphStep {
+    enum Op { Erode, Dilate };
+    Op op;
+    int kw;
+    int kh;
+
+    static MorphStep erode(int kw, int kh) { return MorphStep{Erode, kw, kh}; }
+    static MorphStep dilate(int kw, int kh) { return MorphStep{Dilate, kw, kh}; }
+};
+
+// Threshold followed by erode/dilate steps, fused and streamed row by row
+/*
+    Same mask as binarizeToMask + Morphology, bit for bit, without the full-size
+    intermediate masks: every input row is read once, thresholded and pushed through
+    the steps, and every mask row is written once.
+
+    A step keeps a circular line buffer of kh rows. An incoming row gets the 1 x kw
+    pass at once (Morphology::dilateRow / erodeRow) and goes into the ring; output row
+    r leaves as soon as the last row of its window [r - kh/2, r - kh/2 + kh - 1]
+    has arrived (OR of the window for dilation, AND for erosion, rows outside the
+    image are left out), and is pushed into the next step
+
+        input row --> threshold --> step 1 ring (kh1 rows) --> step 2 ring --> ... --> mask row
+
+    The rows are cut into bands on the thread pool. A band streams its rows plus the
+    sum of kh/2 over the steps on both sides (the rows its windows can reach), with its
+    own rings, and writes only its own rows, so the mask does not depend on the number
+    of threads
+
+    Memory: one row per step plus kh rows per step and band, reused by every run()
+*/
+class MaskPipeline {
+public:
+    // threshold as binarizeToMask
+    MaskPipeline(int threshold, std::vector<MorphStep> steps);
+
+    void run(const bmp::BMPImageView& img, BinaryMask& out);
+
+private:
+    struct Stage {
+        MorphStep step;
+        Morphology rows;            // 1 x kw pass, keeps its scratch rows
+        std::vector<uint64_t> ring; // kh rows after the 1 x kw pass, row r in slot r % kh
+        std::vector<uint64_t> line; // output row handed to the next stage
+        int next = 0;               // next output row
+    };
+
+    // One band of rows: writes [begin, end), streams [lo, hi) as if it were the whole image
+    struct Band {
+        std::vector<Stage> stages;
+        std::vector<uint64_t> input; // thresholded input row
+        int begin = 0, end = 0, lo = 0, hi = 0;
+    };
+
+    void runBand(const bmp::BMPImageView& img, Band& band);
+    void push(Band& band, size_t s, int r, const uint64_t* row);
+    void emit(Band& band, size_t s, int r);
+
+    int threshold_;
+    std::vector<MorphStep> steps_;
+    int halo_ = 0;             // sum of kh/2 over the steps
+    std::vector<Band> bands_;  // one per band of the thread pool
+    BinaryMask* out_ = nullptr;
+    int width_ = 0, words_ = 0;
+};
+
+} // namespace imgproc
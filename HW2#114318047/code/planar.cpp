@@ -0,0 +1,230 @@
+#include "planar.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include "cpu_features.hpp"
+#include "thread_pool.hpp"
+#include <cstring> // for std::memcpy, std::memset
+#include <stdexcept>
+#include <utility> // for std::move
+
+#if ACV_X86
+#include <immintrin.h>
+#endif
+
+namespace imgproc {
+
+namespace {
+
+const size_t kAlignment = 64;
+
+#if ACV_X86
+
+// pshufb controls between 16 interleaved pixels (48 bytes in 3 vectors) and their planes
+struct ShuffleMasks {
+    alignas(16) int8_t split[3][3][16]; // [channel][vector]: bytes of the channel found in the vector
+    alignas(16) int8_t merge[3][3][16]; // [vector][channel]: bytes of the vector taken from the channel
+    ShuffleMasks() {
+        for (int v = 0; v < 3; ++v) {
+            for (int i = 0; i < 16; ++i) {
+                for (int ch = 0; ch < 3; ++ch) {
+                    const int src = 3 * i + ch; // interleaved byte of pixel i, channel ch
+                    split[ch][v][i] = src / 16 == v ? static_cast<int8_t>(src % 16) : static_cast<int8_t>(-128);
+                    const int dst = 16 * v + i; // interleaved byte i of vector v
+                    merge[v][ch][i] = dst % 3 == ch ? static_cast<int8_t>(dst / 3) : static_cast<int8_t>(-128);
+                }
+            }
+        }
+    }
+};
+
+const ShuffleMasks& shuffleMasks() {
+    static const ShuffleMasks masks;
+    return masks;
+}
+
+ACV_TARGET("ssse3")
+inline __m128i shuffle3(__m128i a, __m128i b, __m128i c, const int8_t (*mask)[16]) {
+    const __m128i* m = reinterpret_cast<const __m128i*>(mask);
+    return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, _mm_load_si128(m)),
+                                     _mm_shuffle_epi8(b, _mm_load_si128(m + 1))),
+                        _mm_shuffle_epi8(c, _mm_load_si128(m + 2)));
+}
+
+// 16 pixels per step, returns the first column not converted
+ACV_TARGET("ssse3")
+int deinterleaveRowSSSE3(const uint8_t* px, int width, uint8_t* b, uint8_t* g, uint8_t* r) {
+    const ShuffleMasks& masks = shuffleMasks();
+    int c = 0;
+    for (; c + 16 <= width; c += 16) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(px + c * 3);
+        const __m128i v0 = _mm_loadu_si128(p);
+        const __m128i v1 = _mm_loadu_si128(p + 1);
+        const __m128i v2 = _mm_loadu_si128(p + 2);
+        _mm_store_si128(reinterpret_cast<__m128i*>(b + c), shuffle3(v0, v1, v2, masks.split[0]));
+        _mm_store_si128(reinterpret_cast<__m128i*>(g + c), shuffle3(v0, v1, v2, masks.split[1]));
+        _mm_store_si128(reinterpret_cast<__m128i*>(r + c), shuffle3(v0, v1, v2, masks.split[2]));
+    }
+    return c;
+}
+
+ACV_TARGET("ssse3")
+int interleaveRowSSSE3(const uint8_t* b, const uint8_t* g, const uint8_t* r, int width, uint8_t* px) {
+    const ShuffleMasks& masks = shuffleMasks();
+    int c = 0;
+    for (; c + 16 <= width; c += 16) {
+        const __m128i vb = _mm_load_si128(reinterpret_cast<const __m128i*>(b + c));
+        const __m128i vg = _mm_load_si128(reinterpret_cast<const __m128i*>(g + c));
+        const __m128i vr = _mm_load_si128(reinterpret_cast<const __m128i*>(r + c));
+        __m128i* p = reinterpret_cast<__m128i*>(px + c * 3);
+        _mm_storeu_si128(p, shuffle3(vb, vg, vr, masks.merge[0]));
+        _mm_storeu_si128(p + 1, shuffle3(vb, vg, vr, masks.merge[1]));
+        _mm_storeu_si128(p + 2, shuffle3(vb, vg, vr, masks.merge[2]));
+    }
+    return c;
+}
+
+#endif
+
+} // namespace
+
+PlanarImage::PlanarImage(int width, int height) { resize(width, height); }
+
+PlanarImage::PlanarImage(const PlanarImage& other) { *this = other; }
+
+PlanarImage& PlanarImage::operator=(const PlanarImage& other) {
+    if (this == &other) return *this;
+    resize(other.width_, other.height_);
+    // the other image's buffer may sit at another offset from its alignment: copy the planes
+    if (width_ > 0) std::memcpy(base(), other.base(), 3 * stride_ * height_);
+    for (int i = 0; i < 3; ++i) planeOf_[i] = other.planeOf_[i];
+    return *this;
+}
+
+void PlanarImage::resize(int width, int height) {
+    if (width < 0 || height < 0) {
+        throw std::invalid_argument("PlanarImage: size must not be negative");
+    }
+    width_ = width;
+    height_ = height;
+    stride_ = (static_cast<size_t>(width) + kAlignment - 1) / kAlignment * kAlignment;
+    for (int i = 0; i < 3; ++i) planeOf_[i] = i;
+    const size_t bytes = 3 * stride_ * height + kAlignment - 1;
+    if (storage_.size() < bytes) storage_.resize(bytes);
+    const uintptr_t address = reinterpret_cast<uintptr_t>(storage_.data());
+    offset_ = (kAlignment - address % kAlignment) % kAlignment;
+}
+
+void PlanarImage::permutePlanes(const int (&order)[3]) {
+    bool used[3] = {false, false, false};
+    for (int i = 0; i < 3; ++i) {
+        if (order[i] < 0 || order[i] > 2 || used[order[i]]) {
+            throw std::invalid_argument("permutePlanes: order must be a permutation of 0, 1, 2");
+        }
+        used[order[i]] = true;
+    }
+    const int old[3] = {planeOf_[0], planeOf_[1], planeOf_[2]};
+    for (int i = 0; i < 3; ++i) planeOf_[i] = old[order[i]];
+}
+
+void deinterleaveRow(const uint8_t* px, int width, uint8_t* b, uint8_t* g, uint8_t* r) {
+    int c = 0;
+#if ACV_X86
+    if (cpu::hasSSSE3()) c = deinterleaveRowSSSE3(px, width, b, g, r);
+#endif
+    for (px += c * 3; c < width; ++c, px += 3) {
+        b[c] = px[0];
+        g[c] = px[1];
+        r[c] = px[2];
+    }
+}
+
+void interleaveRow(const uint8_t* b, const uint8_t* g, const uint8_t* r, int width, uint8_t* px) {
+    int c = 0;
+#if ACV_X86
+    if (cpu::hasSSSE3()) c = interleaveRowSSSE3(b, g, r, width, px);
+#endif
+    for (px += c * 3; c < width; ++c, px += 3) {
+        px[0] = b[c];
+        px[1] = g[c];
+        px[2] = r[c];
+    }
+}
+
+void deinterleave(const bmp::BMPImageView& img, PlanarImage& out) {
+    TRACE_SPAN("imgproc: deinterleave");
+    out.resize(img.width, img.height);
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) deinterleaveRow(img.row(r), img.width, out.row(0, r), out.row(1, r), out.row(2, r));
+    });
+}
+
+void interleave(const PlanarImage& img, bmp::BMPImage& out) {
+    TRACE_SPAN("imgproc: interleave");
+    const int rowSize = bmp::rowSizeBytes(img.width());
+    out.width = img.width();
+    out.height = img.height();
+    out.data.resize(static_cast<size_t>(rowSize) * img.height());
+    parallel::parallelRows(img.height(), parallel::kMinRowsPerBand, [&](int begin, int end) {
+        for (int r = begin; r < end; ++r) {
+            uint8_t* px = &out.data[static_cast<size_t>(r) * rowSize];
+            interleaveRow(img.row(0, r), img.row(1, r), img.row(2, r), img.width(), px);
+            std::memset(px + img.width() * 3, 0, rowSize - img.width() * 3);
+        }
+    });
+}
+
+void LazyImage::assign(const bmp::BMPImageView& img) {
+    width_ = img.width;
+    height_ = img.height;
+    view_ = img;
+    ownsInterleaved_ = false;
+    interleavedValid_ = true;
+    planarValid_ = false;
+}
+
+void LazyImage::assign(PlanarImage planes) {
+    width_ = planes.width();
+    height_ = planes.height();
+    planes_ = std::move(planes);
+    view_ = bmp::BMPImageView();
+    ownsInterleaved_ = false;
+    interleavedValid_ = false;
+    planarValid_ = true;
+}
+
+const bmp::BMPImageView& LazyImage::interleaved() {
+    if (!interleavedValid_) {
+        interleave(planes_, owned_);
+        ownsInterleaved_ = true;
+        interleavedValid_ = true;
+        ++conversions_;
+    }
+    if (ownsInterleaved_) view_ = bmp::viewOf(owned_); // owned_ may have a new buffer
+    return view_;
+}
+
+const PlanarImage& LazyImage::planar() {
+    if (!planarValid_) {
+        deinterleave(interleaved(), planes_);
+        planarValid_ = true;
+        ++conversions_;
+    }
+    return planes_;
+}
+
+bmp::BMPImage& LazyImage::editInterleaved() {
+    interleaved();
+    if (!ownsInterleaved_) {
+        view_.materialize(owned_); // the caller's pixels are not ours to change
+        ownsInterleaved_ = true;
+    }
+    planarValid_ = false;
+    return owned_;
+}
+
+PlanarImage& LazyImage::editPlanar() {
+    planar();
+    interleavedValid_ = false;
+    return planes_;
+}
+
+} // namespace imgproc
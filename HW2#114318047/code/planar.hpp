@@ -0,0 +1,179 @@
+#pragma once
+#include <cstddef> // for size_t
+#include <cstdint>
+#include <type_traits> // for std::integral_constant
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImage, bmp::BMPImageView
+
+/********************************************************
+* Filename    : planar.hpp
+* Note        : Planar (one plane per channel) images, the SIMD conversions
+*               to and from the interleaved BGR of the BMP files, and an image
+*               that is only converted when a kernel needs the other layout
+*********************************************************/
+
+namespace imgproc {
+
+// How the pixels of an image are stored
+/*
+    Interleaved   B G R B G R ...   bmp::BMPImage / BMPImageView, the BMP file layout
+    Planar        B B B ... | G G G ... | R R R ...   PlanarImage
+*/
+enum class Layout { Interleaved, Planar };
+
+// Three 8-bit planes (0 = B, 1 = G, 2 = R) of width x height pixels
+/*
+    Rows are bottom-up like BMPImage::data. Every row of every plane starts on a 64-byte
+    boundary and the stride is a multiple of 64 bytes, so a vector load at the start of a
+    row never splits a cache line and a kernel may read whole vectors up to the stride
+    (the bytes past the width hold anything). Channel i uses plane slot planeOf(i), so a
+    permutation of the channels only reorders the slots.
+*/
+class PlanarImage {
+public:
+    PlanarImage() {}
+    PlanarImage(int width, int height); // pixels not initialized
+
+    PlanarImage(const PlanarImage& other);
+    PlanarImage& operator=(const PlanarImage& other);
+    PlanarImage(PlanarImage&&) = default;
+    PlanarImage& operator=(PlanarImage&&) = default;
+
+    // Resize, keeping the buffer when it is large enough; the pixels are not initialized
+    // and the channels go back to slots 0, 1, 2
+    void resize(int width, int height);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t stride() const { return stride_; }
+
+    uint8_t* row(int channel, int r) {
+        return base() + (planeOf_[channel] * static_cast<size_t>(height_) + r) * stride_;
+    }
+    const uint8_t* row(int channel, int r) const {
+        return base() + (planeOf_[channel] * static_cast<size_t>(height_) + r) * stride_;
+    }
+
+    int planeOf(int channel) const { return planeOf_[channel]; }
+
+    // Channel i becomes the old channel order[i]; order must be a permutation of 0, 1, 2
+    // (throws std::invalid_argument otherwise). No pixel is moved
+    void permutePlanes(const int (&order)[3]);
+
+private:
+    uint8_t* base() { return storage_.data() + offset_; }
+    const uint8_t* base() const { return storage_.data() + offset_; }
+
+    int width_ = 0;
+    int height_ = 0;
+    size_t stride_ = 0;
+    int planeOf_[3] = {0, 1, 2};
+    std::vector<uint8_t> storage_; // 63 bytes more than the planes, for the alignment
+    size_t offset_ = 0;            // of the first plane in storage_
+};
+
+// Interleaved BGR -> planes, out keeps its buffer when it is large enough
+/*
+    16 pixels per step with SSSE3 (when the CPU has it): three 16-byte loads, three byte
+    shuffles per plane gather its 16 bytes, one aligned store per plane. Rows are cut into
+    bands on the thread pool.
+*/
+void deinterleave(const bmp::BMPImageView& img, PlanarImage& out);
+
+inline PlanarImage deinterleave(const bmp::BMPImageView& img) {
+    PlanarImage planes;
+    deinterleave(img, planes);
+    return planes;
+}
+
+// One row of width pixels: interleaved BGR -> three plane rows and back (what deinterleave and
+// interleave do to every row); the plane rows must be 16-byte aligned
+void deinterleaveRow(const uint8_t* px, int width, uint8_t* b, uint8_t* g, uint8_t* r);
+void interleaveRow(const uint8_t* b, const uint8_t* g, const uint8_t* r, int width, uint8_t* px);
+
+// Planes -> interleaved BGR with the BMP row padding (zeroed), the inverse of deinterleave;
+// out keeps its buffer when the capacity is large enough
+void interleave(const PlanarImage& img, bmp::BMPImage& out);
+
+inline bmp::BMPImage interleave(const PlanarImage& img) {
+    bmp::BMPImage out;
+    interleave(img, out);
+    return out;
+}
+
+// An image kept in the layouts the kernels asked for
+/*
+    A kernel states the layout it works on and LazyImage converts only when that layout
+    is not up to date: reading a BMP gives the interleaved layout (a view, no copy), a run
+    of planar kernels pays one deinterleave, and the interleaved pixels are only written
+    back when the next interleaved kernel or the BMP writer asks for them.
+
+        struct Blur {
+            static const Layout layout = Layout::Planar;
+            void operator()(const PlanarImage& in, PlanarImage& out) const;
+        };
+        image.run(Blur(), blurred);
+
+    A kernel of layout Interleaved takes a const bmp::BMPImageView& instead. Kernels that
+    change the pixels in place use editPlanar() / editInterleaved(), which mark the other
+    layout stale.
+*/
+class LazyImage {
+public:
+    LazyImage() {}
+    explicit LazyImage(const bmp::BMPImageView& img) { assign(img); }
+
+    LazyImage(const LazyImage&) = delete;
+    LazyImage& operator=(const LazyImage&) = delete;
+    LazyImage(LazyImage&&) = default;
+    LazyImage& operator=(LazyImage&&) = default;
+
+    // Start over from an interleaved image (the view is kept, not copied)
+    void assign(const bmp::BMPImageView& img);
+    // Start over from planes
+    void assign(PlanarImage planes);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    bool upToDate(Layout layout) const { return layout == Layout::Planar ? planarValid_ : interleavedValid_; }
+
+    // The image in one layout, converted from the other one if needed
+    const bmp::BMPImageView& interleaved();
+    const PlanarImage& planar();
+
+    // For kernels that change the pixels in place: the other layout becomes stale
+    // (keep the size, the other layout is converted back at the same size)
+    bmp::BMPImage& editInterleaved();
+    PlanarImage& editPlanar();
+
+    // Conversions done so far (each one is a full pass over the image)
+    int conversions() const { return conversions_; }
+
+    // kernel(image in Kernel::layout, out)
+    template <typename Kernel, typename Out>
+    void run(const Kernel& kernel, Out& out) {
+        runIn(kernel, out, std::integral_constant<Layout, Kernel::layout>());
+    }
+
+private:
+    template <typename Kernel, typename Out>
+    void runIn(const Kernel& kernel, Out& out, std::integral_constant<Layout, Layout::Planar>) {
+        kernel(planar(), out);
+    }
+    template <typename Kernel, typename Out>
+    void runIn(const Kernel& kernel, Out& out, std::integral_constant<Layout, Layout::Interleaved>) {
+        kernel(interleaved(), out);
+    }
+
+    int width_ = 0;
+    int height_ = 0;
+    bmp::BMPImageView view_;   // the caller's interleaved pixels, unless ownsInterleaved_
+    bmp::BMPImage owned_;      // interleaved pixels converted from the planes, or edited
+    bool ownsInterleaved_ = false;
+    PlanarImage planes_;
+    bool interleavedValid_ = false;
+    bool planarValid_ = false;
+    int conversions_ = 0;
+};
+
+} // namespace imgproc
@@ -0,0 +1,293 @@
+#pragma once
+#include <cstddef> // for std::ptrdiff_t
+#include <cstdint>
+#include <cstring> // for std::memcpy
+#include <utility> // for std::declval
+#include "bmp.hpp" // bmp::BMPImage, bmp::BMPImageView, bmp::Strip
+#include "planar.hpp" // imgproc::deinterleaveRow, imgproc::interleaveRow
+#include "thread_pool.hpp" // parallel::parallelRows, parallel::kMinRowsPerBand
+
+/********************************************************
+* Filename    : point_ops.hpp
+* Note        : Per-pixel operations composed at compile time into one loop
+*               over the image (header only)
+*********************************************************/
+
+namespace imgproc {
+namespace ops {
+
+// A pipeline is a chain of point operations ended by a sink
+/*
+    using namespace imgproc::ops;
+    run(img, pipe(intensityAvg, threshold<110>(), toMask), mask);       // HW2 task3 binarization
+    run(strip, pipe(permute<2, 0, 1>(), toBgr));                       // HW1 task3, in place
+    run(img, pipe(luma601, threshold(98), select(white, black), toBgr), out);
+
+    pipe() only builds a type: Compose<Compose<A, B>, C>, every operation an empty or tiny
+    object, so the whole chain inlines into the loop of run(). There is no image between two
+    operations: run() takes 64 pixels of a row at a time, splits them into B, G and R byte
+    arrays, pushes every pixel through the chain and writes the block to the sink. The
+    inner loops have a fixed trip count of 64 and no calls, which is what the vectorizer of
+    -O2 asks for. The operations read and write the caller's BMPImage rows directly (in
+    place when the input and output are the same image).
+
+    An operation is any copyable function object from the value of the one before it:
+    Bgr -> Bgr, Bgr -> int (an intensity), int -> int (0 / 1 after a threshold),
+    int -> Bgr. Keep them branch-free (compares and masks, see Select) or the loop stays scalar.
+*/
+
+// One pixel in a chain; the channels are ints so the operations compute without overflow
+struct Bgr {
+    int b, g, r;
+};
+
+// Operations
+
+// (B + G + R) / 3 rounded down, as HW2's binarization (the divide as a multiply, exact for <= 765)
+struct IntensityAvg {
+    int operator()(const Bgr& p) const {
+        return static_cast<int>((static_cast<unsigned>(p.b + p.g + p.r) * 0xAAABu) >> 17);
+    }
+};
+
+// 0.114 B + 0.587 G + 0.299 R with the 14-bit fixed-point weights of cv::cvtColor(COLOR_BGR2GRAY)
+struct Luma601 {
+    int operator()(const Bgr& p) const { return (1868 * p.b + 9617 * p.g + 4899 * p.r + 8192) >> 14; }
+};
+
+// 1 when the value is > T (a compile-time threshold)
+template <int T>
+struct ThresholdAbove {
+    int operator()(int v) const { return v > T; }
+};
+
+// 1 when the value is > t (a threshold known at run time, e.g. from Otsu)
+struct Threshold {
+    int t;
+    int operator()(int v) const { return v > t; }
+};
+
+// 1 when the pixel is exactly the color value
+struct Equals {
+    Bgr value;
+    int operator()(const Bgr& p) const { return (p.b == value.b) & (p.g == value.g) & (p.r == value.r); }
+};
+
+// Output channel i = input channel I_i (0 = B, 1 = G, 2 = R), the order of imgproc::permuteChannels
+template <int B, int G, int R>
+struct Permute {
+    static_assert(B >= 0 && B < 3 && G >= 0 && G < 3 && R >= 0 && R < 3, "Permute: channels are 0, 1, 2");
+    static int pick(const Bgr& p, int i) { return i == 0 ? p.b : i == 1 ? p.g : p.r; }
+    Bgr operator()(const Bgr& p) const { return Bgr{pick(p, B), pick(p, G), pick(p, R)}; }
+};
+
+// Nonzero -> on, 0 -> off (with a mask instead of a branch, so the loop still vectorizes)
+struct Select {
+    Bgr on, off;
+    Bgr operator()(int v) const {
+        const int m = -static_cast<int>(v != 0);
+        return Bgr{(on.b & m) | (off.b & ~m), (on.g & m) | (off.g & ~m), (on.r & m) | (off.r & ~m)};
+    }
+};
+
+// An intensity on all three channels
+struct Gray3 {
+    Bgr operator()(int v) const { return Bgr{v, v, v}; }
+};
+
+// Sinks: the last element of a pipeline, chosen by run()
+struct ToMask {};      // 0 / 1 -> one bit per pixel, a mask type with BinaryMask's row(r) / width() / height()
+struct ToBgr {};       // Bgr -> a 24-bit bmp::BMPImage (values must be 0..255)
+struct ToGrayBytes {}; // int -> one byte per pixel, a type with GrayImage's width / height / data / row(r)
+
+const IntensityAvg intensityAvg = IntensityAvg();
+const Luma601 luma601 = Luma601();
+const Gray3 gray3 = Gray3();
+const ToMask toMask = ToMask();
+const ToBgr toBgr = ToBgr();
+const ToGrayBytes toGrayBytes = ToGrayBytes();
+
+template <int T>
+ThresholdAbove<T> threshold() { return ThresholdAbove<T>(); }
+
+inline Threshold threshold(int t) { return Threshold{t}; }
+
+template <int B, int G, int R>
+Permute<B, G, R> permute() { return Permute<B, G, R>(); }
+
+inline Equals equals(Bgr value) { return Equals{value}; }
+
+inline Select select(Bgr on, Bgr off) { return Select{on, off}; }
+
+// second(first(value))
+template <typename First, typename Second>
+struct Compose {
+    First first;
+    Second second;
+
+    template <typename In>
+    auto operator()(const In& v) const -> decltype(std::declval<const Second&>()(std::declval<const First&>()(v))) {
+        return second(first(v));
+    }
+};
+
+namespace detail {
+
+// Left fold of the arguments of pipe() into nested Compose
+template <typename... Ops>
+struct Fold;
+
+template <typename Op>
+struct Fold<Op> {
+    typedef Op type;
+    static Op make(const Op& op) { return op; }
+};
+
+template <typename A, typename B, typename... Rest>
+struct Fold<A, B, Rest...> {
+    typedef typename Fold<Compose<A, B>, Rest...>::type type;
+    static type make(const A& a, const B& b, const Rest&... rest) {
+        return Fold<Compose<A, B>, Rest...>::make(Compose<A, B>{a, b}, rest...);
+    }
+};
+
+// Pixels per block; the inner loops run exactly this often
+const int kBlock = 64;
+
+// B, G and R of a block of interleaved pixels as three arrays (split and merged with the
+// SSSE3 shuffles of planar.cpp: the vectorizer cannot do stride-3 byte loads without them)
+struct Block {
+    alignas(16) uint8_t b[kBlock];
+    alignas(16) uint8_t g[kBlock];
+    alignas(16) uint8_t r[kBlock];
+
+    void load(const uint8_t* px, int n) {
+        deinterleaveRow(px, n, b, g, r);
+        for (int i = n; i < kBlock; ++i) b[i] = g[i] = r[i] = 0; // keep the whole-block loops defined
+    }
+
+    void store(uint8_t* px, int n) const { interleaveRow(b, g, r, n, px); }
+};
+
+// 64 bytes of 0 / 1 -> one mask word, bit i = byte i
+inline uint64_t packBits(const uint8_t* ones) {
+    uint64_t word = 0;
+    for (int k = 0; k < kBlock; k += 8) {
+        uint64_t eight;
+        std::memcpy(&eight, ones + k, 8);
+        // little endian: byte j of eight is pixel k + j; the multiply gathers bit 0 of
+        // every byte into the top byte, pixel k + j at bit 56 + j
+        word |= ((eight * 0x0102040810204080ull) >> 56) << k;
+    }
+    return word;
+}
+
+} // namespace detail
+
+// pipe(op1, op2, ..., sink): the chain as one function object
+template <typename... Ops>
+typename detail::Fold<Ops...>::type pipe(const Ops&... ops) {
+    return detail::Fold<Ops...>::make(ops...);
+}
+
+// chain(pixel) > 0 into the bits of out (resized to img unless it has its size already)
+template <typename Chain, typename Mask>
+void run(const bmp::BMPImageView& img, const Compose<Chain, ToMask>& pipeline, Mask& out) {
+    if (out.width() != img.width || out.height() != img.height) out = Mask(img.width, img.height);
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        const Chain chain = pipeline.first; // a local copy: the byte stores cannot alias its parameters
+        detail::Block block;
+        uint8_t ones[detail::kBlock];
+        for (int r = begin; r < end; ++r) {
+            const uint8_t* px = img.row(r);
+            uint64_t* bits = out.row(r);
+            for (int c0 = 0; c0 < img.width; c0 += detail::kBlock) {
+                const int n = img.width - c0 < detail::kBlock ? img.width - c0 : detail::kBlock;
+                block.load(px + 3 * c0, n);
+                for (int i = 0; i < detail::kBlock; ++i) {
+                    ones[i] = static_cast<uint8_t>(chain(Bgr{block.b[i], block.g[i], block.r[i]}) > 0);
+                }
+                const uint64_t word = detail::packBits(ones);
+                // the bits past the width stay 0
+                bits[c0 / detail::kBlock] = n == detail::kBlock ? word : word & ((uint64_t(1) << n) - 1);
+            }
+        }
+    });
+}
+
+// chain(pixel) from height rows of width BGR pixels into the rows at dst; src and dst may be
+// the same rows (in place), the strides may be negative, the row padding is not touched
+template <typename Chain>
+void run(const uint8_t* src, std::ptrdiff_t srcStride, uint8_t* dst, std::ptrdiff_t dstStride, int width,
+         int height, const Compose<Chain, ToBgr>& pipeline) {
+    parallel::parallelRows(height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        const Chain chain = pipeline.first; // a local copy: the byte stores cannot alias its parameters
+        detail::Block in, result;
+        for (int r = begin; r < end; ++r) {
+            const uint8_t* px = src + r * srcStride;
+            uint8_t* out = dst + r * dstStride;
+            for (int c0 = 0; c0 < width; c0 += detail::kBlock) {
+                const int n = width - c0 < detail::kBlock ? width - c0 : detail::kBlock;
+                in.load(px + 3 * c0, n);
+                for (int i = 0; i < detail::kBlock; ++i) {
+                    const Bgr p = chain(Bgr{in.b[i], in.g[i], in.r[i]});
+                    result.b[i] = static_cast<uint8_t>(p.b);
+                    result.g[i] = static_cast<uint8_t>(p.g);
+                    result.r[i] = static_cast<uint8_t>(p.r);
+                }
+                result.store(out + 3 * c0, n);
+            }
+        }
+    });
+}
+
+// Into a new image: out gets the size of img (its buffer is kept when large enough)
+template <typename Chain>
+void run(const bmp::BMPImageView& img, const Compose<Chain, ToBgr>& pipeline, bmp::BMPImage& out) {
+    const int rowSize = bmp::rowSizeBytes(img.width);
+    out.width = img.width;
+    out.height = img.height;
+    out.data.assign(static_cast<size_t>(rowSize) * img.height, 0); // zero row padding
+    run(img.origin, img.stride, out.data.data(), rowSize, img.width, img.height, pipeline);
+}
+
+// In place, on an image or on the strips of bmp::StripReader
+template <typename Chain>
+void run(bmp::BMPImage& img, const Compose<Chain, ToBgr>& pipeline) {
+    const int rowSize = bmp::rowSizeBytes(img.width);
+    run(img.data.data(), rowSize, img.data.data(), rowSize, img.width, img.height, pipeline);
+}
+
+template <typename Chain>
+void run(bmp::Strip& strip, const Compose<Chain, ToBgr>& pipeline) {
+    const int rowSize = bmp::rowSizeBytes(strip.width);
+    run(strip.data.data(), rowSize, strip.data.data(), rowSize, strip.width, strip.rows, pipeline);
+}
+
+// chain(pixel) (0..255) into one byte per pixel of out
+template <typename Chain, typename Gray>
+void run(const bmp::BMPImageView& img, const Compose<Chain, ToGrayBytes>& pipeline, Gray& out) {
+    out.width = img.width;
+    out.height = img.height;
+    out.data.resize(static_cast<size_t>(img.width) * img.height);
+    parallel::parallelRows(img.height, parallel::kMinRowsPerBand, [&](int begin, int end) {
+        const Chain chain = pipeline.first; // a local copy: the byte stores cannot alias its parameters
+        detail::Block block;
+        uint8_t values[detail::kBlock];
+        for (int r = begin; r < end; ++r) {
+            const uint8_t* px = img.row(r);
+            uint8_t* dst = out.row(r);
+            for (int c0 = 0; c0 < img.width; c0 += detail::kBlock) {
+                const int n = img.width - c0 < detail::kBlock ? img.width - c0 : detail::kBlock;
+                block.load(px + 3 * c0, n);
+                for (int i = 0; i < detail::kBlock; ++i) {
+                    values[i] = static_cast<uint8_t>(chain(Bgr{block.b[i], block.g[i], block.r[i]}));
+                }
+                std::memcpy(dst + c0, values, n);
+            }
+        }
+    });
+}
+
+} // namespace ops
+} // namespace imgproc
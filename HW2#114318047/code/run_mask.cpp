@@ -0,0 +1,382 @@
+#include "run_mask.hpp"
+#include "trace.hpp" // TRACE_SPAN
+#include <algorithm> // for std::min, std::max
+#include <stdexcept>
+#include <utility> // for std::swap
+
+namespace imgproc {
+
+namespace {
+
+typedef RunMask::Run Run;
+
+int find(std::vector<int>& parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]]; // path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+// the smaller run index becomes the root, so a root is always the first run of its component
+void unite(std::vector<int>& parent, int a, int b) {
+    a = find(parent, a);
+    b = find(parent, b);
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+}
+
+// Append run to a row under construction, merged with the last run when they meet
+void appendRun(std::vector<Run>& row, int begin, int end) {
+    if (begin >= end) return;
+    if (!row.empty() && begin <= row.back().end) row.back().end = std::max(row.back().end, end);
+    else row.push_back(Run{begin, end});
+}
+
+// Union of two sorted run lists into out (replaced)
+void unionRuns(const Run* a, const Run* aEnd, const Run* b, const Run* bEnd, std::vector<Run>& out) {
+    out.clear();
+    while (a != aEnd || b != bEnd) {
+        const Run* next = b == bEnd || (a != aEnd && a->begin < b->begin) ? a++ : b++;
+        appendRun(out, next->begin, next->end);
+    }
+}
+
+// 1 x k dilation of every row: a run [b, e) covers [b - (k - 1 - k / 2), e + k / 2)
+void dilateRows(const RunMask& src, int k, RunMask& dst) {
+    const int before = k - 1 - k / 2;
+    const int after = k / 2;
+    std::vector<Run> row;
+    dst.reset(src.width(), src.height());
+    for (int r = 0; r < src.height(); ++r) {
+        row.clear();
+        for (const Run* run = src.rowBegin(r); run != src.rowEnd(r); ++run) {
+            appendRun(row, std::max(0, run->begin - before), std::min(src.width(), run->end + after));
+        }
+        for (const Run& run : row) dst.addRun(run.begin, run.end);
+        dst.endRow();
+    }
+}
+
+// k x 1 dilation: output row t = union of the input rows [t - k / 2, t - k / 2 + k - 1]
+/*
+    van Herk / Gil-Werman on rows of runs: q = input row + k / 2 runs over N = height + k - 1
+    positions (rows outside the image are empty), cut into blocks of k; g[q] is the union
+    from the start of q's block to q, h[q] from q to the end of the block, and any window
+    [t, t + k - 1] is h[t] | g[t + k - 1]
+*/
+void dilateColumns(const RunMask& src, int k, RunMask& dst) {
+    const int height = src.height();
+    const int anchor = k / 2;
+    const int n = height + k - 1;
+    std::vector<std::vector<Run>> g(n), h(n);
+    std::vector<Run> merged;
+
+    auto rowOf = [&](int q, const Run*& begin, const Run*& end) {
+        const int r = q - anchor;
+        if (r < 0 || r >= height) {
+            begin = end = nullptr;
+        } else {
+            begin = src.rowBegin(r);
+            end = src.rowEnd(r);
+        }
+    };
+    const Run* begin;
+    const Run* end;
+    for (int q = 0; q < n; ++q) {
+        rowOf(q, begin, end);
+        if (q % k == 0) g[q].assign(begin, end);
+        else unionRuns(g[q - 1].data(), g[q - 1].data() + g[q - 1].size(), begin, end, g[q]);
+    }
+    for (int q = n - 1; q >= 0; --q) {
+        rowOf(q, begin, end);
+        if (q % k == k - 1 || q == n - 1) h[q].assign(begin, end);
+        else unionRuns(h[q + 1].data(), h[q + 1].data() + h[q + 1].size(), begin, end, h[q]);
+    }
+
+    dst.reset(src.width(), height);
+    for (int t = 0; t < height; ++t) {
+        const std::vector<Run>& left = h[t];
+        const std::vector<Run>& right = g[t + k - 1];
+        unionRuns(left.data(), left.data() + left.size(), right.data(), right.data() + right.size(), merged);
+        for (const Run& run : merged) dst.addRun(run.begin, run.end);
+        dst.endRow();
+    }
+}
+
+void checkKernel(int kw, int kh) {
+    if (kw < 1 || kh < 1) {
+        throw std::invalid_argument("RunMask: kernel size must be at least 1");
+    }
+}
+
+// Union-find over the runs of mask; afterwards parent[i] is the root of run i, which is the
+// first run of its component
+void linkRuns(const RunMask& mask, int connectivity, std::vector<int>& parent) {
+    if (connectivity != 4 && connectivity != 8) {
+        throw std::invalid_argument("labelMask: connectivity must be 4 or 8");
+    }
+    // 8-connected runs also meet when one ends right before the other begins (a corner)
+    const int reach = connectivity == 8 ? 1 : 0;
+    const int n = static_cast<int>(mask.runCount());
+    parent.resize(n);
+    for (int i = 0; i < n; ++i) parent[i] = i;
+    if (n == 0) return;
+
+    const Run* base = mask.rowBegin(0);
+    for (int r = 1; r < mask.height(); ++r) {
+        // merge with every touching run of the row below
+        const Run* a = mask.rowBegin(r - 1);
+        const Run* b = mask.rowBegin(r);
+        const Run* aEnd = mask.rowEnd(r - 1);
+        const Run* bEnd = mask.rowEnd(r);
+        while (a != aEnd && b != bEnd) {
+            if (a->begin < b->end + reach && b->begin < a->end + reach) {
+                unite(parent, static_cast<int>(a - base), static_cast<int>(b - base));
+            }
+            if (a->end < b->end) ++a;
+            else ++b;
+        }
+    }
+    // a root comes before its runs, so one pass in order leaves every run pointing at its root
+    for (int i = 0; i < n; ++i) parent[i] = parent[parent[i]];
+}
+
+// linkRuns, then scratch.area[root] = area of the component of root; returns how many
+// components are smaller than minArea
+int componentAreas(const RunMask& mask, int minArea, int connectivity, RunLabelScratch& scratch) {
+    linkRuns(mask, connectivity, scratch.parent);
+    std::vector<int>& area = scratch.area;
+    area.assign(mask.runCount(), 0);
+    size_t i = 0;
+    for (int r = 0; r < mask.height(); ++r) {
+        for (const Run* run = mask.rowBegin(r); run != mask.rowEnd(r); ++run, ++i) {
+            area[scratch.parent[i]] += run->end - run->begin;
+        }
+    }
+    int removed = 0;
+    for (size_t j = 0; j < area.size(); ++j) {
+        if (scratch.parent[j] == static_cast<int>(j) && area[j] < minArea) ++removed;
+    }
+    return removed;
+}
+
+} // namespace
+
+RunMask::RunMask(int width, int height) {
+    reset(width, height);
+    for (int r = 0; r < height; ++r) endRow();
+}
+
+void RunMask::assign(const BinaryMask& mask) {
+    reset(mask.width(), mask.height());
+    for (int r = 0; r < mask.height(); ++r) {
+        for (int c = mask.nextSet(r, 0); c < mask.width(); ) {
+            const int end = mask.nextClear(r, c);
+            runs_.push_back(Run{c, end});
+            c = mask.nextSet(r, end);
+        }
+        endRow();
+    }
+}
+
+void RunMask::reset(int width, int height) {
+    if (width < 0 || height < 0) {
+        throw std::invalid_argument("RunMask: size must not be negative");
+    }
+    width_ = width;
+    height_ = height;
+    runs_.clear();
+    rowStart_.assign(1, 0);
+}
+
+void RunMask::addRun(int begin, int end) {
+    if (begin >= end) return;
+    const size_t first = static_cast<size_t>(rowStart_.back()); // the first run of the current row
+    if (runs_.size() > first && begin <= runs_.back().end) runs_.back().end = std::max(runs_.back().end, end);
+    else runs_.push_back(Run{begin, end});
+}
+
+long long RunMask::count() const {
+    long long n = 0;
+    for (const Run& run : runs_) n += run.end - run.begin;
+    return n;
+}
+
+MaskComponent RunMask::stats() const {
+    MaskComponent comp;
+    bool first = true;
+    for (int r = 0; r < height_; ++r) {
+        for (const Run* run = rowBegin(r); run != rowEnd(r); ++run) {
+            const long long len = run->end - run->begin;
+            if (first) {
+                comp.minR = comp.maxR = r;
+                comp.minC = run->begin;
+                comp.maxC = run->end - 1;
+                first = false;
+            }
+            comp.area += static_cast<int>(len);
+            comp.maxR = r;
+            comp.minC = std::min(comp.minC, run->begin);
+            comp.maxC = std::max(comp.maxC, run->end - 1);
+            comp.sumR += len * r;
+            comp.sumC += (static_cast<long long>(run->begin) + run->end - 1) * len / 2; // begin + ... + end-1
+        }
+    }
+    return comp;
+}
+
+void RunMask::toBinaryMask(BinaryMask& out) const {
+    if (out.width() != width_ || out.height() != height_) {
+        out = BinaryMask(width_, height_);
+    } else {
+        for (int r = 0; r < height_; ++r) out.clearRange(r, 0, width_);
+    }
+    for (int r = 0; r < height_; ++r) {
+        uint64_t* bits = out.row(r);
+        for (const Run* run = rowBegin(r); run != rowEnd(r); ++run) {
+            // whole words at once: the partial words at both ends, ~0 in between
+            const int first = run->begin >> 6, last = (run->end - 1) >> 6;
+            const uint64_t head = ~uint64_t(0) << (run->begin & 63);
+            const uint64_t tail = ~uint64_t(0) >> (63 - ((run->end - 1) & 63));
+            if (first == last) {
+                bits[first] |= head & tail;
+            } else {
+                bits[first] |= head;
+                for (int w = first + 1; w < last; ++w) bits[w] = ~uint64_t(0);
+                bits[last] |= tail;
+            }
+        }
+    }
+}
+
+void RunMask::complement(RunMask& out) const {
+    RunMask result;
+    result.reset(width_, height_);
+    for (int r = 0; r < height_; ++r) {
+        int c = 0;
+        for (const Run* run = rowBegin(r); run != rowEnd(r); ++run) {
+            result.addRun(c, run->begin);
+            c = run->end;
+        }
+        result.addRun(c, width_);
+        result.endRow();
+    }
+    out = std::move(result);
+}
+
+bool RunMask::operator==(const RunMask& other) const {
+    if (width_ != other.width_ || height_ != other.height_ || runs_.size() != other.runs_.size()) return false;
+    if (rowStart_ != other.rowStart_) return false;
+    for (size_t i = 0; i < runs_.size(); ++i) {
+        if (runs_[i].begin != other.runs_[i].begin || runs_[i].end != other.runs_[i].end) return false;
+    }
+    return true;
+}
+
+RunMask runMaskFromBMP(const bmp::BMPImageView& img, bool white) {
+    TRACE_SPAN("imgproc: run mask from BMP");
+    return RunMask(maskFromBMP(img, white));
+}
+
+void dilate(const RunMask& src, RunMask& dst, int kw, int kh) {
+    TRACE_SPAN("imgproc: dilate runs");
+    checkKernel(kw, kh);
+    RunMask rows;
+    dilateRows(src, kw, rows);
+    dilateColumns(rows, kh, dst); // rows is a copy, so dst may be src
+}
+
+void erode(const RunMask& src, RunMask& dst, int kw, int kh) {
+    TRACE_SPAN("imgproc: erode runs");
+    checkKernel(kw, kh);
+    // erosion of the 1s = dilation of the 0s; outside pixels stay 0 in the complement
+    RunMask inverse;
+    src.complement(inverse);
+    dilate(inverse, inverse, kw, kh);
+    inverse.complement(dst);
+}
+
+void labelMask(const RunMask& mask, MaskLabels& out, int connectivity, RunLabelScratch& scratch) {
+    TRACE_SPAN("imgproc: label runs");
+    linkRuns(mask, connectivity, scratch.parent);
+    const std::vector<int>& root = scratch.parent;
+    std::vector<MaskRun>& runs = out.runs;
+    runs.resize(mask.runCount());
+    out.components.clear();
+
+    // roots are the first run of their component, so numbering the roots in run order
+    // numbers the components in raster order of their first pixel
+    size_t i = 0;
+    for (int r = 0; r < mask.height(); ++r) {
+        for (const Run* src = mask.rowBegin(r); src != mask.rowEnd(r); ++src, ++i) {
+            MaskRun& run = runs[i];
+            run.row = r;
+            run.begin = src->begin;
+            run.end = src->end;
+            if (root[i] == static_cast<int>(i)) {
+                run.component = static_cast<int>(out.components.size());
+                MaskComponent comp;
+                comp.minR = comp.maxR = r;
+                comp.minC = run.begin;
+                comp.maxC = run.end - 1;
+                out.components.push_back(comp);
+            } else {
+                run.component = runs[root[i]].component;
+            }
+
+            MaskComponent& comp = out.components[run.component];
+            const long long len = run.end - run.begin;
+            comp.area += static_cast<int>(len);
+            comp.minR = std::min(comp.minR, r);
+            comp.maxR = std::max(comp.maxR, r);
+            comp.minC = std::min(comp.minC, run.begin);
+            comp.maxC = std::max(comp.maxC, run.end - 1);
+            comp.sumR += len * r;
+            comp.sumC += (static_cast<long long>(run.begin) + run.end - 1) * len / 2; // begin + ... + end-1
+        }
+    }
+}
+
+void labelMask(const RunMask& mask, MaskLabels& out, int connectivity) {
+    RunLabelScratch scratch;
+    labelMask(mask, out, connectivity, scratch);
+}
+
+int removeSmallComponents(RunMask& mask, int minArea, int connectivity, RunLabelScratch& scratch) {
+    TRACE_SPAN("imgproc: remove small runs");
+    const int removed = componentAreas(mask, minArea, connectivity, scratch);
+    RunMask& kept = scratch.runs;
+    kept.reset(mask.width(), mask.height());
+    size_t i = 0;
+    for (int r = 0; r < mask.height(); ++r) {
+        for (const Run* run = mask.rowBegin(r); run != mask.rowEnd(r); ++run, ++i) {
+            if (scratch.area[scratch.parent[i]] >= minArea) kept.addRun(run->begin, run->end);
+        }
+        kept.endRow();
+    }
+    std::swap(mask, kept); // the old buffers stay in the scratch for the next call
+    return removed;
+}
+
+int removeSmallComponents(RunMask& mask, int minArea, int connectivity) {
+    RunLabelScratch scratch;
+    return removeSmallComponents(mask, minArea, connectivity, scratch);
+}
+
+int removeSmallComponents(BinaryMask& mask, int minArea, int connectivity, RunLabelScratch& scratch) {
+    TRACE_SPAN("imgproc: remove small runs");
+    RunMask& runs = scratch.runs;
+    runs.assign(mask);
+    const int removed = componentAreas(runs, minArea, connectivity, scratch);
+    if (removed == 0) return 0;
+    size_t i = 0;
+    for (int r = 0; r < runs.height(); ++r) {
+        for (const Run* run = runs.rowBegin(r); run != runs.rowEnd(r); ++run, ++i) {
+            if (scratch.area[scratch.parent[i]] < minArea) mask.clearRange(r, run->begin, run->end);
+        }
+    }
+    return removed;
+}
+
+} // namespace imgproc
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef> // for size_t
+#include <vector>
+#include "bmp.hpp" // bmp::BMPImageView
+#include "binary_mask.hpp" // imgproc::BinaryMask, imgproc::MaskLabels, imgproc::MaskComponent
+
+/********************************************************
+* Filename    : run_mask.hpp
+* Note        : Run-length encoded binary images: the runs of 1 pixels of every
+*               row, with morphology, labelling and statistics working on the
+*               runs instead of the pixels
+*********************************************************/
+
+namespace imgproc {
+
+// A binary image as the runs of 1 pixels of every row
+/*
+    Row r (0 = bottom row, as BinaryMask) holds its runs [begin, end) sorted by column and
+    separated by at least one 0 pixel. All runs sit in one array, row r owns
+    runs [rowStart(r), rowStart(r + 1)), so a road mask of a few long runs per row costs
+    a few bytes per row whatever the width, and every operation below costs O(runs):
+
+    row       0 0 1 1 1 0 0 1 1 0        runs {2, 5} {7, 9}
+*/
+class RunMask {
+public:
+    struct Run {
+        int begin;
+        int end;
+    };
+
+    RunMask() {}
+    RunMask(int width, int height); // all pixels 0
+    // The runs of mask (found a word at a time)
+    explicit RunMask(const BinaryMask& mask) { assign(mask); }
+
+    // Replace the contents by the runs of mask, keeps the buffers
+    void assign(const BinaryMask& mask);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t runCount() const { return runs_.size(); }
+
+    const Run* rowBegin(int r) const { return runs_.data() + rowStart_[r]; }
+    const Run* rowEnd(int r) const { return runs_.data() + rowStart_[r + 1]; }
+
+    // Build row after row: reset, then addRun for the runs of a row (in column order) and
+    // endRow after every row; a run touching the previous one of its row is merged with it
+    void reset(int width, int height); // no rows yet, keeps the buffers
+    void addRun(int begin, int end);
+    void endRow() { rowStart_.push_back(static_cast<int>(runs_.size())); }
+
+    // Number of 1 pixels
+    long long count() const;
+
+    // Area, bounding box and first moments of all the 1 pixels (area 0 when there is none)
+    MaskComponent stats() const;
+
+    // Back to one bit per pixel; out keeps its buffer when it already has the size
+    void toBinaryMask(BinaryMask& out) const;
+
+    // The 0 pixels as runs
+    void complement(RunMask& out) const;
+
+    bool operator==(const RunMask& other) const;
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    std::vector<Run> runs_;
+    std::vector<int> rowStart_ = std::vector<int>(1, 0); // height + 1 entries once built
+};
+
+// 1 where the pixel is exactly white (255, 255, 255), or exactly black when white is false
+RunMask runMaskFromBMP(const bmp::BMPImageView& img, bool white = true);
+
+// Rectangular kw x kh dilation / erosion with the conventions of Morphology (anchor in the
+// center, pixels outside the image never turn a pixel on or off), the same result bit for bit
+/*
+    row pass:    every run grows by the half widths, runs that meet are merged
+    column pass: the van Herk / Gil-Werman scheme of Morphology on whole rows of runs,
+                 with the union of two run lists (a merge) as the OR: two unions per row
+                 whatever kh is
+    erosion:     the complement of the dilation of the complement
+
+    dst may be the same object as src
+*/
+void dilate(const RunMask& src, RunMask& dst, int kw, int kh);
+void erode(const RunMask& src, RunMask& dst, int kw, int kh);
+
+// Working memory of the labelling below: passing the same one again (batch mode keeps one
+// per worker) reuses its buffers, so the calls stop allocating once they are large enough
+struct RunLabelScratch {
+    std::vector<int> parent; // union-find over the runs, then the root run of every run
+    std::vector<int> area;   // area of the component of every root run
+    RunMask runs;            // the runs of a BinaryMask, or the runs removeSmallComponents keeps
+};
+
+// Components of the 1 pixels, connectivity 4 or 8 (std::invalid_argument otherwise)
+/*
+    Union-find over the runs: a run is merged with every run of the row below that shares
+    a column (4) or a column or a corner (8); the components are numbered in raster order
+    of their first pixel, as labelComponents, and their statistics are summed run by run
+*/
+void labelMask(const RunMask& mask, MaskLabels& out, int connectivity, RunLabelScratch& scratch);
+void labelMask(const RunMask& mask, MaskLabels& out, int connectivity = 4);
+
+inline MaskLabels labelMask(const RunMask& mask, int connectivity = 4) {
+    MaskLabels labels;
+    labelMask(mask, labels, connectivity);
+    return labels;
+}
+
+// Drop every component smaller than minArea pixels, returns how many were removed
+// (only the areas are summed, no MaskLabels is built)
+int removeSmallComponents(RunMask& mask, int minArea, int connectivity, RunLabelScratch& scratch);
+int removeSmallComponents(RunMask& mask, int minArea, int connectivity = 4);
+
+// The same on a BinaryMask: its runs are labelled and only the runs of the small components
+// are cleared, with no label image
+int removeSmallComponents(BinaryMask& mask, int minArea, int connectivity, RunLabelScratch& scratch);
+
+} // namespace imgproc
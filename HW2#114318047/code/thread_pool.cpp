@@ -0,0 +1,177 @@
+#include "thread_pool.hpp"
+#include "trace.hpp" // TRACE_SPAN, trace::nameThread
+#include <algorithm> // for std::min, std::max
+#include <cstring> // for std::strcmp, std::strncmp
+#include <memory> // for std::unique_ptr
+#include <stdexcept>
+#include <string>
+
+namespace parallel {
+
+namespace {
+
+// true while this thread runs a band, parallel loops started from there run serially
+thread_local bool inBand = false;
+
+std::mutex poolMutex;
+std::unique_ptr<ThreadPool> sharedPool;
+int sharedThreads = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads < 0) {
+        throw std::invalid_argument("ThreadPool: thread count must not be negative");
+    }
+    if (threads == 0) threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    size_ = threads;
+    workers_.reserve(size_ - 1);
+    for (int i = 1; i < size_; ++i) {
+        workers_.emplace_back([this, i] {
+            trace::nameThread("pool worker " + std::to_string(i));
+            workerLoop();
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& t : workers_) t.join();
+}
+
+int ThreadPool::bands(int height, int grain) const {
+    if (height <= 0) return 0;
+    return std::max(1, std::min(size_, height / std::max(1, grain)));
+}
+
+void ThreadPool::workerLoop() {
+    unsigned long long seen = 0;
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+        // the other threads may have run every band already and the caller may have
+        // returned, then fn_ points to a BandRef that is gone
+        if (pending_ == 0) continue;
+        const BandRef fn = *fn_; // copied while the caller still waits for its bands
+        const int height = height_;
+        const int bands = bands_;
+        ++active_;
+        lock.unlock();
+
+        runBands(fn, height, bands);
+        lock.lock();
+        --active_;
+        lock.unlock();
+        done_.notify_all();
+    }
+}
+
+// Take bands until there are none left (caller and workers)
+void ThreadPool::runBands(BandRef fn, int height, int bands) {
+    while (true) {
+        const int b = next_.fetch_add(1);
+        if (b >= bands) return;
+        inBand = true;
+        try {
+            TRACE_SPAN("pool: band"); // on the thread that ran it, under the kernel's span on the caller
+            fn(b, bandBegin(height, bands, b), bandBegin(height, bands, b + 1));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+        inBand = false;
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last = --pending_ == 0;
+        }
+        if (last) done_.notify_all();
+    }
+}
+
+void ThreadPool::parallelBands(int height, int grain, BandRef fn) {
+    const int n = bands(height, grain);
+    // checked before the try-lock: a band on the submitting thread already owns submit_,
+    // and try_lock on a mutex the thread owns is undefined
+    std::unique_lock<std::mutex> submit;
+    if (n > 1 && !inBand) submit = std::unique_lock<std::mutex>(submit_, std::try_to_lock);
+    if (!submit.owns_lock()) {
+        // same bands, one after the other on this thread
+        for (int b = 0; b < n; ++b) fn(b, bandBegin(height, n, b), bandBegin(height, n, b + 1));
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // workers still leaving the previous loop must not see the new one half set up
+        done_.wait(lock, [&] { return active_ == 0; });
+        fn_ = &fn;
+        height_ = height;
+        bands_ = n;
+        pending_ = n;
+        error_ = nullptr;
+        next_.store(0);
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    runBands(fn, height, n);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&] { return pending_ == 0; });
+        error = error_;
+        error_ = nullptr;
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+ThreadPool& pool() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!sharedPool) sharedPool.reset(new ThreadPool(sharedThreads));
+    return *sharedPool;
+}
+
+void setThreads(int threads) {
+    if (threads < 0) {
+        throw std::invalid_argument("setThreads: thread count must not be negative");
+    }
+    std::lock_guard<std::mutex> lock(poolMutex);
+    sharedThreads = threads;
+    sharedPool.reset(); // created again with the new count on first use
+}
+
+void applyThreadsOption(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* value = nullptr;
+        if (std::strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 == argc) throw std::invalid_argument("--threads needs a number");
+            value = argv[++i];
+        } else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+            value = argv[i] + 10;
+        } else {
+            continue;
+        }
+
+        size_t used = 0;
+        int threads = 0;
+        try {
+            threads = std::stoi(value, &used);
+        } catch (const std::exception&) {
+            used = 0;
+        }
+        if (used == 0 || value[used] != '\0' || threads < 1) {
+            throw std::invalid_argument(std::string("--threads needs a positive number, got ") + value);
+        }
+        setThreads(threads);
+    }
+}
+
+} // namespace parallel
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm> // for std::min, std::max
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+// Default grain of the row loops: with fewer rows than this per band, waking a thread for the
+// band costs more than the band saves on a per-pixel kernel. Kernels whose bands carry extra
+// work per band (halo rows, stripe borders) use a larger grain of their own
+const int kMinRowsPerBand = 16;
+
+// Non-owning reference to a callable fn(band, begin, end)
+/*
+    Unlike std::function it never allocates (a lambda with many captures does not fit
+    the small buffer of std::function), so starting a parallel loop costs no heap
+    allocation. Only valid while the referenced callable is alive, which a loop
+    argument always is: the loop returns before the caller's lambda goes away.
+*/
+class BandRef {
+public:
+    template <typename F>
+    BandRef(const F& fn) : object_(&fn), call_(&invoke<F>) {}
+
+    void operator()(int band, int begin, int end) const { call_(object_, band, begin, end); }
+
+private:
+    template <typename F>
+    static void invoke(const void* fn, int band, int begin, int end) {
+        (*static_cast<const F*>(fn))(band, begin, end);
+    }
+
+    const void* object_;
+    void (*call_)(const void*, int, int, int);
+};
+
+// Persistent worker threads for loops over bands of rows
+/*
+    parallelRows(height, grain, fn) cuts the rows [0, height) into at most size() bands of
+    at least `grain` rows, calls fn(begin, end) once per band and returns when every band
+    is done. The calling thread works on bands too, so a pool of N threads has N - 1 workers.
+
+    Band b of n covers rows [height * b / n, height * (b + 1) / n): the bands only depend on
+    height, grain and size(). Every kernel writes only the rows of its own band, so the
+    output does not depend on the number of threads or on which thread ran which band.
+
+    A parallel loop started from inside a band, or while another thread is already running
+    one on the same pool, runs on the calling thread alone (no nesting, no deadlock).
+    The first exception thrown by a band is rethrown by the caller once all bands are done.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads = 0); // 0 = one per core
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return size_; }
+
+    // Number of bands the loops below cut `height` rows into
+    int bands(int height, int grain) const;
+
+    // First row of band b of n
+    static int bandBegin(int height, int n, int b) {
+        return static_cast<int>(static_cast<long long>(height) * b / n);
+    }
+
+    // fn(begin, end)
+    template <typename F>
+    void parallelRows(int height, int grain, const F& fn) {
+        parallelBands(height, grain, [&fn](int, int begin, int end) { fn(begin, end); });
+    }
+
+    // Same bands, with the band index (for per-band scratch buffers): fn(band, begin, end)
+    void parallelBands(int height, int grain, BandRef fn);
+
+    // For neighbourhood operations: the band writes rows [begin, end) and may read
+    // rows [haloBegin, haloEnd) = [begin - halo, end + halo) clipped to the image,
+    // fn(band, begin, end, haloBegin, haloEnd)
+    template <typename F>
+    void parallelBandsHalo(int height, int grain, int halo, const F& fn) {
+        parallelBands(height, grain, [&fn, height, halo](int band, int begin, int end) {
+            fn(band, begin, end, std::max(0, begin - halo), std::min(height, end + halo));
+        });
+    }
+
+private:
+    void workerLoop();
+    void runBands(BandRef fn, int height, int bands);
+
+    int size_;
+    std::vector<std::thread> workers_;
+
+    std::mutex submit_; // one parallel loop at a time
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stop_ = false;
+    unsigned long long generation_ = 0; // bumped for every loop
+
+    // current loop, set up under mutex_
+    const BandRef* fn_ = nullptr;
+    int height_ = 0;
+    int bands_ = 0;
+    std::atomic<int> next_{0};  // next band to hand out
+    int pending_ = 0;           // bands not finished yet
+    int active_ = 0;            // workers between waking up and running out of bands
+    std::exception_ptr error_;  // first exception thrown by a band
+};
+
+// The pool shared by every kernel, created on first use
+ThreadPool& pool();
+
+// --threads N: number of threads of the shared pool (0 = one per core);
+// replaces the pool, so call it before any kernel runs
+void setThreads(int threads);
+
+template <typename F>
+void parallelRows(int height, int grain, const F& fn) {
+    pool().parallelRows(height, grain, fn);
+}
+
+template <typename F>
+void parallelBands(int height, int grain, const F& fn) {
+    pool().parallelBands(height, grain, BandRef(fn));
+}
+
+template <typename F>
+void parallelBandsHalo(int height, int grain, int halo, const F& fn) {
+    pool().parallelBandsHalo(height, grain, halo, fn);
+}
+
+// Parse "--threads N" (or "--threads=N") from the command line and apply it,
+// other arguments are left alone; throws std::invalid_argument for a bad N
+void applyThreadsOption(int argc, char** argv);
+
+} // namespace parallel